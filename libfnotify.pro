@@ -2,4 +2,5 @@ TEMPLATE = subdirs
 CONFIG += ordered
 SUBDIRS += src/core \
  src/test \
- src/plugins
+ src/plugins \
+ src/tools
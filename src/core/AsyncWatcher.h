@@ -0,0 +1,236 @@
+#ifndef ASYNC_WATCHER_H_
+#define ASYNC_WATCHER_H_
+//
+// C++ Interface: AsyncWatcher
+//
+// Description: 
+//
+//
+// Author: Vitali Lovich <vlovich@gmail.com>, (C) 2008
+//
+// Copyright: See COPYING file that comes with this distribution
+//
+//
+// C++20 coroutine adapters for FileWatcher.  Everything here is inline and is compiled
+// out entirely for older compilers, so the library itself does not need C++20.
+//
+// Usage:
+//
+//   EventBatch batch = co_await nextBatch(*watcher, &executor);
+//   if (batch.isEmpty())
+//       co_return;	// polling was stopped
+//
+//   EventStream events(*watcher, &executor);
+//   while (const FileEvent * event = co_await events.next())
+//       ...;
+//
+#if defined(__cplusplus) && __cplusplus >= 202002L && defined(__has_include)
+#if __has_include(<coroutine>)
+#define FNOTIFY_HAS_COROUTINES 1
+#endif
+#endif
+
+#ifdef FNOTIFY_HAS_COROUTINES
+
+#include <coroutine>
+#include <atomic>
+#include <thread>
+
+#include "FileWatcher.h"
+#include "EventBatch.h"
+#include "BatchQueue.h"
+
+/**
+ * Where awaiting coroutines are resumed.  Without one, they are resumed directly on the
+ * poll thread, in which case they must hand off any blocking work themselves.
+ */
+class ResumeExecutor
+{
+public:
+	virtual ~ResumeExecutor() {}
+	virtual void resume(std::coroutine_handle<> handle) = 0;
+};
+
+/**
+ * Awaitable returned by nextBatch().  The batch is handed from the poll loop straight to
+ * the suspended coroutine - there is no intermediate thread hop or allocation.
+ *
+ * A coroutine suspended here may be destroyed (a cancelled task, shutdown): the waiter is
+ * withdrawn, or if the poll thread has already taken it, the destructor waits for ready()
+ * to let go.  If ready() got to it first it still resumes the coroutine, so destroying a
+ * coroutine while it may be resuming remains the caller's race to avoid.
+ */
+class BatchAwaitable : private BatchQueue::Waiter
+{
+public:
+	BatchAwaitable(FileWatcher & watcher_, ResumeExecutor * executor_) : watcher(watcher_), executor(executor_), state(Idle)
+	{
+	}
+
+	~BatchAwaitable()
+	{
+		if (state.load() != Waiting)
+		{
+			return;
+		}
+		if (watcher.cancelAwait(this))
+		{
+			return;
+		}
+		// the poll thread has taken us - either it hasn't started yet & will back off, or
+		// it's completing us & we wait for it to be done with us
+		int expected = Waiting;
+		int letGo = state.compare_exchange_strong(expected, Abandoned) ? Released : Done;
+		while (state.load() != letGo)
+		{
+			std::this_thread::yield();
+		}
+	}
+
+	BatchAwaitable(const BatchAwaitable &) = delete;
+	BatchAwaitable & operator=(const BatchAwaitable &) = delete;
+
+	bool await_ready() const
+	{
+		return false;
+	}
+
+	bool await_suspend(std::coroutine_handle<> handle_)
+	{
+		handle = handle_;
+		state.store(Waiting);
+		// once registered, ready() may resume (and destroy) us on the poll thread, so
+		// nothing may be touched after this call
+		if (!watcher.awaitBatch(this, result))
+		{
+			state.store(Done);
+			return false;
+		}
+		return true;
+	}
+
+	/**
+	 * @return The next batch, or an empty batch once polling has stopped.
+	 */
+	EventBatch await_resume()
+	{
+		return result;
+	}
+
+private:
+	enum State
+	{
+		Idle,		/**< Not awaited (yet). */
+		Waiting,	/**< Registered with the watcher. */
+		Completing,	/**< ready() is handing the batch over. */
+		Done,		/**< ready() is done with us, or was never needed. */
+		Abandoned,	/**< Being destroyed while ready() has the waiter. */
+		Released	/**< ready() saw that & backed off. */
+	};
+
+	void ready(const EventBatch & batch)
+	{
+		int expected = Waiting;
+		if (!state.compare_exchange_strong(expected, Completing))
+		{
+			// our coroutine is being destroyed - it mustn't be resumed
+			state.store(Released);
+			return;
+		}
+		result = batch;
+		// the destructor may go ahead as soon as we're Done, so nothing of ours is touched
+		// after that
+		ResumeExecutor * resumeOn = executor;
+		std::coroutine_handle<> resumed = handle;
+		state.store(Done);
+		if (resumeOn != nullptr)
+		{
+			resumeOn->resume(resumed);
+		}
+		else
+		{
+			resumed.resume();
+		}
+	}
+
+	FileWatcher & watcher;
+	ResumeExecutor * executor;
+	std::coroutine_handle<> handle;
+	EventBatch result;
+	std::atomic<int> state;
+};
+
+/**
+ * @return An awaitable that completes with the next batch published by watcher.  Cancelled
+ * (completed with an empty batch) by FileWatcher::stopPolling.
+ */
+inline BatchAwaitable nextBatch(FileWatcher & watcher, ResumeExecutor * executor = nullptr)
+{
+	return BatchAwaitable(watcher, executor);
+}
+
+/**
+ * Asynchronous iteration over individual events.  Keeps a reference to the current batch,
+ * so the returned events stay valid until the following next().
+ */
+class EventStream
+{
+public:
+	EventStream(FileWatcher & watcher_, ResumeExecutor * executor_ = nullptr) : watcher(watcher_), executor(executor_), position(0)
+	{
+	}
+
+	class NextAwaitable
+	{
+	public:
+		explicit NextAwaitable(EventStream & stream_) : stream(stream_), pending(stream_.watcher, stream_.executor)
+		{
+		}
+
+		bool await_ready() const
+		{
+			return stream.position < stream.current.size();
+		}
+
+		bool await_suspend(std::coroutine_handle<> handle)
+		{
+			return pending.await_suspend(handle);
+		}
+
+		/**
+		 * @return The next event, or nullptr once polling has stopped.
+		 */
+		const FileEvent * await_resume()
+		{
+			if (stream.position >= stream.current.size())
+			{
+				stream.current = pending.await_resume();
+				stream.position = 0;
+				if (stream.current.isEmpty())
+				{
+					return nullptr;
+				}
+			}
+			return &stream.current.at(stream.position++);
+		}
+
+	private:
+		EventStream & stream;
+		BatchAwaitable pending;
+	};
+
+	NextAwaitable next()
+	{
+		return NextAwaitable(*this);
+	}
+
+private:
+	FileWatcher & watcher;
+	ResumeExecutor * executor;
+	EventBatch current;
+	int position;
+};
+
+#endif /* FNOTIFY_HAS_COROUTINES */
+
+#endif /* ASYNC_WATCHER_H_ */
@@ -0,0 +1,381 @@
+//
+// C++ Implementation: BatchQueue
+//
+// Description: 
+//
+//
+// Author: Vitali Lovich <vlovich@gmail.com>, (C) 2008
+//
+// Copyright: See COPYING file that comes with this distribution
+//
+//
+#include "BatchQueue.h"
+
+#include <QMutexLocker>
+#include <QVector>
+
+#include "WatcherStats.h"
+
+#include <limits.h>
+
+/**
+ * @return Roughly what the event costs to keep queued.
+ */
+static inline qint64 eventBytes(const FileEvent & event)
+{
+	return sizeof(FileEvent) + event.nativePath().size() + event.nativeOtherPath().size();
+}
+
+static qint64 batchBytes(const EventBatch & batch)
+{
+	qint64 total = 0;
+	const FileEvent * events = batch.constData();
+	for (int i = 0; i < batch.size(); ++i)
+	{
+		total += eventBytes(events[i]);
+	}
+	return total;
+}
+
+BatchQueue::BatchQueue()
+	: active(false), cancelled(false), maxEvents(0), maxBytes(0), policy(Block), events(0), bytes(0), mostEvents(0), mostBytes(0), nextSerial(0)
+{
+}
+
+BatchQueue::~BatchQueue()
+{
+	Q_ASSERT_X(waiters.isEmpty(), "BatchQueue destruction", "waiters must be cancelled before the watcher goes away");
+}
+
+bool BatchQueue::isActive() const
+{
+	return active;
+}
+
+void BatchQueue::setLimits(int maxEvents_, qint64 maxBytes_, Policy policy_)
+{
+	QMutexLocker locker(&lock);
+	maxEvents = qMax(maxEvents_, 0);
+	maxBytes = qMax(maxBytes_, (qint64)0);
+	if (policy_ != policy)
+	{
+		// only kept up while coalescing - what's there may have missed events since
+		lastQueued.clear();
+	}
+	policy = policy_;
+	// whoever is blocked may fit now
+	room.wakeAll();
+}
+
+bool BatchQueue::fits(int moreEvents, qint64 moreBytes) const
+{
+	return (maxEvents == 0 || events + moreEvents <= maxEvents) && (maxBytes == 0 || bytes + moreBytes <= maxBytes);
+}
+
+void BatchQueue::push(const EventBatch & batch, bool canBlock, Overflow * overflow)
+{
+	Q_ASSERT(!batch.isEmpty());
+
+	Overflow result;
+	qint64 size = batchBytes(batch);
+	QMutexLocker locker(&lock);
+	// waiters only ever wait on an empty queue, so there is only room to make if there are none
+	if (!batches.isEmpty() && !fits(batch.size(), size))
+	{
+		Policy overflowPolicy = policy;
+		if (policy == Block && !canBlock)
+		{
+			overflowPolicy = Coalesce;
+			result.blockRefused = true;
+		}
+		if (overflowPolicy == Block)
+		{
+			quint64 start = monotonicNanos();
+			while (!cancelled && !batches.isEmpty() && !fits(batch.size(), size))
+			{
+				room.wait(&lock);
+			}
+			result.blockedNanos = monotonicNanos() - start;
+		}
+		else
+		{
+			if (overflowPolicy == Coalesce)
+			{
+				result.coalesced = coalesce(batch, result.dropped);
+			}
+			else
+			{
+				result.dropped = batch.size();
+			}
+			if (overflow != NULL)
+			{
+				*overflow = result;
+			}
+			return;
+		}
+	}
+
+	if (waiters.isEmpty())
+	{
+		queue(batch, size);
+		available.wakeOne();
+		locker.unlock();
+	}
+	else
+	{
+		Waiter * waiter = waiters.takeFirst();
+		locker.unlock();
+
+		waiter->ready(batch);
+	}
+	if (overflow != NULL)
+	{
+		*overflow = result;
+	}
+}
+
+void BatchQueue::queue(const EventBatch & batch, qint64 size)
+{
+	if (policy == Coalesce)
+	{
+		const FileEvent * queued = batch.constData();
+		for (int i = 0; i < batch.size(); ++i)
+		{
+			index(queued[i], nextSerial + i, lastQueued);
+		}
+	}
+	nextSerial += batch.size();
+
+	batches += batch;
+	events += batch.size();
+	bytes += size;
+	mostEvents = qMax(mostEvents, events);
+	mostBytes = qMax(mostBytes, bytes);
+}
+
+void BatchQueue::index(const FileEvent & event, qint64 serial, QHash<QByteArray, Queued> & into)
+{
+	Queued entry;
+	entry.serial = serial;
+	entry.event = event;
+	into.insert(event.nativePath(), entry);
+	if (!event.nativeOtherPath().isEmpty())
+	{
+		into.insert(event.nativeOtherPath(), entry);
+	}
+}
+
+bool BatchQueue::lastFor(const QByteArray & path, const QHash<QByteArray, Queued> & incoming, Queued & last) const
+{
+	QHash<QByteArray, Queued>::const_iterator found = incoming.constFind(path);
+	if (found != incoming.constEnd())
+	{
+		last = found.value();
+		return true;
+	}
+	found = lastQueued.constFind(path);
+	// anything older has been taken already
+	if (found != lastQueued.constEnd() && found.value().serial >= nextSerial - events)
+	{
+		last = found.value();
+		return true;
+	}
+	return false;
+}
+
+bool BatchQueue::repeats(const FileEvent & event, const QHash<QByteArray, Queued> & incoming) const
+{
+	Queued last;
+	if (!lastFor(event.nativePath(), incoming, last))
+	{
+		return false;
+	}
+	const FileEvent & previous = last.event;
+	if (previous.type() != event.type() || previous.nativePath() != event.nativePath() || previous.nativeOtherPath() != event.nativeOtherPath())
+	{
+		return false;
+	}
+	if (event.nativeOtherPath().isEmpty())
+	{
+		return true;
+	}
+	// a move repeats only if nothing happened to where it went either
+	Queued other;
+	return lastFor(event.nativeOtherPath(), incoming, other) && other.serial == last.serial;
+}
+
+int BatchQueue::coalesce(const EventBatch & batch, int & dropped)
+{
+	// repeats are merged into the event already queued, as long as nothing else happened to
+	// the path in between - up to then the two say the same thing
+	QVector<FileEvent> kept;
+	QHash<QByteArray, Queued> incoming;
+	const FileEvent * pending = batch.constData();
+	for (int i = 0; i < batch.size(); ++i)
+	{
+		if (!repeats(pending[i], incoming))
+		{
+			index(pending[i], nextSerial + kept.size(), incoming);
+			kept += pending[i];
+		}
+	}
+	int coalesced = batch.size() - kept.size();
+
+	// still too much - the newest go
+	qint64 size = 0;
+	for (int i = 0; i < kept.size(); ++i)
+	{
+		size += eventBytes(kept.at(i));
+	}
+	dropped = 0;
+	while (!kept.isEmpty() && !fits(kept.size(), size))
+	{
+		size -= eventBytes(kept.last());
+		kept.remove(kept.size() - 1);
+		++dropped;
+	}
+	if (!kept.isEmpty())
+	{
+		queue(EventBatch(kept), size);
+	}
+
+	// entries for events taken since linger until their path comes up again
+	if (lastQueued.size() > 2 * qMax(events, COALESCE_INDEX_SLACK))
+	{
+		qint64 oldest = nextSerial - events;
+		QHash<QByteArray, Queued>::iterator i = lastQueued.begin();
+		while (i != lastQueued.end())
+		{
+			if (i.value().serial < oldest)
+			{
+				i = lastQueued.erase(i);
+			}
+			else
+			{
+				++i;
+			}
+		}
+	}
+	return coalesced;
+}
+
+EventBatch BatchQueue::take()
+{
+	EventBatch batch = batches.takeFirst();
+	events -= batch.size();
+	bytes -= batchBytes(batch);
+	if (batches.isEmpty())
+	{
+		lastQueued.clear();
+	}
+	room.wakeAll();
+	return batch;
+}
+
+bool BatchQueue::tryPop(EventBatch & batch)
+{
+	QMutexLocker locker(&lock);
+	active = true;
+	if (batches.isEmpty())
+	{
+		return false;
+	}
+	batch = take();
+	return true;
+}
+
+EventBatch BatchQueue::pop(int timeout)
+{
+	QMutexLocker locker(&lock);
+	active = true;
+	while (batches.isEmpty() && !cancelled)
+	{
+		if (!available.wait(&lock, timeout < 0 ? ULONG_MAX : (unsigned long)timeout))
+		{
+			break;
+		}
+	}
+	if (batches.isEmpty())
+	{
+		return EventBatch();
+	}
+	return take();
+}
+
+bool BatchQueue::await(Waiter * waiter, EventBatch & immediate)
+{
+	Q_ASSERT(waiter != NULL);
+
+	QMutexLocker locker(&lock);
+	active = true;
+	if (!batches.isEmpty())
+	{
+		immediate = take();
+		return false;
+	}
+	if (cancelled)
+	{
+		immediate = EventBatch();
+		return false;
+	}
+	waiters += waiter;
+	return true;
+}
+
+bool BatchQueue::cancel(Waiter * waiter)
+{
+	QMutexLocker locker(&lock);
+	return waiters.removeOne(waiter);
+}
+
+void BatchQueue::cancel()
+{
+	QMutexLocker locker(&lock);
+	cancelled = true;
+	QList<Waiter *> pending = waiters;
+	waiters.clear();
+	available.wakeAll();
+	room.wakeAll();
+	locker.unlock();
+
+	foreach(Waiter * waiter, pending)
+	{
+		waiter->ready(EventBatch());
+	}
+}
+
+bool BatchQueue::isCancelled() const
+{
+	QMutexLocker locker(&lock);
+	return cancelled;
+}
+
+int BatchQueue::size() const
+{
+	QMutexLocker locker(&lock);
+	return batches.size();
+}
+
+int BatchQueue::queuedEvents() const
+{
+	QMutexLocker locker(&lock);
+	return events;
+}
+
+qint64 BatchQueue::queuedBytes() const
+{
+	QMutexLocker locker(&lock);
+	return bytes;
+}
+
+int BatchQueue::peakEvents() const
+{
+	QMutexLocker locker(&lock);
+	return mostEvents;
+}
+
+qint64 BatchQueue::peakBytes() const
+{
+	QMutexLocker locker(&lock);
+	return mostBytes;
+}
@@ -0,0 +1,234 @@
+#ifndef BATCH_QUEUE_H_
+#define BATCH_QUEUE_H_
+//
+// C++ Interface: BatchQueue
+//
+// Description: 
+//
+//
+// Author: Vitali Lovich <vlovich@gmail.com>, (C) 2008
+//
+// Copyright: See COPYING file that comes with this distribution
+//
+//
+#include <QList>
+#include <QHash>
+#include <QByteArray>
+#include <QMutex>
+#include <QWaitCondition>
+
+#include "EventBatch.h"
+
+/**
+ * How many stale entries the index of queued paths keeps at least before they're purged.
+ */
+#ifndef COALESCE_INDEX_SLACK
+#define COALESCE_INDEX_SLACK 1024
+#endif /* COALESCE_INDEX_SLACK */
+
+/**
+ * Hands the batches published by the poll loop to consumers that pull them, either by
+ * blocking or by registering a waiter that is completed from the poll thread.  Each
+ * batch goes to exactly one consumer.
+ *
+ * The queue only starts collecting batches once a consumer has asked for one, so watchers
+ * that are only used through signals or listeners don't accumulate anything.  It can be
+ * bounded by the number of events and the memory they take (@see setLimits).
+ */
+class BatchQueue
+{
+public:
+	/**
+	 * What push() does when a batch doesn't fit.
+	 */
+	enum Policy
+	{
+		Block,		/**< Waits for consumers to make room. */
+		Coalesce,	/**< Merges an event into the same event last queued for its path, as long as nothing else happened to the path in between, then drops the newest events if that's not enough. */
+		Drop		/**< Drops the batch. */
+	};
+
+	/**
+	 * What push() had to do to stay within the limits.
+	 */
+	struct Overflow
+	{
+		Overflow() : coalesced(0), dropped(0), blockedNanos(0), blockRefused(false) {}
+
+		int coalesced;		/**< Queued events merged away. */
+		int dropped;		/**< Events thrown away. */
+		quint64 blockedNanos;	/**< How long it waited for room. */
+		bool blockRefused;	/**< Whether it would have waited, but the caller couldn't. */
+	};
+
+	/**
+	 * Completion callback for asynchronous consumers (@see FileWatcher::awaitBatch).
+	 */
+	class Waiter
+	{
+	public:
+		virtual ~Waiter() {}
+
+		/**
+		 * Called exactly once per registration, from the poll thread (or the thread that
+		 * stopped polling).
+		 *
+		 * @param batch The batch handed to this waiter, or an empty batch if polling was
+		 * stopped before one arrived.
+		 */
+		virtual void ready(const EventBatch & batch) = 0;
+	};
+
+	BatchQueue();
+	~BatchQueue();
+
+	/**
+	 * @return Whether a consumer has ever asked for a batch.
+	 */
+	bool isActive() const;
+
+	/**
+	 * @param maxEvents The most events that may be queued, or 0 for no limit (the default).
+	 * @param maxBytes The most memory the queued events may take, or 0 for no limit (the
+	 * default).  Counts the events and their paths.
+	 */
+	void setLimits(int maxEvents, qint64 maxBytes, Policy policy);
+
+	/**
+	 * Gives batch to the oldest waiter, or queues it if there is none.  A batch that is
+	 * larger than the limits on its own is queued whole once the queue is empty.
+	 *
+	 * @param canBlock False if the caller mustn't wait - it is the consumer's thread as well,
+	 * or serves others that would wait with it - in which case Block coalesces instead.
+	 * @param overflow If not NULL, receives what had to be done to stay within the limits.
+	 */
+	void push(const EventBatch & batch, bool canBlock = true, Overflow * overflow = NULL);
+
+	/**
+	 * Takes the oldest queued batch without blocking.
+	 *
+	 * @return False if nothing was queued.
+	 */
+	bool tryPop(EventBatch & batch);
+
+	/**
+	 * Blocks until a batch is available, the timeout expires or the queue is cancelled.
+	 *
+	 * @param timeout In milliseconds, or -1 to wait forever.
+	 * @return The batch, or an empty batch on timeout or cancellation.
+	 */
+	EventBatch pop(int timeout);
+
+	/**
+	 * Registers waiter to be completed with the next batch.  If a batch is already queued
+	 * (or the queue is cancelled) the waiter is not registered - the batch (or an empty
+	 * batch) is stored in immediate instead.
+	 *
+	 * @return Whether the waiter was registered.  If it was, ready() may be called from
+	 * another thread before this returns.
+	 */
+	bool await(Waiter * waiter, EventBatch & immediate);
+
+	/**
+	 * Withdraws a waiter that has not been completed yet.
+	 *
+	 * @return False if the waiter was already completed (or is being completed).
+	 */
+	bool cancel(Waiter * waiter);
+
+	/**
+	 * Completes every waiter with an empty batch and makes subsequent requests return
+	 * immediately.  Batches that were already queued can still be taken.
+	 */
+	void cancel();
+
+	bool isCancelled() const;
+
+	/**
+	 * @return The number of batches waiting to be taken.
+	 */
+	int size() const;
+
+	/**
+	 * @return The events waiting to be taken, and the memory they take.
+	 */
+	int queuedEvents() const;
+	qint64 queuedBytes() const;
+
+	/**
+	 * @return The most there have ever been at once.
+	 */
+	int peakEvents() const;
+	qint64 peakBytes() const;
+
+private:
+	mutable QMutex lock;
+	QWaitCondition available;
+
+	/**
+	 * Signalled whenever a batch is taken.
+	 */
+	QWaitCondition room;
+
+	QList<EventBatch> batches;
+	QList<Waiter *> waiters;
+	volatile bool active;
+	bool cancelled;
+
+	int maxEvents;
+	qint64 maxBytes;
+	Policy policy;
+
+	int events;
+	qint64 bytes;
+	int mostEvents;
+	qint64 mostBytes;
+
+	/**
+	 * The last event queued for a path, numbered in the order events were queued.
+	 */
+	struct Queued
+	{
+		qint64 serial;
+		FileEvent event;
+	};
+
+	/**
+	 * The last event queued for each path (both paths of a move), kept up while coalescing.
+	 * Entries older than the oldest event still queued are stale.
+	 */
+	QHash<QByteArray, Queued> lastQueued;
+
+	/**
+	 * The number the next event queued gets.  The events still queued are the last
+	 * `events` numbered.
+	 */
+	qint64 nextSerial;
+
+	/**
+	 * @return Whether that many more would still be within the limits.
+	 */
+	bool fits(int moreEvents, qint64 moreBytes) const;
+
+	/**
+	 * Queues batch without the events that repeat the last one for their path, dropping
+	 * the newest events if it still doesn't fit.
+	 *
+	 * @param dropped Receives the number of events dropped.
+	 * @return The number of events merged away.
+	 */
+	int coalesce(const EventBatch & batch, int & dropped);
+
+	/**
+	 * @return Whether event is the same as the last one for its path (and for where it was
+	 * moved to), looking at incoming before what's queued.
+	 */
+	bool repeats(const FileEvent & event, const QHash<QByteArray, Queued> & incoming) const;
+	bool lastFor(const QByteArray & path, const QHash<QByteArray, Queued> & incoming, Queued & last) const;
+	static void index(const FileEvent & event, qint64 serial, QHash<QByteArray, Queued> & into);
+
+	EventBatch take();
+	void queue(const EventBatch & batch, qint64 size);
+};
+
+#endif /* BATCH_QUEUE_H_ */
@@ -0,0 +1,126 @@
+//
+// C++ Implementation: DeliveryController
+//
+// Description:
+//
+//
+// Author: Vitali Lovich <vlovich@gmail.com>, (C) 2008
+//
+// Copyright: See COPYING file that comes with this distribution
+//
+//
+#include "DeliveryController.h"
+
+#include <math.h>
+
+static const double WINDOW_NANOS = ADAPTIVE_RATE_WINDOW_MS * 1e6;
+
+DeliveryController::DeliveryController()
+	: idleMs(1), stormMs(50), eventRate(0), lastUpdate(0), currentMode(LowLatency), delayMicros(0), batchTarget(1)
+{
+}
+
+void DeliveryController::setLatencyBounds(int idleMs_, int stormMs_)
+{
+	QMutexLocker locker(&boundsLock);
+	idleMs = qMax(idleMs_, 1);
+	stormMs = qMax(stormMs_, idleMs);
+}
+
+int DeliveryController::idleLatency() const
+{
+	QMutexLocker locker(&boundsLock);
+	return idleMs;
+}
+
+int DeliveryController::stormLatency() const
+{
+	QMutexLocker locker(&boundsLock);
+	return stormMs;
+}
+
+void DeliveryController::update(int events, int queued, quint64 now)
+{
+	// exponentially weighted: decays over the window, each event adds 1 / window
+	if (lastUpdate != 0 && now > lastUpdate)
+	{
+		eventRate *= exp(-(double)(now - lastUpdate) / WINDOW_NANOS);
+	}
+	lastUpdate = now;
+	eventRate += events / (WINDOW_NANOS / 1e9);
+
+	// taken together, so that a concurrent setLatencyBounds can't leave storm below idle
+	boundsLock.lock();
+	int idle = idleMs;
+	int storm = stormMs;
+	boundsLock.unlock();
+
+	Mode next;
+	double delayMs;
+	if (queued >= ADAPTIVE_DEEP_QUEUE || eventRate >= ADAPTIVE_STORM_RATE)
+	{
+		next = Throughput;
+		delayMs = storm;
+	}
+	else if (eventRate <= ADAPTIVE_CALM_RATE)
+	{
+		next = LowLatency;
+		delayMs = 0;
+	}
+	else
+	{
+		// as far between the bounds as the rate is between calm & storm, on a log scale
+		double position = log(eventRate / ADAPTIVE_CALM_RATE) / log((double)ADAPTIVE_STORM_RATE / ADAPTIVE_CALM_RATE);
+		next = Balanced;
+		delayMs = idle * pow((double)storm / idle, position);
+	}
+
+	delayMicros = (int)(delayMs * 1000);
+	batchTarget = next == LowLatency ? 1 : qBound(1, (int)(eventRate * delayMs / 1000), ADAPTIVE_MAX_BATCH);
+	currentMode = next;
+}
+
+bool DeliveryController::shouldFlush(int pending, quint64 heldSince, quint64 now) const
+{
+	if (pending == 0)
+	{
+		return false;
+	}
+	return pending >= batchTarget || now >= heldSince + (quint64)delayMicros * 1000;
+}
+
+int DeliveryController::timeout(int pending, quint64 heldSince, quint64 now, int maximum) const
+{
+	if (pending == 0)
+	{
+		return maximum;
+	}
+	quint64 due = heldSince + (quint64)delayMicros * 1000;
+	if (due <= now)
+	{
+		return 0;
+	}
+	// rounded up, so that the loop doesn't wake up just short of it
+	quint64 remaining = (due - now + 999999) / 1000000;
+	return (int)qMin(remaining, (quint64)qMax(maximum, 0));
+}
+
+DeliveryController::Mode DeliveryController::mode() const
+{
+	return (Mode)currentMode;
+}
+
+double DeliveryController::rate() const
+{
+	return eventRate;
+}
+
+int DeliveryController::delay() const
+{
+	return delayMicros;
+}
+
+int DeliveryController::batchSize() const
+{
+	return batchTarget;
+}
@@ -0,0 +1,139 @@
+#ifndef DELIVERY_CONTROLLER_H_
+#define DELIVERY_CONTROLLER_H_
+//
+// C++ Interface: DeliveryController
+//
+// Description:
+//
+//
+// Author: Vitali Lovich <vlovich@gmail.com>, (C) 2008
+//
+// Copyright: See COPYING file that comes with this distribution
+//
+//
+#include <QtGlobal>
+#include <QMutex>
+
+/**
+ * Events per second at or below which every read is delivered straight away.
+ */
+#ifndef ADAPTIVE_CALM_RATE
+#define ADAPTIVE_CALM_RATE 1000
+#endif /* ADAPTIVE_CALM_RATE */
+
+/**
+ * Events per second at or above which events are held for as long as the storm latency
+ * bound allows.
+ */
+#ifndef ADAPTIVE_STORM_RATE
+#define ADAPTIVE_STORM_RATE 50000
+#endif /* ADAPTIVE_STORM_RATE */
+
+/**
+ * Events waiting to be pulled at or above which consumers are taken to be behind, and
+ * batches are made as large as they can be whatever the rate.
+ */
+#ifndef ADAPTIVE_DEEP_QUEUE
+#define ADAPTIVE_DEEP_QUEUE 10000
+#endif /* ADAPTIVE_DEEP_QUEUE */
+
+/**
+ * The time constant, in milliseconds, of the moving average the rate is measured with.
+ */
+#ifndef ADAPTIVE_RATE_WINDOW_MS
+#define ADAPTIVE_RATE_WINDOW_MS 100
+#endif /* ADAPTIVE_RATE_WINDOW_MS */
+
+/**
+ * The largest batch held back for.
+ */
+#ifndef ADAPTIVE_MAX_BATCH
+#define ADAPTIVE_MAX_BATCH 65536
+#endif /* ADAPTIVE_MAX_BATCH */
+
+/**
+ * Decides how long the poll loop holds events back to make larger batches.  At low rates
+ * every read is delivered as soon as it's parsed.  As the rate grows, the delay grows
+ * (geometrically) from the idle latency bound to the storm one, and a batch is delivered
+ * as soon as it holds what that delay is expected to bring in - so the bounds are never
+ * exceeded, and batches only get large when the events are there to fill them.
+ *
+ * Only used from the poll thread, except for the accessors and setLatencyBounds.
+ *
+ * @see FileWatcher::setAdaptiveBatching
+ */
+class DeliveryController
+{
+public:
+	enum Mode
+	{
+		LowLatency,	/**< Every read is delivered straight away. */
+		Balanced,	/**< Events are held for part of the storm bound. */
+		Throughput	/**< Events are held for as long as the storm bound allows. */
+	};
+
+	DeliveryController();
+
+	/**
+	 * @param idleMs The most events may be held once the rate picks up.  1 by default.
+	 * @param stormMs The most events may be held, under the heaviest load.  50 by default.
+	 *
+	 * Safe to call from any thread - the poll thread picks both up together on its next pass.
+	 */
+	void setLatencyBounds(int idleMs, int stormMs);
+	int idleLatency() const;
+	int stormLatency() const;
+
+	/**
+	 * Takes note of a pass of the poll loop.
+	 *
+	 * @param events The events it brought in.
+	 * @param queued The events waiting for consumers to pull them.
+	 * @param now @see monotonicNanos
+	 */
+	void update(int events, int queued, quint64 now);
+
+	/**
+	 * @param pending The events held.
+	 * @param heldSince When the oldest of them was held.
+	 * @return Whether they should be delivered now.
+	 */
+	bool shouldFlush(int pending, quint64 heldSince, quint64 now) const;
+
+	/**
+	 * @return How long, in milliseconds, the poll loop may wait for more events before the
+	 * held ones are due - never more than maximum.
+	 */
+	int timeout(int pending, quint64 heldSince, quint64 now, int maximum) const;
+
+	Mode mode() const;
+
+	/**
+	 * @return The measured rate, in events per second.
+	 */
+	double rate() const;
+
+	/**
+	 * @return How long events may currently be held, in microseconds, and how many make a
+	 * batch worth delivering early.
+	 */
+	int delay() const;
+	int batchSize() const;
+
+private:
+	/**
+	 * Guards the bounds, which are set from any thread.
+	 */
+	mutable QMutex boundsLock;
+	int idleMs;
+	int stormMs;
+
+	double eventRate;
+	quint64 lastUpdate;
+
+	volatile int currentMode;
+	volatile int delayMicros;
+	volatile int batchTarget;
+};
+
+#endif /* DELIVERY_CONTROLLER_H_ */
@@ -0,0 +1,140 @@
+//
+// C++ Implementation: EventBatch
+//
+// Description: 
+//
+//
+// Author: Vitali Lovich <vlovich@gmail.com>, (C) 2008
+//
+// Copyright: See COPYING file that comes with this distribution
+//
+//
+#include "EventBatch.h"
+
+#include <QMutex>
+#include <QMutexLocker>
+
+/**
+ * Bounds on what is kept for reuse, so that a burst of events doesn't pin its memory
+ * forever.
+ */
+static const int MAX_POOLED_BATCHES = 16;
+static const int MAX_POOLED_EVENTS = 4096;
+
+/**
+ * Released batch storage, ready to be filled again.  Batches can be released from any
+ * thread, hence the lock - it's only ever held for a push or a pop.
+ */
+struct BatchPool
+{
+	BatchPool()
+	{
+		free.reserve(MAX_POOLED_BATCHES);
+	}
+
+	~BatchPool()
+	{
+		qDeleteAll(free);
+	}
+
+	QMutex lock;
+	QVector<EventBatch::Data *> free;
+};
+
+static BatchPool pool;
+
+EventBatch::EventBatch() : d(NULL)
+{
+	// empty batches are common (every poll that only read filtered events), so they
+	// don't get any storage
+}
+
+EventBatch::EventBatch(QVector<FileEvent> & pending) : d(NULL)
+{
+	{
+		QMutexLocker locker(&pool.lock);
+		if (!pool.free.isEmpty())
+		{
+			d = pool.free.last();
+			pool.free.pop_back();
+		}
+	}
+	if (d == NULL)
+	{
+		d = new Data;
+	}
+	d->ref.ref();
+
+	// pending gets the (empty) recycled storage in exchange
+	Q_ASSERT(d->events.isEmpty());
+	qSwap(d->events, pending);
+}
+
+EventBatch::EventBatch(const EventBatch & other) : d(other.d)
+{
+	if (d != NULL)
+	{
+		d->ref.ref();
+	}
+}
+
+EventBatch::~EventBatch()
+{
+	release(d);
+}
+
+EventBatch & EventBatch::operator=(const EventBatch & other)
+{
+	if (other.d != NULL)
+	{
+		other.d->ref.ref();
+	}
+	release(d);
+	d = other.d;
+	return *this;
+}
+
+void EventBatch::release(Data * data)
+{
+	if (data == NULL || data->ref.deref())
+	{
+		return;
+	}
+
+	// reserving marks the vector as having a fixed capacity, so that emptying it destroys
+	// the events without giving back the memory they were stored in
+	data->events.reserve(data->events.capacity());
+	data->events.resize(0);
+
+	if (data->events.capacity() <= MAX_POOLED_EVENTS)
+	{
+		QMutexLocker locker(&pool.lock);
+		if (pool.free.size() < MAX_POOLED_BATCHES)
+		{
+			pool.free.push_back(data);
+			return;
+		}
+	}
+	delete data;
+}
+
+bool EventBatch::isEmpty() const
+{
+	return d == NULL || d->events.isEmpty();
+}
+
+int EventBatch::size() const
+{
+	return d != NULL ? d->events.size() : 0;
+}
+
+const FileEvent & EventBatch::at(int i) const
+{
+	Q_ASSERT(i >= 0 && i < size());
+	return d->events.at(i);
+}
+
+const FileEvent * EventBatch::constData() const
+{
+	return d != NULL ? d->events.constData() : NULL;
+}
@@ -0,0 +1,71 @@
+#ifndef EVENT_BATCH_H_
+#define EVENT_BATCH_H_
+//
+// C++ Interface: EventBatch
+//
+// Description: 
+//
+//
+// Author: Vitali Lovich <vlovich@gmail.com>, (C) 2008
+//
+// Copyright: See COPYING file that comes with this distribution
+//
+//
+#include <QVector>
+#include <QSharedData>
+
+#include "FileEvent.h"
+
+/**
+ * An immutable, reference-counted list of events produced by one pass of the poll loop.
+ * Copying a batch only bumps the reference count, so the same batch can be handed to
+ * any number of subscribers (on any thread) without copying the events themselves.
+ *
+ * Once the last copy is released, the events are destroyed in one go and the batch's
+ * storage goes back to a small pool, so that a steady stream of batches doesn't keep
+ * going back to the heap for them.
+ */
+class EventBatch
+{
+public:
+	/**
+	 * Creates an empty batch.
+	 */
+	EventBatch();
+
+	/**
+	 * Takes over the events accumulated in pending.  pending is left empty, although it may
+	 * get recycled storage to fill the next batch with.
+	 */
+	explicit EventBatch(QVector<FileEvent> & pending);
+
+	EventBatch(const EventBatch & other);
+	~EventBatch();
+	EventBatch & operator=(const EventBatch & other);
+
+	bool isEmpty() const;
+	int size() const;
+	const FileEvent & at(int i) const;
+
+	/**
+	 * @return The events as a contiguous array of size() elements.
+	 */
+	const FileEvent * constData() const;
+
+private:
+	struct Data : public QSharedData
+	{
+		QVector<FileEvent> events;
+	};
+
+	/**
+	 * Drops a reference, recycling the data if it was the last one.
+	 */
+	static void release(Data * data);
+
+	friend struct BatchPool;
+
+	Data * d;
+};
+
+#endif /* EVENT_BATCH_H_ */
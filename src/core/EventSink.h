@@ -0,0 +1,39 @@
+#ifndef EVENT_SINK_H_
+#define EVENT_SINK_H_
+//
+// C++ Interface: EventSink
+//
+// Description: 
+//
+//
+// Author: Vitali Lovich <vlovich@gmail.com>, (C) 2008
+//
+// Copyright: See COPYING file that comes with this distribution
+//
+//
+#include <QVector>
+
+class EventBatch;
+
+/**
+ * Receives the events matching a subscription.
+ *
+ * @see FileWatcher::subscribe
+ */
+class EventSink
+{
+public:
+	virtual ~EventSink() {}
+
+	/**
+	 * Called from the poll thread once per batch that contains at least one matching event.
+	 * The batch is shared with every other subscriber - it may be kept (copying it only
+	 * takes a reference) but never modified.
+	 *
+	 * @param batch All the events read during one pass of the poll loop.
+	 * @param matches The indices within batch of the events this subscription asked for, in order.
+	 */
+	virtual void deliver(const EventBatch & batch, const QVector<int> & matches) = 0;
+};
+
+#endif /* EVENT_SINK_H_ */
@@ -0,0 +1,133 @@
+#ifndef FILE_EVENT_H_
+#define FILE_EVENT_H_
+//
+// C++ Interface: FileEvent
+//
+// Description: 
+//
+//
+// Author: Vitali Lovich <vlovich@gmail.com>, (C) 2008
+//
+// Copyright: See COPYING file that comes with this distribution
+//
+//
+#include <QString>
+#include <QByteArray>
+#include <QFile>
+#include <QtGlobal>
+
+/**
+ * A single file notification, independent of the signal that is emitted for it.
+ * Events are handed out in batches (@see EventBatch) and are never modified after
+ * they have been published.
+ *
+ * Paths are kept in their native, on-disk encoding - file names are arbitrary bytes on
+ * most platforms and don't necessarily survive a round trip through QString.  They are
+ * only decoded if path() or otherPath() is asked for.
+ */
+class FileEvent
+{
+public:
+	/**
+	 * The kind of change.  The values are bit flags so that they can be combined
+	 * into a mask when subscribing.
+	 *
+	 * @see FileWatcher::subscribe
+	 */
+	enum Type
+	{
+		Created = 0x01,		/**< @see FileWatcher::newChild */
+		Deleted = 0x02,		/**< @see FileWatcher::deleted */
+		Modified = 0x04,	/**< @see FileWatcher::modified */
+		Moved = 0x08,		/**< @see FileWatcher::moved(QString, QString) */
+		MovedSelf = 0x10,	/**< @see FileWatcher::moved(QString) */
+		Existing = 0x20,	/**< Found by a crawl, rather than a change.  @see FileWatcher::setInventory */
+
+		AllEvents = 0xFF
+	};
+
+	FileEvent();
+	FileEvent(Type type, const QByteArray & nativePath, const QByteArray & nativeOtherPath = QByteArray(), quint64 sampledAt = 0);
+	FileEvent(Type type, const QString & path, const QString & otherPath = QString(), quint64 sampledAt = 0);
+
+	Type type() const;
+
+	/**
+	 * @return The path the event happened to.  For moves, this is where the file was
+	 * moved from.
+	 * @see nativePath
+	 */
+	QString path() const;
+
+	/**
+	 * @return The destination of a move, or an empty string for every other type of event.
+	 * @see nativeOtherPath
+	 */
+	QString otherPath() const;
+
+	/**
+	 * @return path() exactly as the operating system reported it, without decoding it.
+	 * @see QFile::decodeName
+	 */
+	const QByteArray & nativePath() const;
+	const QByteArray & nativeOtherPath() const;
+
+	/**
+	 * @return When the event was queued (@see monotonicNanos) if it was sampled for latency
+	 * tracing, 0 otherwise.
+	 * @see FileWatcher::setLatencySampling
+	 */
+	quint64 sampledAt() const;
+
+private:
+	Type eventType;
+	QByteArray filePath;
+	QByteArray otherFilePath;
+	quint64 sampleTime;
+};
+
+inline FileEvent::FileEvent() : eventType(Modified), sampleTime(0)
+{
+}
+
+inline FileEvent::FileEvent(Type type, const QByteArray & nativePath, const QByteArray & nativeOtherPath, quint64 sampledAt)
+	: eventType(type), filePath(nativePath), otherFilePath(nativeOtherPath), sampleTime(sampledAt)
+{
+}
+
+inline FileEvent::FileEvent(Type type, const QString & path, const QString & otherPath, quint64 sampledAt)
+	: eventType(type), filePath(QFile::encodeName(path)), otherFilePath(QFile::encodeName(otherPath)), sampleTime(sampledAt)
+{
+}
+
+inline FileEvent::Type FileEvent::type() const
+{
+	return eventType;
+}
+
+inline QString FileEvent::path() const
+{
+	return QFile::decodeName(filePath);
+}
+
+inline QString FileEvent::otherPath() const
+{
+	return QFile::decodeName(otherFilePath);
+}
+
+inline const QByteArray & FileEvent::nativePath() const
+{
+	return filePath;
+}
+
+inline const QByteArray & FileEvent::nativeOtherPath() const
+{
+	return otherFilePath;
+}
+
+inline quint64 FileEvent::sampledAt() const
+{
+	return sampleTime;
+}
+
+#endif /* FILE_EVENT_H_ */
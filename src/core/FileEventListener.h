@@ -0,0 +1,76 @@
+#ifndef FILE_EVENT_LISTENER_H_
+#define FILE_EVENT_LISTENER_H_
+//
+// C++ Interface: FileEventListener
+//
+// Description: 
+//
+//
+// Author: Vitali Lovich <vlovich@gmail.com>, (C) 2008
+//
+// Copyright: See COPYING file that comes with this distribution
+//
+//
+#include <stddef.h>
+
+#include "FileEvent.h"
+
+class EventBatch;
+
+/**
+ * Lightweight alternative to connecting to the FileWatcher signals.  Listeners are
+ * called directly with the events of each batch - there is no meta-call, no argument
+ * marshalling and no allocation per event, which also makes it possible to use the
+ * library without a Qt event loop.
+ *
+ * @see FileWatcher::addListener
+ */
+class FileEventListener
+{
+public:
+	virtual ~FileEventListener() {}
+
+	/**
+	 * @param events The events read during one pass of the poll loop.  Only valid for
+	 * the duration of the call.
+	 * @param count The number of events.  Never 0.
+	 */
+	virtual void onEvents(const FileEvent * events, size_t count) = 0;
+};
+
+/**
+ * Decides which thread a listener runs on.  Without an executor, listeners are called
+ * on the poll thread.
+ */
+class ListenerExecutor
+{
+public:
+	virtual ~ListenerExecutor() {}
+
+	/**
+	 * Arranges for listener->onEvents(batch.constData(), batch.size()) to be called.
+	 * Copying batch only takes a reference, so it can be queued as is.
+	 */
+	virtual void execute(FileEventListener * listener, const EventBatch & batch) = 0;
+};
+
+/**
+ * Adapts any callable taking (const FileEvent *, size_t) - a function pointer or a
+ * functor - into a listener without going through a virtual call in the callable itself.
+ */
+template <typename Callback>
+class CallbackListener : public FileEventListener
+{
+public:
+	explicit CallbackListener(Callback callback_) : callback(callback_) {}
+
+	void onEvents(const FileEvent * events, size_t count)
+	{
+		callback(events, count);
+	}
+
+private:
+	Callback callback;
+};
+
+#endif /* FILE_EVENT_LISTENER_H_ */
@@ -16,39 +16,59 @@
 #include <QtDebug>
 #include <QStringList>
 #include <QDir>
+#include <QFileInfo>
+#include <QReadLocker>
+#include <QWriteLocker>
+#include <QTimerEvent>
 
+#include "EventBatch.h"
+#include "FileEventListener.h"
+#include "Trace.h"
+
+/**
+ * @return The path watches are known by, however they were spelt - relative, with a
+ * trailing separator, ...
+ */
 static QString normalizePath(const QString& path)
 {
-	QString normalizedPath = path;
-	if (normalizedPath.endsWith(QDir::separator()))
-	{
-		// path ends with /
-		normalizedPath = normalizedPath.left(normalizedPath.length() - 1);
-	}
-	else
-	{
-		QByteArray normalizedPathStr = normalizedPath.toAscii();
-		Q_ASSERT_X(normalizedPath.at(normalizedPath.length() - 1) != QDir::separator(),
-			"normalizing path", "should never happen since the above condition should be executed instead");
-		if (normalizedPath.length() > 2)
-		{
-			qDebug() << "Looking for " << QDir::separator() << " in " << normalizedPath;
-			Q_ASSERT_X(normalizedPath.at(normalizedPath.length() - 2) != QDir::separator(),
-				"normalizing path",
-				("not sure what the problem with `" + normalizedPathStr + "' is").data());
-		}
-	}
+	QString normalizedPath = QDir::cleanPath(QFileInfo(path).absoluteFilePath());
 #ifdef WIN32
 	normalizedPath = normalizedPath.toLower();
 #endif /* WIN32 */
-	qDebug() << "Normalized " << path << " to " << normalizedPath;
 	return normalizedPath;
 }
 
-FileWatcher::FileWatcher() 
+static int typeIndex(FileEvent::Type type)
+{
+	switch (type)
+	{
+		case FileEvent::Created:
+			return 0;
+		case FileEvent::Deleted:
+			return 1;
+		case FileEvent::Modified:
+			return 2;
+		case FileEvent::Moved:
+			return 3;
+		case FileEvent::MovedSelf:
+			return 4;
+		case FileEvent::Existing:
+			return 5;
+		default:
+			Q_ASSERT_X(false, "latency tracing", "not a single event type");
+			return 2;
+	}
+}
+
+FileWatcher::FileWatcher()
+	: externalLoop(false), sharedLoop(false), droppingBatches(false), linkPolicy(FollowSymlinks), crossFilesystems(true), inventory(false), statsTimer(0), sampleEvery(0), unsampled(0), readStartedAt(0), readCompletedAt(0), hotTracking(false), adaptiveBatching(false), heldEvents(0), heldSince(0), deliveringThread(NULL), listenersChanged(false)
 {
-	connect(this, SIGNAL(watchAdded(QString)), SLOT(addWatchListener(const QString &)));
-	connect(this, SIGNAL(watchRemoved(QString)), SLOT(removeWatchListener(const QString &)));
+	qRegisterMetaType<WatcherStats>("WatcherStats");
+
+	// direct, so that watches stays in step with subtreeRemoved & watchesAdded, which update
+	// it on the emitting thread
+	connect(this, SIGNAL(watchAdded(QString)), SLOT(addWatchListener(const QString &)), Qt::DirectConnection);
+	connect(this, SIGNAL(watchRemoved(QString)), SLOT(removeWatchListener(const QString &)), Qt::DirectConnection);
 
 	qDebug() << "FileWatcher constructor finished";
 }
@@ -62,9 +82,67 @@ FileWatcher::~FileWatcher()
 
 bool FileWatcher::hasWatch(const QString & path) const
 {
+	QMutexLocker watcher(internalLock(&watchesLock));
 	return watches.contains(normalizePath(path));
 }
 
+quint64 FileWatcher::generation() const
+{
+	return 0;
+}
+
+QStringList FileWatcher::changedSince(const QString & root, quint64 generation) const
+{
+	Q_UNUSED(generation);
+	return QStringList(root);
+}
+
+int FileWatcher::addWatches(const QList<WatchSpec> & specs)
+{
+	// whatever recursive roots added along the way is counted too
+	quint64 before = counters.watchesAdded.load();
+	QStringList failed;
+	foreach(const WatchSpec & spec, specs)
+	{
+		if (!addWatch(spec.path, spec.recursive))
+		{
+			failed += spec.path;
+		}
+	}
+	emit watchesAdded((int)(counters.watchesAdded.load() - before), failed);
+	return failed.size();
+}
+
+void FileWatcher::setSymlinkPolicy(SymlinkPolicy policy)
+{
+	linkPolicy = policy;
+}
+
+FileWatcher::SymlinkPolicy FileWatcher::symlinkPolicy() const
+{
+	return linkPolicy;
+}
+
+void FileWatcher::setCrossFilesystems(bool cross)
+{
+	crossFilesystems = cross;
+}
+
+bool FileWatcher::crossesFilesystems() const
+{
+	return crossFilesystems;
+}
+
+void FileWatcher::setInventory(bool report)
+{
+	inventory = report;
+}
+
+bool FileWatcher::reportsInventory() const
+{
+	return inventory;
+}
+
 void FileWatcher::addWatchListener(const QString & path)
 {
 	if (path.isEmpty())
@@ -73,13 +151,10 @@ void FileWatcher::addWatchListener(const QString & path)
 		Q_ASSERT(false);
 		return;
 	}
-	QMutexLocker watcher(&watchesLock);
+	QMutexLocker watcher(internalLock(&watchesLock));
 	QString normalizedPath = normalizePath(path);
-	if (!watches.contains(normalizedPath))
-	{
-		watches += normalizedPath;
-	}
-	Q_ASSERT(hasWatch(normalizedPath));
+	++watches[normalizedPath];
+	Q_ASSERT(watches.contains(normalizedPath));
 }
 
 void FileWatcher::removeWatchListener(const QString & path)
@@ -90,13 +165,499 @@ void FileWatcher::removeWatchListener(const QString & path)
 		Q_ASSERT_X(false, "Removing watch", "path cannot be empty");
 		return;
 	}
-	QMutexLocker watcher(&watchesLock);
-	Q_ASSERT(hasWatch(path));
+	QMutexLocker watcher(internalLock(&watchesLock));
 	QString normalizedPath = normalizePath(path);
-	qDebug() << "Told watch removed: " << normalizedPath;
-	int numRemoved = watches.removeAll(normalizedPath);
-	Q_ASSERT(numRemoved == 1);
-	Q_ASSERT(!hasWatch(normalizedPath));
+	forgetWatch(normalizedPath);
+}
+
+void FileWatcher::rememberWatch(const QString & path)
+{
+	QMutexLocker watcher(internalLock(&watchesLock));
+	++watches[normalizePath(path)];
+}
+
+void FileWatcher::forgetWatches(const QList<QString> & paths)
+{
+	QMutexLocker watcher(internalLock(&watchesLock));
+	foreach(const QString & path, paths)
+	{
+		forgetWatch(normalizePath(path));
+	}
+}
+
+void FileWatcher::forgetWatch(const QString & normalizedPath)
+{
+	QHash<QString, int>::iterator watch = watches.find(normalizedPath);
+	Q_ASSERT(watch != watches.end());
+	if (watch != watches.end() && --watch.value() == 0)
+	{
+		watches.erase(watch);
+	}
+}
+
+int FileWatcher::subscribe(const QString & pathPrefix, int mask, EventSink * sink)
+{
+	Q_ASSERT(sink != NULL);
+	// events are always reported with absolute paths
+	QString prefix = pathPrefix.isEmpty() ? pathPrefix : QDir(pathPrefix).absolutePath();
+
+	QWriteLocker locker(subscriptionsWriteLock());
+	return subscriptions.add(prefix, mask, sink);
+}
+
+bool FileWatcher::unsubscribe(int subscription)
+{
+	QWriteLocker locker(subscriptionsWriteLock());
+	return subscriptions.remove(subscription);
+}
+
+void FileWatcher::addListener(FileEventListener * listener, ListenerExecutor * executor)
+{
+	Q_ASSERT(listener != NULL);
+	Listener entry;
+	entry.listener = listener;
+	entry.executor = executor;
+
+	QWriteLocker locker(subscriptionsWriteLock());
+	listeners += entry;
+	listenersChanged = true;
+}
+
+bool FileWatcher::removeListener(FileEventListener * listener)
+{
+	QWriteLocker locker(subscriptionsWriteLock());
+	for (int i = 0; i < listeners.size(); ++i)
+	{
+		if (listeners.at(i).listener == listener)
+		{
+			listeners.remove(i);
+			listenersChanged = true;
+			return true;
+		}
+	}
+	return false;
+}
+
+bool FileWatcher::isListening(FileEventListener * listener) const
+{
+	foreach(const Listener & entry, listeners)
+	{
+		if (entry.listener == listener)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+QReadWriteLock * FileWatcher::subscriptionsWriteLock()
+{
+	// a callback changing subscriptions from within flushEvents - the poll thread is the
+	// only one that reads them, & it already holds the lock
+	if (deliveringThread != NULL && deliveringThread == QThread::currentThreadId())
+	{
+		return NULL;
+	}
+	return internalLock(&subscriptionsLock);
+}
+
+EventBatch FileWatcher::nextBatch(int timeout)
+{
+	EventBatch batch = batches.pop(timeout);
+	recordDelivery(batch);
+	return batch;
+}
+
+bool FileWatcher::awaitBatch(BatchQueue::Waiter * waiter, EventBatch & immediate)
+{
+	bool registered = batches.await(waiter, immediate);
+	if (!registered)
+	{
+		recordDelivery(immediate);
+	}
+	return registered;
+}
+
+void FileWatcher::setQueueLimits(int maxEvents, qint64 maxBytes, QueuePolicy policy)
+{
+	static const BatchQueue::Policy POLICIES[] = { BatchQueue::Block, BatchQueue::Coalesce, BatchQueue::Drop };
+	batches.setLimits(maxEvents, maxBytes, POLICIES[policy]);
+}
+
+bool FileWatcher::cancelAwait(BatchQueue::Waiter * waiter)
+{
+	return batches.cancel(waiter);
+}
+
+void FileWatcher::pollingStopped()
+{
+	batches.cancel();
+}
+
+bool FileWatcher::setExternalLoop(bool external)
+{
+	if (isRunning())
+	{
+		return false;
+	}
+	externalLoop = external;
+	sharedLoop = false;
+	return true;
+}
+
+bool FileWatcher::isExternalLoop() const
+{
+	return externalLoop;
+}
+
+bool FileWatcher::setSharedLoop(bool shared)
+{
+	if (!setExternalLoop(shared))
+	{
+		return false;
+	}
+	sharedLoop = shared;
+	return true;
+}
+
+bool FileWatcher::isSharedLoop() const
+{
+	return sharedLoop;
+}
+
+int FileWatcher::readinessHandle() const
+{
+	return -1;
+}
+
+void FileWatcher::processReady()
+{
+	Q_ASSERT_X(false, "processing ready events", "not supported by this implementation");
+}
+
+QMutex * FileWatcher::internalLock(QMutex * lock) const
+{
+	return externalLoop && !sharedLoop ? NULL : lock;
+}
+
+QReadWriteLock * FileWatcher::internalLock(QReadWriteLock * lock) const
+{
+	return externalLoop && !sharedLoop ? NULL : lock;
+}
+
+WatcherStats FileWatcher::stats() const
+{
+	WatcherStats result = counters.snapshot(batches.size());
+	result.queuedEvents = batches.queuedEvents();
+	result.queuedBytes = batches.queuedBytes();
+	result.peakQueuedEvents = batches.peakEvents();
+	result.peakQueuedBytes = batches.peakBytes();
+	return result;
+}
+
+void FileWatcher::setStatsInterval(int msecs)
+{
+	if (statsTimer != 0)
+	{
+		killTimer(statsTimer);
+		statsTimer = 0;
+	}
+	if (msecs > 0)
+	{
+		statsTimer = startTimer(msecs);
+	}
+}
+
+void FileWatcher::timerEvent(QTimerEvent * event)
+{
+	if (event->timerId() == statsTimer)
+	{
+		emit statsUpdated(stats());
+		return;
+	}
+	QThread::timerEvent(event);
+}
+
+void FileWatcher::setLatencySampling(int every)
+{
+	sampleEvery = qMax(every, 0);
+}
+
+int FileWatcher::latencySampling() const
+{
+	return sampleEvery;
+}
+
+const LatencyHistogram & FileWatcher::latency(LatencyStage stage, FileEvent::Type type) const
+{
+	Q_ASSERT(stage >= 0 && stage < NumLatencyStages);
+	return latencies[stage][typeIndex(type)];
+}
+
+QString FileWatcher::latencyReport() const
+{
+	static const char * STAGE_NAMES[NumLatencyStages] = { "read", "parse", "enqueue", "delivery" };
+	static const char * TYPE_NAMES[NUM_EVENT_TYPES] = { "created", "deleted", "modified", "moved", "movedSelf", "existing" };
+
+	QString report;
+	for (int stage = 0; stage < NumLatencyStages; ++stage)
+	{
+		for (int type = 0; type < NUM_EVENT_TYPES; ++type)
+		{
+			const LatencyHistogram & histogram = latencies[stage][type];
+			if (histogram.count() == 0)
+			{
+				continue;
+			}
+			report += QString("%1 %2 %3\n").arg(STAGE_NAMES[stage], -8).arg(TYPE_NAMES[type], -9).arg(histogram.summary());
+		}
+	}
+	return report;
+}
+
+void FileWatcher::resetLatency()
+{
+	for (int stage = 0; stage < NumLatencyStages; ++stage)
+	{
+		for (int type = 0; type < NUM_EVENT_TYPES; ++type)
+		{
+			latencies[stage][type].reset();
+		}
+	}
+}
+
+void FileWatcher::recordDelivery(const EventBatch & batch)
+{
+	recordLatency(DeliveryStage, batch, monotonicNanos());
+}
+
+void FileWatcher::setHotDirectoryTracking(bool track)
+{
+	if (track && !hotTracking)
+	{
+		// what was seen last time it was on is long out of date
+		hotDirectories.reset();
+	}
+	hotTracking = track;
+}
+
+bool FileWatcher::tracksHotDirectories() const
+{
+	return hotTracking;
+}
+
+QList<HotDirectory> FileWatcher::topDirectories(int k) const
+{
+	return hotDirectories.top(k);
+}
+
+void FileWatcher::setAdaptiveBatching(bool adaptive)
+{
+	adaptiveBatching = adaptive;
+}
+
+bool FileWatcher::isAdaptiveBatching() const
+{
+	return adaptiveBatching;
+}
+
+void FileWatcher::setLatencyBounds(int idleMs, int stormMs)
+{
+	delivery.setLatencyBounds(idleMs, stormMs);
+}
+
+DeliveryController::Mode FileWatcher::deliveryMode() const
+{
+	return adaptiveBatching ? delivery.mode() : DeliveryController::LowLatency;
+}
+
+int FileWatcher::deliveryDelay() const
+{
+	return adaptiveBatching ? delivery.delay() : 0;
+}
+
+void FileWatcher::recordLatency(LatencyStage stage, const EventBatch & batch, quint64 now)
+{
+	if (sampleEvery == 0)
+	{
+		return;
+	}
+	const FileEvent * events = batch.constData();
+	for (int i = 0; i < batch.size(); ++i)
+	{
+		quint64 sampledAt = events[i].sampledAt();
+		if (sampledAt != 0 && now >= sampledAt)
+		{
+			latencies[stage][typeIndex(events[i].type())].record(now - sampledAt);
+		}
+	}
+}
+
+void FileWatcher::readCompleted(quint64 startedAt)
+{
+	if (sampleEvery != 0)
+	{
+		readStartedAt = startedAt;
+		readCompletedAt = monotonicNanos();
+	}
+}
+
+void FileWatcher::queueEvent(FileEvent::Type type, const QString & path, const QString & otherPath)
+{
+	queueEvent(type, QFile::encodeName(path), QFile::encodeName(otherPath));
+}
+
+void FileWatcher::queueEvent(FileEvent::Type type, const QByteArray & nativePath, const QByteArray & nativeOtherPath)
+{
+	switch (type)
+	{
+		case FileEvent::Created:
+			counters.created.add();
+			break;
+		case FileEvent::Deleted:
+			counters.deleted.add();
+			break;
+		case FileEvent::Modified:
+			counters.modified.add();
+			break;
+		case FileEvent::Moved:
+			counters.moved.add();
+			break;
+		case FileEvent::MovedSelf:
+			counters.movedSelf.add();
+			break;
+		case FileEvent::Existing:
+			counters.existing.add();
+			break;
+		default:
+			break;
+	}
+
+	quint64 sampledAt = 0;
+	int every = sampleEvery;
+	if (every != 0 && ++unsampled >= every)
+	{
+		unsampled = 0;
+		sampledAt = monotonicNanos();
+		if (readCompletedAt != 0)
+		{
+			int index = typeIndex(type);
+			latencies[ReadStage][index].record(readCompletedAt - readStartedAt);
+			latencies[ParseStage][index].record(sampledAt - readCompletedAt);
+		}
+	}
+	pendingEvents += FileEvent(type, nativePath, nativeOtherPath, sampledAt);
+}
+
+EventBatch FileWatcher::publishEvents()
+{
+	if (!adaptiveBatching)
+	{
+		return flushEvents();
+	}
+
+	quint64 now = monotonicNanos();
+	int arrived = pendingEvents.size() - heldEvents;
+	if (heldEvents == 0 && arrived > 0)
+	{
+		heldSince = now;
+	}
+	delivery.update(arrived, batches.queuedEvents(), now);
+	if (!delivery.shouldFlush(pendingEvents.size(), heldSince, now))
+	{
+		heldEvents = pendingEvents.size();
+		return EventBatch();
+	}
+	return flushEvents();
+}
+
+int FileWatcher::publishTimeout(int maximum) const
+{
+	if (!adaptiveBatching)
+	{
+		return maximum;
+	}
+	return delivery.timeout(heldEvents, heldSince, monotonicNanos(), maximum);
+}
+
+EventBatch FileWatcher::flushEvents()
+{
+	heldEvents = 0;
+	if (pendingEvents.isEmpty())
+	{
+		return EventBatch();
+	}
+	quint64 start = monotonicNanos();
+	EventBatch batch(pendingEvents);
+	Q_ASSERT(pendingEvents.isEmpty());
+	recordLatency(EnqueueStage, batch, start);
+	if (hotTracking)
+	{
+		hotDirectories.record(batch.constData(), batch.size(), start);
+	}
+
+	// whether someone had the events by the time we're done here
+	bool delivered = false;
+
+	QReadLocker locker(internalLock(&subscriptionsLock));
+	deliveringThread = QThread::currentThreadId();
+	listenersChanged = false;
+	// a snapshot, as callbacks may add or remove listeners as they go
+	QVector<Listener> current = listeners;
+	foreach(const Listener & entry, current)
+	{
+		if (listenersChanged && !isListening(entry.listener))
+		{
+			continue;
+		}
+		if (entry.executor == NULL)
+		{
+			entry.listener->onEvents(batch.constData(), batch.size());
+			delivered = true;
+		}
+		else
+		{
+			entry.executor->execute(entry.listener, batch);
+		}
+	}
+	delivered = delivered || !subscriptions.isEmpty();
+	subscriptions.route(batch);
+	deliveringThread = NULL;
+	locker.unlock();
+
+	if (delivered)
+	{
+		recordDelivery(batch);
+	}
+
+	if (batches.isActive())
+	{
+		BatchQueue::Overflow overflow;
+		// only a poll thread of our own may wait for room
+		batches.push(batch, !externalLoop, &overflow);
+		counters.coalescedEvents.add(overflow.coalesced);
+		counters.droppedEvents.add(overflow.dropped);
+		counters.blockedNanos.add(overflow.blockedNanos);
+		if (overflow.blockRefused)
+		{
+			counters.refusedBlocks.add();
+		}
+		if (overflow.dropped == 0)
+		{
+			droppingBatches = false;
+		}
+		else if (!droppingBatches)
+		{
+			droppingBatches = true;
+			counters.resyncs.add();
+			emit resyncNeeded();
+		}
+	}
+
+	FNOTIFY_TRACE_EVENT(BatchPublished, -1, 0, batch.size());
+	counters.batches.add();
+	counters.deliverNanos.add(monotonicNanos() - start);
+	return batch;
 }
 
 void FileWatcher::run()
@@ -14,7 +14,25 @@
 #include <QThread>
 #include <QString>
 #include <QList>
+#include <QSet>
+#include <QHash>
+#include <QStringList>
 #include <QMutex>
+#include <QVector>
+#include <QReadWriteLock>
+
+#include "FileEvent.h"
+#include "WatchSpec.h"
+#include "BatchQueue.h"
+#include "WatcherStats.h"
+#include "LatencyHistogram.h"
+#include "HotDirectories.h"
+#include "DeliveryController.h"
+#include "SubscriptionIndex.h"
+
+class EventSink;
+class FileEventListener;
+class ListenerExecutor;
 
 /**
  * OS & platform agnostic class that abstracts file watches.  This is meant to be the
@@ -29,6 +47,295 @@ public:
 	virtual bool supportsRecursiveWatch() const = 0;
 	virtual bool hasWatch(const QString & path) const;
 
+	/**
+	 * For build tools and the like, which only need to know where to look again rather than
+	 * every event.  Take the generation, and later ask what changed since it.
+	 *
+	 * @return The current generation, or 0 if the implementation doesn't keep track.
+	 */
+	virtual quint64 generation() const;
+
+	/**
+	 * @param root A watched path.
+	 * @param generation As returned by generation() earlier.
+	 * @return The directories at or under root that something changed in after that
+	 * generation.  A change may be reported again once too often, but never missed.  The
+	 * default implementation doesn't keep track, so it reports root itself - everything
+	 * needs looking at.
+	 */
+	virtual QStringList changedSince(const QString & root, quint64 generation) const;
+
+	/**
+	 * How recursive watches treat links to directories.
+	 */
+	enum SymlinkPolicy
+	{
+		FollowSymlinks,		/**< Watch what they point to.  The default. */
+		SkipSymlinks		/**< Leave them out of the crawl. */
+	};
+
+	/**
+	 * Options for the crawl done by recursive watches.  Whatever the options, a crawl watches
+	 * each directory (device & inode) once however many ways it can be reached, so link loops
+	 * and bind mounts can't run away with the watch budget.  Only affect watches added
+	 * afterwards.
+	 */
+	void setSymlinkPolicy(SymlinkPolicy policy);
+	SymlinkPolicy symlinkPolicy() const;
+
+	/**
+	 * @param cross Whether recursive watches descend into directories on another file system
+	 * than their root, i.e. through mount points.  True by default.
+	 */
+	void setCrossFilesystems(bool cross);
+	bool crossesFilesystems() const;
+
+	/**
+	 * @param report Whether recursive crawls report everything they find under the root
+	 * as FileEvent::Existing events, so that a consumer can take stock & follow changes in
+	 * one pass.  The inventory of a directory comes before any change reported in it after
+	 * it was listed.  Off by default.
+	 */
+	void setInventory(bool report);
+	bool reportsInventory() const;
+
+	/**
+	 * Registers interest in a subset of the events generated by this watcher.  Every matching
+	 * subscriber receives the same shared batch (@see EventBatch), so any number of components
+	 * can share one watcher without duplicating the kernel watches or the events.
+	 *
+	 * @param pathPrefix Only events for paths at or below this directory are delivered.
+	 * An empty prefix subscribes to the whole tree.
+	 * @param mask Combination of FileEvent::Type flags to deliver.
+	 * @param sink Receives the events on the poll thread.  Not owned - must outlive the
+	 * subscription.  Sinks & listeners may subscribe, unsubscribe, add or remove listeners
+	 * from their callbacks; changes take effect from the next batch, except that a removed
+	 * sink or listener is not called again.
+	 * @return A handle for unsubscribe().
+	 */
+	int subscribe(const QString & pathPrefix, int mask, EventSink * sink);
+
+	/**
+	 * @param subscription The handle returned by subscribe().
+	 * @return Whether the subscription existed.  Once this returns, the sink will not
+	 * be called again.
+	 */
+	bool unsubscribe(int subscription);
+
+	/**
+	 * Registers a listener that receives every event without going through the meta-object
+	 * system.
+	 *
+	 * @param listener Not owned - must be removed before it is destroyed.
+	 * @param executor Where to run the listener.  If NULL, the listener is called directly on
+	 * the poll thread and must not block.  Not owned.  The executor is handed batches with
+	 * the listeners locked, so a listener it runs on another thread must not add or remove
+	 * listeners or subscriptions if execute() may block on it.
+	 * @see PartitionedExecutor
+	 */
+	void addListener(FileEventListener * listener, ListenerExecutor * executor = NULL);
+
+	/**
+	 * @return Whether the listener was registered.  Once this returns, the listener will not
+	 * be called again from the poll thread (an executor may still hold a queued batch for it).
+	 */
+	bool removeListener(FileEventListener * listener);
+
+	/**
+	 * Pulls the next batch published by the poll loop.  Batches are only collected once a
+	 * consumer has pulled or awaited one, and each batch goes to a single consumer.
+	 *
+	 * @param timeout In milliseconds, or -1 to wait until a batch arrives or polling stops.
+	 * @return The batch, or an empty batch on timeout or once polling has stopped.
+	 */
+	EventBatch nextBatch(int timeout = -1);
+
+	/**
+	 * Asynchronous form of nextBatch(), for adapting to other event loops and coroutines
+	 * (@see AsyncWatcher.h).  The waiter is completed from the poll thread, or with an empty
+	 * batch from stopPolling().
+	 *
+	 * @param immediate Receives the batch if one is already available, in which case the
+	 * waiter is not registered.
+	 * @return Whether the waiter was registered.
+	 * @see BatchQueue::await
+	 */
+	bool awaitBatch(BatchQueue::Waiter * waiter, EventBatch & immediate);
+
+	/**
+	 * What happens to a batch that would take the queue behind nextBatch()/awaitBatch()
+	 * over its limits.
+	 */
+	enum QueuePolicy
+	{
+		BlockWhenFull,		/**< The poll thread waits for room, leaving the burst to the kernel queue.  In external loop mode it coalesces instead: without a shared loop that would be waiting on itself, and a shared loop would hold up every other watcher it serves.  stats() counts each time. */
+		CoalesceWhenFull,	/**< An event that repeats the last one queued for its path, with nothing else having happened to the path in between, is merged into it.  If that's not enough, the newest events are dropped. */
+		DropWhenFull		/**< The batch is dropped. */
+	};
+
+	/**
+	 * Bounds the batches waiting to be pulled, which otherwise grow for as long as consumers
+	 * fall behind.  Whenever events have to be dropped, resyncNeeded is emitted.  The queue's
+	 * size & high water marks are in stats().
+	 *
+	 * @param maxEvents The most events that may wait, or 0 for no limit (the default).
+	 * @param maxBytes The most memory they may take, or 0 for no limit (the default).
+	 */
+	void setQueueLimits(int maxEvents, qint64 maxBytes, QueuePolicy policy = BlockWhenFull);
+
+	/**
+	 * Withdraws a waiter registered with awaitBatch().
+	 *
+	 * @return False if it has already been completed.
+	 */
+	bool cancelAwait(BatchQueue::Waiter * waiter);
+
+	/**
+	 * Synchronous alternative to running the poll thread: processes pending notifications on
+	 * the calling thread and copies the resulting events into a caller-owned buffer.  Must not
+	 * be mixed with start().
+	 *
+	 * @param out Where to store the events.
+	 * @param max The capacity of out.
+	 * @param timeout How long to wait for notifications, in milliseconds, or -1 to wait forever.
+	 * @return The number of events stored, 0 on timeout.
+	 */
+	virtual size_t drain(FileEvent * out, size_t max, int timeout) = 0;
+
+	/**
+	 * Switches to (or away from) external event loop mode.  Instead of running the poll
+	 * thread, the owner waits for readinessHandle() in its own loop (epoll, io_uring, ...)
+	 * and calls processReady() whenever it becomes readable.  Everything then happens on
+	 * that one thread, so the watcher stops taking its internal locks - adding and removing
+	 * watches, subscriptions and listeners must all happen on that thread as well.
+	 *
+	 * @return Whether the mode could be changed.  Cannot be changed while polling.
+	 */
+	virtual bool setExternalLoop(bool external);
+	bool isExternalLoop() const;
+
+	/**
+	 * External loop mode for a loop that is shared with other watchers and runs on a thread
+	 * of its own (@see WatcherFactory::createSharedWatcher).  processReady() is called from
+	 * that thread while the watcher is used from any other, so the watcher keeps taking its
+	 * internal locks.
+	 *
+	 * @return Whether the mode could be changed.  Cannot be changed while polling.
+	 */
+	bool setSharedLoop(bool shared);
+	bool isSharedLoop() const;
+
+	/**
+	 * @return A descriptor that becomes readable when processReady() has work to do, or -1
+	 * if the implementation cannot be driven by an external loop.
+	 */
+	virtual int readinessHandle() const;
+
+	/**
+	 * Processes whatever is pending without blocking.  Only valid in external loop mode.
+	 */
+	virtual void processReady();
+
+	/**
+	 * @return A snapshot of the runtime counters.  Safe to call from any thread - the counters
+	 * are kept up to date as events are processed, so this is cheap.
+	 */
+	WatcherStats stats() const;
+
+	/**
+	 * Emits statsUpdated periodically from the thread this watcher belongs to (which needs
+	 * an event loop).
+	 *
+	 * @param msecs The period, or 0 to stop.
+	 */
+	void setStatsInterval(int msecs);
+
+	/**
+	 * The stages an event goes through, for latency tracing.  Each is timed separately so
+	 * that a slow notification can be pinned on the right culprit.
+	 */
+	enum LatencyStage
+	{
+		ReadStage,		/**< Reading from the kernel, for the read the event came from. */
+		ParseStage,		/**< From the end of the read until the event was queued. */
+		EnqueueStage,		/**< From being queued until its batch was published. */
+		DeliveryStage,		/**< From being queued until a consumer had it (@see recordDelivery). */
+
+		NumLatencyStages
+	};
+
+	/**
+	 * Turns latency tracing on or off.  Sampled events are timestamped (@see
+	 * FileEvent::sampledAt) and timed through each stage into per-type histograms.
+	 * Unsampled events cost a single counter, so sampling can be left on in production.
+	 *
+	 * @param every Trace every Nth event, or 0 to stop tracing (the default).
+	 */
+	void setLatencySampling(int every);
+	int latencySampling() const;
+
+	/**
+	 * @param stage The stage to look at.
+	 * @param type A single FileEvent::Type.
+	 * @return The latencies recorded for that stage & type.  Safe to read from any thread.
+	 */
+	const LatencyHistogram & latency(LatencyStage stage, FileEvent::Type type) const;
+
+	/**
+	 * @return All non-empty histograms, one per line, as "stage type summary".
+	 */
+	QString latencyReport() const;
+
+	void resetLatency();
+
+	/**
+	 * Delivery is recorded for listeners called on the poll thread, subscribers and batches
+	 * pulled with nextBatch() or available straight away to awaitBatch().  Consumers that get
+	 * their events some other way (an executor, a waiter completed later, Qt queued
+	 * connections) can call this once they have the batch in hand.
+	 */
+	void recordDelivery(const EventBatch & batch);
+
+	/**
+	 * @param track Whether to keep track of which directories generate the most events, for
+	 * topDirectories().  Costs a hash of each event's directory, in fixed memory however
+	 * many directories are watched.  Off by default.
+	 * @see HotDirectories
+	 */
+	void setHotDirectoryTracking(bool track);
+	bool tracksHotDirectories() const;
+
+	/**
+	 * @return Up to k of the directories generating the most events lately, busiest first.
+	 * Safe to call from any thread.
+	 */
+	QList<HotDirectory> topDirectories(int k) const;
+
+	/**
+	 * Lets the poll thread hold events back to deliver them in larger batches when they come
+	 * in fast, within the latency bounds (@see DeliveryController).  Off by default, in which
+	 * case every read is delivered as its own batch.  Only affects implementations running
+	 * their own poll thread - drain() and external loops always deliver straight away.
+	 */
+	void setAdaptiveBatching(bool adaptive);
+	bool isAdaptiveBatching() const;
+
+	/**
+	 * @param idleMs The most events may be held once the rate picks up.  1 by default.
+	 * @param stormMs The most events may be held under the heaviest load.  50 by default.
+	 */
+	void setLatencyBounds(int idleMs, int stormMs);
+
+	/**
+	 * @return What adaptive batching is currently doing.  Safe to call from any thread.
+	 */
+	DeliveryController::Mode deliveryMode() const;
+
+	/**
+	 * @return How long events may currently be held, in microseconds.
+	 */
+	int deliveryDelay() const;
+
 public slots:
 	/**
 	 * This should actually not be pure virtual.  If the native implementation doesn't support
@@ -39,6 +346,16 @@ public slots:
 	 * @return Whether or not the watch was added.
 	 */
 	virtual bool addWatch(const QString & path, bool recursive) = 0;
+
+	/**
+	 * Adds many watches at once.  Same as calling addWatch for each, except that the
+	 * implementation may prepare the roots in parallel & install them together, and that the
+	 * whole batch is reported by a single watchesAdded.  The default implementation just
+	 * calls addWatch, so watchAdded is emitted as well.
+	 *
+	 * @return The number of roots that couldn't be watched.
+	 */
+	virtual int addWatches(const QList<WatchSpec> & specs);
 	
 	/**
 	* @returns If the watch was successfully removed.
@@ -50,23 +367,233 @@ protected:
 	void run();
 	virtual void poll() = 0;
 
+	/**
+	 * Records an event for delivery to subscribers.  Called from the poll thread
+	 * alongside the corresponding signal.
+	 *
+	 * @param nativePath The path as the operating system reported it (@see FileEvent::nativePath).
+	 */
+	void queueEvent(FileEvent::Type type, const QByteArray & nativePath, const QByteArray & nativeOtherPath = QByteArray());
+
+	/**
+	 * Same as above for implementations that only have decoded paths.
+	 */
+	void queueEvent(FileEvent::Type type, const QString & path, const QString & otherPath = QString());
+
+	/**
+	 * Publishes all the events queued since the last flush as a single batch.  Should be
+	 * called by the implementation once it has finished processing what it read.
+	 *
+	 * @return The published batch.
+	 */
+	EventBatch flushEvents();
+
+	/**
+	 * To be called by a poll thread in place of flushEvents() after each pass of its loop.
+	 * Publishes the events queued since the last flush unless adaptive batching holds them
+	 * back for a larger batch.
+	 *
+	 * @return The published batch, or an empty batch if the events were held.
+	 */
+	EventBatch publishEvents();
+
+	/**
+	 * @param maximum In milliseconds.
+	 * @return How long the poll thread may wait for more events before publishEvents()
+	 * needs calling for the ones held - never more than maximum.
+	 */
+	int publishTimeout(int maximum) const;
+
+	/**
+	 * Completes everyone waiting in nextBatch()/awaitBatch().  Must be called by the
+	 * implementation from stopPolling().
+	 */
+	void pollingStopped();
+
+	/**
+	 * Tells latency tracing about a read from the kernel.  The events queued until the next
+	 * call are attributed to this read.
+	 *
+	 * @param startedAt When the read started (@see monotonicNanos).
+	 */
+	void readCompleted(quint64 startedAt);
+
+	void timerEvent(QTimerEvent * event);
+
+	/**
+	 * @return The lock to take in order to protect the given lock's data, or NULL in external
+	 * loop mode where there is only ever one thread (unless the loop is shared).  QMutexLocker & QReadLocker/QWriteLocker
+	 * accept NULL.
+	 */
+	QMutex * internalLock(QMutex * lock) const;
+	QReadWriteLock * internalLock(QReadWriteLock * lock) const;
+
+	/**
+	 * @return The lock to take for writing in order to change subscriptions or listeners,
+	 * which is NULL when called back from the delivery of a batch.
+	 */
+	QReadWriteLock * subscriptionsWriteLock();
+
+	bool isListening(FileEventListener * listener) const;
+
+	/**
+	 * Drops one reference to a watch.  watchesLock must be held.
+	 */
+	void forgetWatch(const QString & normalizedPath);
+
 private slots:
 	void addWatchListener(const QString & path);
 	void removeWatchListener(const QString & path);
 
 protected:
-	QList<QString> watches;
-	QMutex watchesLock;
+	/**
+	 * The watches reported, by normalized path.  Counted, since paths that aren't valid in
+	 * the locale's encoding can decode to the same string.  Updated on whichever thread
+	 * reports the watch, as it is reported, under watchesLock.
+	 */
+	QHash<QString, int> watches;
+	mutable QMutex watchesLock;
+
+	/**
+	 * Forgets many watches at once, for implementations that tear down whole subtrees and
+	 * report them with subtreeRemoved rather than with watchRemoved for every path.
+	 */
+	void forgetWatches(const QList<QString> & paths);
+
+	/**
+	 * The counterpart of forgetWatches for watches reported by watchesAdded.  Called as
+	 * each watch is made, before anything can tear it down again.
+	 */
+	void rememberWatch(const QString & path);
+
+	/**
+	 * Updated by the implementation as it goes.  Events, batches and delivery time are
+	 * already counted by queueEvent() & flushEvents().
+	 */
+	WatcherCounters counters;
+
+private:
+	/**
+	 * Events queued by the poll thread since the last flush.
+	 */
+	QVector<FileEvent> pendingEvents;
+
+	SubscriptionIndex subscriptions;
+
+	struct Listener
+	{
+		FileEventListener * listener;
+		ListenerExecutor * executor;
+	};
+
+	QVector<Listener> listeners;
+
+	BatchQueue batches;
+
+	bool externalLoop;
+	bool sharedLoop;
+
+	/**
+	 * Whether the last batch had to be dropped, so that resyncNeeded is only emitted once
+	 * for each run of them.  Only touched by the poll thread.
+	 */
+	bool droppingBatches;
+
+	SymlinkPolicy linkPolicy;
+	bool crossFilesystems;
+	bool inventory;
+
+	int statsTimer;
+
+	void recordLatency(LatencyStage stage, const EventBatch & batch, quint64 now);
+
+	enum
+	{
+		NUM_EVENT_TYPES = 6
+	};
+
+	/**
+	 * @see setLatencySampling.  The rest is only touched by the poll thread.
+	 */
+	volatile int sampleEvery;
+	int unsampled;
+	quint64 readStartedAt;
+	quint64 readCompletedAt;
+
+	LatencyHistogram latencies[NumLatencyStages][NUM_EVENT_TYPES];
+
+	/**
+	 * @see setHotDirectoryTracking
+	 */
+	volatile bool hotTracking;
+	HotDirectories hotDirectories;
+
+	/**
+	 * @see setAdaptiveBatching.  The events held and when the first of them was are only
+	 * touched by the poll thread.
+	 */
+	volatile bool adaptiveBatching;
+	DeliveryController delivery;
+	int heldEvents;
+	quint64 heldSince;
+
+	/**
+	 * Taken for reading while delivering a batch, for writing when subscriptions or
+	 * listeners change.
+	 */
+	QReadWriteLock subscriptionsLock;
+
+	/**
+	 * The thread delivering a batch while it holds subscriptionsLock, so that sinks &
+	 * listeners it calls can change subscriptions without deadlocking on it.
+	 */
+	volatile Qt::HANDLE deliveringThread;
+
+	/**
+	 * Whether listeners changed since the delivery of the current batch started.
+	 */
+	bool listenersChanged;
 
 signals:
 	void error(QString message);
 	void watchAdded(QString path);
 	void watchRemoved(QString path);
+
+	/**
+	 * Reported once for an addWatches batch.
+	 *
+	 * @param count The number of watches added, including those under recursive roots.
+	 * @param failed The roots that couldn't be watched.
+	 */
+	void watchesAdded(int count, QStringList failed);
+
+	/**
+	 * Reported instead of watchRemoved for each path when a whole tree of recursive watches
+	 * goes at once - because it was deleted, moved or unwatched.
+	 *
+	 * @param root The path of the top of the tree.
+	 * @param count The number of watches removed, root included.
+	 */
+	void subtreeRemoved(QString root, int count);
+
+	/**
+	 * Events were dropped to keep the queue behind nextBatch() within its limits, so what
+	 * its consumers know may be out of date.  Emitted from the poll thread once for each
+	 * run of dropped batches.
+	 *
+	 * @see setQueueLimits
+	 */
+	void resyncNeeded();
 	void moved(QString from);
 	void moved(QString from, QString to);
 	void deleted(QString path);
 	void newChild(QString path);
 	void modified(QString path);
+
+	/**
+	 * @see setStatsInterval
+	 */
+	void statsUpdated(WatcherStats stats);
 };
 
 #endif /* FILE_WATCHER _H_ */
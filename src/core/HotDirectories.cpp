@@ -0,0 +1,209 @@
+//
+// C++ Implementation: HotDirectories
+//
+// Description:
+//
+//
+// Author: Vitali Lovich <vlovich@gmail.com>, (C) 2008
+//
+// Copyright: See COPYING file that comes with this distribution
+//
+//
+#include "HotDirectories.h"
+
+#include <QMutexLocker>
+#include <QtAlgorithms>
+#include <QFile>
+
+#include "FileEvent.h"
+#include "WatcherStats.h"
+
+#include <math.h>
+
+/**
+ * The weight at which the counts are scaled back down - 32 half lives.
+ */
+static const double RESCALE_WEIGHT = 4294967296.0;
+
+static const double HALF_LIFE_NANOS = HOT_DIRECTORY_HALF_LIFE_MS * 1e6;
+
+/**
+ * FNV-1a over the directory part of a path, so that nothing is copied unless the directory
+ * is new.
+ *
+ * @param length Receives the length of the directory part.
+ */
+static inline quint64 directoryKey(const QByteArray & path, int & length)
+{
+	const char * data = path.constData();
+	length = path.size();
+	while (length > 0 && data[length - 1] != '/')
+	{
+		--length;
+	}
+	if (length > 1)
+	{
+		// drop the trailing slash, except for the root itself
+		--length;
+	}
+
+	quint64 key = Q_UINT64_C(14695981039346656037);
+	for (int i = 0; i < length; ++i)
+	{
+		key ^= (uchar)data[i];
+		key *= Q_UINT64_C(1099511628211);
+	}
+	return key;
+}
+
+static bool busier(const HotDirectory & first, const HotDirectory & second)
+{
+	return first.rate > second.rate;
+}
+
+HotDirectories::HotDirectories() : used(0)
+{
+	reset();
+}
+
+void HotDirectories::reset()
+{
+	QMutexLocker locker(&lock);
+	for (int i = 0; i < used; ++i)
+	{
+		entries[i].directory = QByteArray();
+	}
+	used = 0;
+	for (int i = 0; i < INDEX_SIZE; ++i)
+	{
+		index[i] = EMPTY;
+	}
+	base = monotonicNanos();
+}
+
+double HotDirectories::weightAt(quint64 now) const
+{
+	return now <= base ? 1.0 : pow(2.0, (now - base) / HALF_LIFE_NANOS);
+}
+
+int HotDirectories::probe(quint64 key) const
+{
+	int position = key & (INDEX_SIZE - 1);
+	while (index[position] != EMPTY && entries[index[position]].key != key)
+	{
+		position = (position + 1) & (INDEX_SIZE - 1);
+	}
+	return position;
+}
+
+void HotDirectories::removeKey(quint64 key)
+{
+	int hole = probe(key);
+	Q_ASSERT(index[hole] != EMPTY);
+	index[hole] = EMPTY;
+
+	// shift back whatever probed past the hole, so that probes don't stop short of it
+	for (int position = (hole + 1) & (INDEX_SIZE - 1); index[position] != EMPTY; position = (position + 1) & (INDEX_SIZE - 1))
+	{
+		int home = entries[index[position]].key & (INDEX_SIZE - 1);
+		bool between = hole <= position ? (hole < home && home <= position) : (hole < home || home <= position);
+		if (!between)
+		{
+			index[hole] = index[position];
+			index[position] = EMPTY;
+			hole = position;
+		}
+	}
+}
+
+void HotDirectories::rescale(quint64 now)
+{
+	double weight = weightAt(now);
+	for (int i = 0; i < used; ++i)
+	{
+		entries[i].count /= weight;
+		entries[i].error /= weight;
+	}
+	base = now;
+}
+
+void HotDirectories::record(const FileEvent * events, int count, quint64 now)
+{
+	QMutexLocker locker(&lock);
+	double weight = weightAt(now);
+	if (weight >= RESCALE_WEIGHT)
+	{
+		rescale(now);
+		weight = 1.0;
+	}
+
+	for (int i = 0; i < count; ++i)
+	{
+		const FileEvent & event = events[i];
+		if (event.type() == FileEvent::Existing)
+		{
+			continue;
+		}
+
+		int length;
+		quint64 key = directoryKey(event.nativePath(), length);
+		int position = probe(key);
+		if (index[position] != EMPTY)
+		{
+			entries[index[position]].count += weight;
+			continue;
+		}
+
+		int slot;
+		if (used < HOT_DIRECTORY_SLOTS)
+		{
+			slot = used++;
+			entries[slot].count = weight;
+			entries[slot].error = 0;
+		}
+		else
+		{
+			// the new directory takes over the quietest one's count - which bounds how much
+			// it may be overestimated by
+			slot = 0;
+			for (int j = 1; j < used; ++j)
+			{
+				if (entries[j].count < entries[slot].count)
+				{
+					slot = j;
+				}
+			}
+			removeKey(entries[slot].key);
+			entries[slot].error = entries[slot].count;
+			entries[slot].count += weight;
+			position = probe(key);
+		}
+		entries[slot].key = key;
+		entries[slot].directory = QByteArray(event.nativePath().constData(), length);
+		index[position] = slot;
+	}
+}
+
+QList<HotDirectory> HotDirectories::top(int k) const
+{
+	QList<HotDirectory> result;
+	QMutexLocker locker(&lock);
+	// a count of C events in units of the current weight is a rate of C * ln 2 / half life
+	double scale = log(2.0) / (weightAt(monotonicNanos()) * HALF_LIFE_NANOS / 1e9);
+	for (int i = 0; i < used; ++i)
+	{
+		HotDirectory directory;
+		directory.path = entries[i].directory.isEmpty() ? QString(".") : QFile::decodeName(entries[i].directory);
+		directory.rate = entries[i].count * scale;
+		directory.error = entries[i].error * scale;
+		result += directory;
+	}
+	locker.unlock();
+
+	qSort(result.begin(), result.end(), busier);
+	while (result.size() > qMax(k, 0))
+	{
+		result.removeLast();
+	}
+	return result;
+}
@@ -0,0 +1,123 @@
+#ifndef HOT_DIRECTORIES_H_
+#define HOT_DIRECTORIES_H_
+//
+// C++ Interface: HotDirectories
+//
+// Description:
+//
+//
+// Author: Vitali Lovich <vlovich@gmail.com>, (C) 2008
+//
+// Copyright: See COPYING file that comes with this distribution
+//
+//
+#include <QtGlobal>
+#include <QString>
+#include <QByteArray>
+#include <QList>
+#include <QMutex>
+
+class FileEvent;
+
+/**
+ * The number of directories tracked.  Must be a power of 2.  Directories outside the top
+ * HOT_DIRECTORY_SLOTS share the estimates of the ones they displace.
+ */
+#ifndef HOT_DIRECTORY_SLOTS
+#define HOT_DIRECTORY_SLOTS 64
+#endif /* HOT_DIRECTORY_SLOTS */
+
+/**
+ * How quickly old activity is forgotten - an event counts half as much after this long.
+ */
+#ifndef HOT_DIRECTORY_HALF_LIFE_MS
+#define HOT_DIRECTORY_HALF_LIFE_MS 30000
+#endif /* HOT_DIRECTORY_HALF_LIFE_MS */
+
+/**
+ * A directory's share of the recent events.
+ */
+struct HotDirectory
+{
+	QString path;
+
+	/**
+	 * Events per second, decayed exponentially over HOT_DIRECTORY_HALF_LIFE_MS.  May be
+	 * overestimated by up to error.
+	 */
+	double rate;
+	double error;
+};
+
+/**
+ * Finds the directories generating the most events with the space-saving heavy hitters
+ * algorithm, in fixed memory however many directories there are.  Any directory with more
+ * than 1/HOT_DIRECTORY_SLOTS of the (decayed) events is guaranteed to be tracked.
+ *
+ * Rather than decaying every counter as time goes by, each event is counted with a weight
+ * that grows as time does, so recording an event is a hash of its directory, a probe of a
+ * small open-addressed table and an addition.
+ */
+class HotDirectories
+{
+public:
+	HotDirectories();
+
+	/**
+	 * Counts the events against the directories they happened in.  Existing events are
+	 * not activity, so they are left out.
+	 *
+	 * @param now When they happened (@see monotonicNanos).
+	 */
+	void record(const FileEvent * events, int count, quint64 now);
+
+	/**
+	 * @return Up to k of the busiest directories, busiest first.  Safe to call from any
+	 * thread.
+	 */
+	QList<HotDirectory> top(int k) const;
+
+	void reset();
+
+private:
+	enum
+	{
+		INDEX_SIZE = HOT_DIRECTORY_SLOTS * 2,
+		EMPTY = -1
+	};
+
+	struct Entry
+	{
+		quint64 key;
+		QByteArray directory;
+		double count;
+		double error;
+	};
+
+	Entry entries[HOT_DIRECTORY_SLOTS];
+	int used;
+
+	/**
+	 * Maps the hash of a directory to its entry, probing linearly.
+	 */
+	qint16 index[INDEX_SIZE];
+
+	/**
+	 * Counts are kept in units of the weight an event had at base - the weight is
+	 * 2^((now - base) / half life), and everything is scaled back down before it gets large.
+	 */
+	quint64 base;
+
+	mutable QMutex lock;
+
+	double weightAt(quint64 now) const;
+
+	/**
+	 * @return Where the key is in the index, or the empty position it would go in.
+	 */
+	int probe(quint64 key) const;
+	void removeKey(quint64 key);
+	void rescale(quint64 now);
+};
+
+#endif /* HOT_DIRECTORIES_H_ */
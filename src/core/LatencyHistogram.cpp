@@ -0,0 +1,115 @@
+//
+// C++ Implementation: LatencyHistogram
+//
+// Description:
+//
+//
+// Author: Vitali Lovich <vlovich@gmail.com>, (C) 2008
+//
+// Copyright: See COPYING file that comes with this distribution
+//
+//
+#include "LatencyHistogram.h"
+
+static QString formatNanos(quint64 nanos)
+{
+	if (nanos < Q_UINT64_C(1000))
+	{
+		return QString::number(nanos) + "ns";
+	}
+	if (nanos < Q_UINT64_C(1000000))
+	{
+		return QString::number(nanos / 1e3, 'f', 1) + "us";
+	}
+	if (nanos < Q_UINT64_C(1000000000))
+	{
+		return QString::number(nanos / 1e6, 'f', 1) + "ms";
+	}
+	return QString::number(nanos / 1e9, 'f', 1) + "s";
+}
+
+LatencyHistogram::LatencyHistogram()
+{
+}
+
+quint64 LatencyHistogram::count() const
+{
+	quint64 result = 0;
+	for (int i = 0; i < NUM_BUCKETS; ++i)
+	{
+		result += buckets[i].load();
+	}
+	return result;
+}
+
+quint64 LatencyHistogram::mean() const
+{
+	quint64 recorded = count();
+	return recorded == 0 ? 0 : total.load() / recorded;
+}
+
+quint64 LatencyHistogram::maximum() const
+{
+	return largest.load();
+}
+
+quint64 LatencyHistogram::valueAtPercentile(double percentile) const
+{
+	quint64 recorded = count();
+	if (recorded == 0)
+	{
+		return 0;
+	}
+	quint64 wanted = (quint64)(recorded * percentile / 100.0 + 0.5);
+	if (wanted == 0)
+	{
+		wanted = 1;
+	}
+
+	quint64 seen = 0;
+	for (int i = 0; i < NUM_BUCKETS; ++i)
+	{
+		seen += buckets[i].load();
+		if (seen >= wanted)
+		{
+			// the bucket bounds can overshoot what was actually recorded
+			return qMin(highestValueIn(i), maximum());
+		}
+	}
+	// more was recorded while we were counting
+	return maximum();
+}
+
+void LatencyHistogram::reset()
+{
+	for (int i = 0; i < NUM_BUCKETS; ++i)
+	{
+		buckets[i].set(0);
+	}
+	total.set(0);
+	largest.set(0);
+}
+
+QString LatencyHistogram::summary() const
+{
+	return QString("count=%1 mean=%2 p50=%3 p90=%4 p99=%5 p99.9=%6 max=%7")
+		.arg(count())
+		.arg(formatNanos(mean()))
+		.arg(formatNanos(valueAtPercentile(50)))
+		.arg(formatNanos(valueAtPercentile(90)))
+		.arg(formatNanos(valueAtPercentile(99)))
+		.arg(formatNanos(valueAtPercentile(99.9)))
+		.arg(formatNanos(maximum()));
+}
+
+quint64 LatencyHistogram::highestValueIn(int bucket)
+{
+	if (bucket < SUB_BUCKETS)
+	{
+		return bucket;
+	}
+	int exponent = bucket / SUB_BUCKETS + SUB_BUCKET_BITS - 1;
+	quint64 sub = bucket % SUB_BUCKETS;
+	quint64 width = Q_UINT64_C(1) << (exponent - SUB_BUCKET_BITS);
+	return ((SUB_BUCKETS + sub) << (exponent - SUB_BUCKET_BITS)) + width - 1;
+}
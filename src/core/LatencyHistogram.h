@@ -0,0 +1,122 @@
+#ifndef LATENCY_HISTOGRAM_H_
+#define LATENCY_HISTOGRAM_H_
+//
+// C++ Interface: LatencyHistogram
+//
+// Description:
+//
+//
+// Author: Vitali Lovich <vlovich@gmail.com>, (C) 2008
+//
+// Copyright: See COPYING file that comes with this distribution
+//
+//
+#include <QString>
+
+#include "WatcherStats.h"
+
+/**
+ * A histogram of durations in the spirit of HdrHistogram: buckets are grouped by power of
+ * two and each group is split into SUB_BUCKETS linear buckets, so every recorded value is
+ * kept to within 1/SUB_BUCKETS of its real value whatever its magnitude.  Buckets are
+ * StatCounters, so recording is lock-free - from any number of threads at once, as the
+ * delivery stage is - and reading may happen from any thread while values are being
+ * recorded.
+ */
+class LatencyHistogram
+{
+public:
+	LatencyHistogram();
+
+	/**
+	 * @param nanos The duration to record.  Anything above 2^(MAX_EXPONENT + 1) ns
+	 * (about 36 minutes) is counted in the last bucket.
+	 */
+	inline void record(quint64 nanos)
+	{
+		buckets[bucketFor(nanos)].add();
+		total.add(nanos);
+		largest.setMax(nanos);
+	}
+
+	quint64 count() const;
+
+	/**
+	 * @return The mean of the recorded values, in nanoseconds.
+	 */
+	quint64 mean() const;
+
+	/**
+	 * @return The largest value recorded, in nanoseconds.
+	 */
+	quint64 maximum() const;
+
+	/**
+	 * @param percentile Between 0 and 100.
+	 * @return The value at or below which percentile % of the recorded values fall, in
+	 * nanoseconds, or 0 if nothing was recorded.
+	 */
+	quint64 valueAtPercentile(double percentile) const;
+
+	/**
+	 * Forgets everything recorded.  Values recorded concurrently may be partially lost.
+	 */
+	void reset();
+
+	/**
+	 * @return One line of the form "count=N mean=X p50=X p90=X p99=X p99.9=X max=X".
+	 */
+	QString summary() const;
+
+private:
+	enum
+	{
+		SUB_BUCKET_BITS = 3,
+		SUB_BUCKETS = 1 << SUB_BUCKET_BITS,
+		MAX_EXPONENT = 40,
+		NUM_BUCKETS = (MAX_EXPONENT - SUB_BUCKET_BITS + 2) * SUB_BUCKETS
+	};
+
+	static inline int bucketFor(quint64 nanos)
+	{
+		if (nanos < SUB_BUCKETS)
+		{
+			return (int)nanos;
+		}
+		int exponent = highestBit(nanos);
+		if (exponent > MAX_EXPONENT)
+		{
+			return NUM_BUCKETS - 1;
+		}
+		int sub = (int)(nanos >> (exponent - SUB_BUCKET_BITS)) & (SUB_BUCKETS - 1);
+		return (exponent - SUB_BUCKET_BITS + 1) * SUB_BUCKETS + sub;
+	}
+
+	static inline int highestBit(quint64 value)
+	{
+#if defined(__GNUC__)
+		return 63 - __builtin_clzll(value);
+#else
+		int bit = 0;
+		while (value >>= 1)
+		{
+			++bit;
+		}
+		return bit;
+#endif
+	}
+
+	/**
+	 * @return The largest value that lands in the bucket.
+	 */
+	static quint64 highestValueIn(int bucket);
+
+	StatCounter buckets[NUM_BUCKETS];
+	StatCounter total;
+	StatCounter largest;
+
+	LatencyHistogram(const LatencyHistogram &);
+	LatencyHistogram & operator=(const LatencyHistogram &);
+};
+
+#endif /* LATENCY_HISTOGRAM_H_ */
@@ -0,0 +1,368 @@
+//
+// C++ Implementation: PartitionedExecutor
+//
+// Description:
+//
+//
+// Author: Vitali Lovich <vlovich@gmail.com>, (C) 2008
+//
+// Copyright: See COPYING file that comes with this distribution
+//
+//
+#include "PartitionedExecutor.h"
+
+#include <QThread>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QWaitCondition>
+#include <QList>
+
+#include "EventBatch.h"
+
+/**
+ * Where the two workers owning either end of a move meet, so that the move is delivered
+ * after everything queued before it for both paths & before anything queued after it.
+ * Each of the two tasks sharing it crosses it once; the last one out deletes it.
+ */
+class MoveBarrier
+{
+public:
+	MoveBarrier();
+
+	/**
+	 * Waits for the other worker.  The worker owning the source delivers the move once the
+	 * other has arrived, while the other waits until it has.
+	 */
+	void cross(FileEventListener * listener, const EventBatch & move, bool deliver);
+
+private:
+	QMutex lock;
+	QWaitCondition changed;
+	int arrived;
+	bool delivered;
+	int refs;
+};
+
+MoveBarrier::MoveBarrier() : arrived(0), delivered(false), refs(2)
+{
+}
+
+void MoveBarrier::cross(FileEventListener * listener, const EventBatch & move, bool deliver)
+{
+	QMutexLocker locker(&lock);
+	++arrived;
+	changed.wakeAll();
+	if (deliver)
+	{
+		while (arrived < 2)
+		{
+			changed.wait(&lock);
+		}
+		locker.unlock();
+		listener->onEvents(move.constData(), move.size());
+		locker.relock();
+		delivered = true;
+		changed.wakeAll();
+	}
+	else
+	{
+		while (!delivered)
+		{
+			changed.wait(&lock);
+		}
+	}
+	bool last = --refs == 0;
+	locker.unlock();
+	if (last)
+	{
+		delete this;
+	}
+}
+
+/**
+ * A worker thread and the queue it works through.
+ */
+class PartitionWorker : public QThread
+{
+public:
+	explicit PartitionWorker(int limit);
+
+	/**
+	 * Queues the events for the listener, first waiting for room if the queue is full.  A
+	 * batch larger than the limit is still taken once the queue is empty.
+	 *
+	 * @param barrier If not NULL, the batch is a move shared with another worker, which is
+	 * delivered by the one told to.
+	 * @return How long it had to wait, in nanoseconds.
+	 */
+	quint64 push(FileEventListener * listener, const EventBatch & batch, MoveBarrier * barrier = NULL, bool deliver = true);
+
+	/**
+	 * Makes the thread exit once the queue is empty.
+	 */
+	void finish();
+
+	void waitForIdle();
+
+	int queued() const;
+
+protected:
+	void run();
+
+private:
+	struct Task
+	{
+		FileEventListener * listener;
+		EventBatch batch;
+		MoveBarrier * barrier;
+		bool deliver;
+	};
+
+	mutable QMutex lock;
+
+	/**
+	 * Signalled whenever a task is queued or finished.
+	 */
+	QWaitCondition changed;
+
+	QList<Task> tasks;
+
+	/**
+	 * The events in tasks.
+	 */
+	int pending;
+	int limit;
+	bool busy;
+	bool stopping;
+};
+
+PartitionWorker::PartitionWorker(int limit_) : pending(0), limit(limit_), busy(false), stopping(false)
+{
+}
+
+quint64 PartitionWorker::push(FileEventListener * listener, const EventBatch & batch, MoveBarrier * barrier, bool deliver)
+{
+	// the side of a move that doesn't deliver it has no events to count
+	int size = deliver ? batch.size() : 0;
+	quint64 waited = 0;
+	QMutexLocker locker(&lock);
+	if (pending > 0 && pending + size > limit)
+	{
+		quint64 start = monotonicNanos();
+		while (pending > 0 && pending + size > limit)
+		{
+			changed.wait(&lock);
+		}
+		waited = monotonicNanos() - start;
+	}
+
+	Task task;
+	task.listener = listener;
+	task.batch = batch;
+	task.barrier = barrier;
+	task.deliver = deliver;
+	tasks += task;
+	pending += size;
+	changed.wakeAll();
+	return waited;
+}
+
+void PartitionWorker::finish()
+{
+	QMutexLocker locker(&lock);
+	stopping = true;
+	changed.wakeAll();
+}
+
+void PartitionWorker::waitForIdle()
+{
+	QMutexLocker locker(&lock);
+	while (busy || !tasks.isEmpty())
+	{
+		changed.wait(&lock);
+	}
+}
+
+int PartitionWorker::queued() const
+{
+	QMutexLocker locker(&lock);
+	return pending;
+}
+
+void PartitionWorker::run()
+{
+	QMutexLocker locker(&lock);
+	for (;;)
+	{
+		while (tasks.isEmpty() && !stopping)
+		{
+			changed.wait(&lock);
+		}
+		if (tasks.isEmpty())
+		{
+			return;
+		}
+
+		Task task = tasks.takeFirst();
+		busy = true;
+		locker.unlock();
+
+		if (task.barrier != NULL)
+		{
+			task.barrier->cross(task.listener, task.batch, task.deliver);
+		}
+		else
+		{
+			task.listener->onEvents(task.batch.constData(), task.batch.size());
+		}
+
+		locker.relock();
+		pending -= task.deliver ? task.batch.size() : 0;
+		busy = false;
+		changed.wakeAll();
+	}
+}
+
+/**
+ * FNV-1a over the path, or over the part of it up to the last slash.
+ */
+static inline uint partitionHash(const QByteArray & path, bool directory)
+{
+	const char * data = path.constData();
+	int length = path.size();
+	if (directory)
+	{
+		while (length > 0 && data[length - 1] != '/')
+		{
+			--length;
+		}
+	}
+
+	uint hash = 2166136261u;
+	for (int i = 0; i < length; ++i)
+	{
+		hash ^= (uchar)data[i];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+PartitionedExecutor::PartitionedExecutor(int workers, Partitioning partitioning_, int queueLimit)
+	: partitioning(partitioning_)
+{
+	for (int i = 0; i < qMax(workers, 1); ++i)
+	{
+		PartitionWorker * worker = new PartitionWorker(qMax(queueLimit, 1));
+		worker->start();
+		pool += worker;
+	}
+}
+
+PartitionedExecutor::~PartitionedExecutor()
+{
+	foreach(PartitionWorker * worker, pool)
+	{
+		worker->finish();
+	}
+	foreach(PartitionWorker * worker, pool)
+	{
+		worker->wait();
+		delete worker;
+	}
+}
+
+void PartitionedExecutor::execute(FileEventListener * listener, const EventBatch & batch)
+{
+	if (pool.size() == 1)
+	{
+		// nothing to split
+		push(pool.first(), listener, batch);
+		return;
+	}
+
+	// barriers must be queued in the same order on every worker, or two workers could each
+	// wait at the barrier the other has yet to reach
+	QMutexLocker dispatching(&dispatchLock);
+
+	// split the batch up, keeping the order within each part
+	QVector<QVector<FileEvent> > parts(pool.size());
+	bool directory = partitioning == ByDirectory;
+	const FileEvent * events = batch.constData();
+	for (int i = 0; i < batch.size(); ++i)
+	{
+		int owner = partitionHash(events[i].nativePath(), directory) % pool.size();
+		if (events[i].type() == FileEvent::Moved && !events[i].nativeOtherPath().isEmpty())
+		{
+			int partner = partitionHash(events[i].nativeOtherPath(), directory) % pool.size();
+			if (partner != owner)
+			{
+				// whatever came before the move has to be queued ahead of it
+				pushParts(listener, parts);
+				QVector<FileEvent> moved;
+				moved += events[i];
+				EventBatch move(moved);
+				MoveBarrier * barrier = new MoveBarrier;
+				push(pool.at(owner), listener, move, barrier, true);
+				push(pool.at(partner), listener, move, barrier, false);
+				continue;
+			}
+		}
+		parts[owner] += events[i];
+	}
+	pushParts(listener, parts);
+}
+
+void PartitionedExecutor::pushParts(FileEventListener * listener, QVector<QVector<FileEvent> > & parts)
+{
+	for (int i = 0; i < parts.size(); ++i)
+	{
+		if (!parts[i].isEmpty())
+		{
+			push(pool.at(i), listener, EventBatch(parts[i]));
+			parts[i].clear();
+		}
+	}
+}
+
+void PartitionedExecutor::push(PartitionWorker * worker, FileEventListener * listener, const EventBatch & batch, MoveBarrier * barrier, bool deliver)
+{
+	quint64 waited = worker->push(listener, batch, barrier, deliver);
+	if (waited != 0)
+	{
+		stallCount.add();
+		stallTime.add(waited);
+	}
+}
+
+void PartitionedExecutor::waitForIdle()
+{
+	foreach(PartitionWorker * worker, pool)
+	{
+		worker->waitForIdle();
+	}
+}
+
+int PartitionedExecutor::workers() const
+{
+	return pool.size();
+}
+
+int PartitionedExecutor::queued() const
+{
+	int total = 0;
+	foreach(PartitionWorker * worker, pool)
+	{
+		total += worker->queued();
+	}
+	return total;
+}
+
+quint64 PartitionedExecutor::stalls() const
+{
+	return stallCount.load();
+}
+
+quint64 PartitionedExecutor::stalledNanos() const
+{
+	return stallTime.load();
+}
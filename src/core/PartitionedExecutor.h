@@ -0,0 +1,130 @@
+#ifndef PARTITIONED_EXECUTOR_H_
+#define PARTITIONED_EXECUTOR_H_
+//
+// C++ Interface: PartitionedExecutor
+//
+// Description:
+//
+//
+// Author: Vitali Lovich <vlovich@gmail.com>, (C) 2008
+//
+// Copyright: See COPYING file that comes with this distribution
+//
+//
+#include <QVector>
+#include <QMutex>
+
+#include "FileEventListener.h"
+#include "WatcherStats.h"
+
+class EventBatch;
+class PartitionWorker;
+class MoveBarrier;
+
+/**
+ * The number of worker threads, unless told otherwise.
+ */
+#ifndef PARTITION_WORKERS
+#define PARTITION_WORKERS 4
+#endif /* PARTITION_WORKERS */
+
+/**
+ * How many events may be waiting for a single worker before the poll thread is made to
+ * wait for it.
+ */
+#ifndef PARTITION_QUEUE_LIMIT
+#define PARTITION_QUEUE_LIMIT 65536
+#endif /* PARTITION_QUEUE_LIMIT */
+
+/**
+ * Runs listeners that do heavy work (hashing, uploading, ...) on a pool of workers, without
+ * giving up the order of the events for any one path.  Each batch is split up by a hash of
+ * the path (or of its directory) and every part goes to the worker that owns it, so the
+ * events for a path are always handled by the same worker in the order they happened while
+ * unrelated paths are handled in parallel.  A move whose two paths belong to different
+ * workers is handed to both: the two meet at a barrier, so it is delivered (once, by the
+ * owner of the path moved from) after the earlier events for either path & before the
+ * later ones.
+ *
+ * Once a worker has PARTITION_QUEUE_LIMIT events waiting, execute() blocks until it catches
+ * up.  That holds up the poll thread, and the kernel queues the events in the meantime -
+ * consumers that can't keep up slow the watcher down instead of growing without bound.
+ *
+ * The watcher calls execute() with its listeners locked, so a listener run here must not
+ * add or remove listeners or subscriptions itself: should execute() be waiting on that
+ * very worker, neither would ever get anywhere.  Do it from another thread, or from a
+ * listener called directly on the poll thread.
+ *
+ * @see FileWatcher::addListener
+ */
+class PartitionedExecutor : public ListenerExecutor
+{
+public:
+	/**
+	 * What keeps events in order.
+	 */
+	enum Partitioning
+	{
+		ByPath,			/**< Events for the same path.  The default. */
+		ByDirectory		/**< Events for anything in the same directory. */
+	};
+
+	/**
+	 * Starts the workers.
+	 *
+	 * @param queueLimit @see PARTITION_QUEUE_LIMIT
+	 */
+	explicit PartitionedExecutor(int workers = PARTITION_WORKERS, Partitioning partitioning = ByPath, int queueLimit = PARTITION_QUEUE_LIMIT);
+
+	/**
+	 * Finishes whatever is queued, then stops the workers.
+	 */
+	~PartitionedExecutor();
+
+	void execute(FileEventListener * listener, const EventBatch & batch);
+
+	/**
+	 * Blocks until every worker has finished everything queued so far - after removing a
+	 * listener, say, before destroying it.
+	 */
+	void waitForIdle();
+
+	int workers() const;
+
+	/**
+	 * @return The number of events waiting, across all the workers.
+	 */
+	int queued() const;
+
+	/**
+	 * @return How many times, and for how long in total (in nanoseconds), execute() had to
+	 * wait for a worker to catch up.
+	 */
+	quint64 stalls() const;
+	quint64 stalledNanos() const;
+
+private:
+	Partitioning partitioning;
+	QVector<PartitionWorker *> pool;
+
+	/**
+	 * Held across execute(), so that watchers sharing the executor queue moves in the same
+	 * order on every worker.
+	 */
+	QMutex dispatchLock;
+
+	StatCounter stallCount;
+	StatCounter stallTime;
+
+	/**
+	 * Hands the events to the worker, counting the stall if it had to wait.
+	 */
+	void push(PartitionWorker * worker, FileEventListener * listener, const EventBatch & batch, MoveBarrier * barrier = NULL, bool deliver = true);
+
+	/**
+	 * Hands each worker its part of the events split up so far.
+	 */
+	void pushParts(FileEventListener * listener, QVector<QVector<FileEvent> > & parts);
+};
+
+#endif /* PARTITIONED_EXECUTOR_H_ */
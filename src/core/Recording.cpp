@@ -0,0 +1,137 @@
+//
+// C++ Implementation: Recording
+//
+// Description:
+//
+//
+// Author: Vitali Lovich <vlovich@gmail.com>, (C) 2008
+//
+// Copyright: See COPYING file that comes with this distribution
+//
+//
+#include "Recording.h"
+
+#include <QMutexLocker>
+
+#include "WatcherStats.h"
+
+static const char MAGIC[] = "FNRECRD1";
+static const int MAGIC_SIZE = sizeof(MAGIC) - 1;
+
+template <typename T>
+static bool writeValue(QFile & file, const T & value)
+{
+	return file.write((const char *)&value, sizeof(value)) == sizeof(value);
+}
+
+template <typename T>
+static bool readValue(QFile & file, T & value)
+{
+	return file.read((char *)&value, sizeof(value)) == sizeof(value);
+}
+
+Recording::Recording()
+{
+}
+
+Recording::~Recording()
+{
+	close();
+}
+
+bool Recording::create(const QString & fileName)
+{
+	close();
+	QMutexLocker locker(&lock);
+	file.setFileName(fileName);
+	if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+	{
+		return false;
+	}
+	if (file.write(MAGIC, MAGIC_SIZE) != MAGIC_SIZE)
+	{
+		file.close();
+		return false;
+	}
+	return true;
+}
+
+bool Recording::open(const QString & fileName)
+{
+	close();
+	QMutexLocker locker(&lock);
+	file.setFileName(fileName);
+	if (!file.open(QIODevice::ReadOnly))
+	{
+		return false;
+	}
+	char magic[MAGIC_SIZE];
+	if (file.read(magic, MAGIC_SIZE) != MAGIC_SIZE || qstrncmp(magic, MAGIC, MAGIC_SIZE) != 0)
+	{
+		file.close();
+		return false;
+	}
+	return true;
+}
+
+void Recording::close()
+{
+	QMutexLocker locker(&lock);
+	if (file.isOpen())
+	{
+		file.close();
+	}
+}
+
+bool Recording::isOpen() const
+{
+	QMutexLocker locker(&lock);
+	return file.isOpen();
+}
+
+QString Recording::fileName() const
+{
+	QMutexLocker locker(&lock);
+	return file.fileName();
+}
+
+QString Recording::errorString() const
+{
+	QMutexLocker locker(&lock);
+	return file.errorString();
+}
+
+bool Recording::write(Type type, int handle, const char * data, int size)
+{
+	quint8 recordType = type;
+	qint32 recordHandle = handle;
+	quint64 timestamp = monotonicNanos();
+	quint32 recordSize = size;
+
+	QMutexLocker locker(&lock);
+	bool ok = file.isOpen();
+	ok = ok && writeValue(file, recordType);
+	ok = ok && writeValue(file, recordHandle);
+	ok = ok && writeValue(file, timestamp);
+	ok = ok && writeValue(file, recordSize);
+	ok = ok && file.write(data, size) == size;
+	return ok;
+}
+
+bool Recording::read(Record & record)
+{
+	QMutexLocker locker(&lock);
+	quint32 size;
+	if (!readValue(file, record.type) || !readValue(file, record.handle)
+		|| !readValue(file, record.timestamp) || !readValue(file, size))
+	{
+		return false;
+	}
+	if ((qint64)size > file.bytesAvailable())
+	{
+		// cut short, or the size is garbage - either way, not worth allocating for
+		return false;
+	}
+	record.data = file.read(size);
+	return record.data.size() == (int)size;
+}
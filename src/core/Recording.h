@@ -0,0 +1,101 @@
+#ifndef RECORDING_H_
+#define RECORDING_H_
+//
+// C++ Interface: Recording
+//
+// Description:
+//
+//
+// Author: Vitali Lovich <vlovich@gmail.com>, (C) 2008
+//
+// Copyright: See COPYING file that comes with this distribution
+//
+//
+#include <QtGlobal>
+#include <QString>
+#include <QByteArray>
+#include <QFile>
+#include <QMutex>
+
+/**
+ * A file of raw notifications, exactly as the operating system delivered them, along with
+ * the table needed to make sense of them.  Written by an implementation that is recording
+ * (@see LinuxWatcher::setRecording) and read back by the replay plugin, so that a real
+ * event storm can be played to a consumer again & again.
+ *
+ * The format is the magic string "FNRECRD1", then records of a type (quint8), a handle
+ * (qint32), a timestamp (quint64, @see monotonicNanos), a size (quint32) and that many
+ * bytes of data - in the byte order of the machine that wrote it.
+ */
+class Recording
+{
+public:
+	/**
+	 * What a record is about, and what its fields mean.
+	 */
+	enum Type
+	{
+		WatchAdded = 1,		/**< handle, data = the native path now watched through it */
+		WatchRemoved,		/**< handle, data = the native path no longer watched through it */
+		NativeEvents		/**< data = everything returned by one read */
+	};
+
+	struct Record
+	{
+		quint8 type;
+		qint32 handle;
+		quint64 timestamp;
+		QByteArray data;
+	};
+
+	Recording();
+
+	/**
+	 * Flushes & closes the file.
+	 */
+	~Recording();
+
+	/**
+	 * Starts a new recording, replacing whatever was in the file.
+	 *
+	 * @return Whether it could be created.
+	 */
+	bool create(const QString & fileName);
+
+	/**
+	 * Opens a recording for reading.
+	 *
+	 * @return Whether it could be opened & really is a recording.
+	 */
+	bool open(const QString & fileName);
+
+	void close();
+	bool isOpen() const;
+	QString fileName() const;
+	QString errorString() const;
+
+	/**
+	 * Appends a record, timestamped now.  Safe to call from any thread.
+	 *
+	 * @return Whether it was written.
+	 */
+	bool write(Type type, int handle, const char * data, int size);
+
+	/**
+	 * Reads the next record.
+	 *
+	 * @return False at the end of the recording, or if it was cut short or is corrupt.
+	 */
+	bool read(Record & record);
+
+private:
+	QFile file;
+
+	/**
+	 * Keeps records from different threads whole.  Taken for everything that touches the
+	 * file.
+	 */
+	mutable QMutex lock;
+};
+
+#endif /* RECORDING_H_ */
@@ -0,0 +1,247 @@
+//
+// C++ Implementation: SubscriptionIndex
+//
+// Description: 
+//
+//
+// Author: Vitali Lovich <vlovich@gmail.com>, (C) 2008
+//
+// Copyright: See COPYING file that comes with this distribution
+//
+//
+#include "SubscriptionIndex.h"
+
+#include <QFile>
+#include <QVector>
+#include <QtAlgorithms>
+#include <string.h>
+
+#include "EventBatch.h"
+#include "EventSink.h"
+
+SubscriptionIndex::Node::~Node()
+{
+	foreach(const Child & child, children)
+	{
+		delete child.node;
+	}
+}
+
+SubscriptionIndex::Node * SubscriptionIndex::Node::child(const char * name, int length) const
+{
+	uint hash = hashComponent(name, length);
+	for (QHash<uint, Child>::const_iterator i = children.constFind(hash); i != children.constEnd() && i.key() == hash; ++i)
+	{
+		const QByteArray & candidate = i.value().name;
+		if (candidate.size() == length && memcmp(candidate.constData(), name, length) == 0)
+		{
+			return i.value().node;
+		}
+	}
+	return NULL;
+}
+
+uint SubscriptionIndex::hashComponent(const char * name, int length)
+{
+	// FNV-1a
+	uint hash = 2166136261u;
+	for (int i = 0; i < length; ++i)
+	{
+		hash = (hash ^ (uchar)name[i]) * 16777619u;
+	}
+	return hash;
+}
+
+SubscriptionIndex::SubscriptionIndex() : nextId(1)
+{
+	// so that emptying it never gives the memory back
+	matched.reserve(16);
+}
+
+SubscriptionIndex::~SubscriptionIndex()
+{
+}
+
+QList<QByteArray> SubscriptionIndex::components(const QString & path)
+{
+	QList<QByteArray> parts = QFile::encodeName(path).split('/');
+	parts.removeAll(QByteArray());
+	return parts;
+}
+
+int SubscriptionIndex::add(const QString & pathPrefix, int mask, EventSink * sink)
+{
+	Q_ASSERT(sink != NULL);
+
+	QList<QByteArray> parts = components(pathPrefix);
+	Node * node = &root;
+	foreach(const QByteArray & part, parts)
+	{
+		Node * child = node->child(part.constData(), part.size());
+		if (child == NULL)
+		{
+			Node::Child entry;
+			entry.name = part;
+			entry.node = child = new Node;
+			node->children.insertMulti(hashComponent(part.constData(), part.size()), entry);
+		}
+		node = child;
+	}
+
+	Subscription subscription;
+	subscription.id = nextId++;
+	subscription.mask = mask;
+	subscription.sink = sink;
+	node->subscriptions += subscription;
+
+	prefixes.insert(subscription.id, parts);
+	sinks.insert(subscription.id, sink);
+	return subscription.id;
+}
+
+bool SubscriptionIndex::remove(int subscription)
+{
+	if (!prefixes.contains(subscription))
+	{
+		return false;
+	}
+	QList<QByteArray> parts = prefixes.take(subscription);
+	sinks.remove(subscription);
+	// route() delivers a copy, so this may be in the middle of one
+	matches.remove(subscription);
+
+	QList<Node *> path;
+	Node * node = &root;
+	foreach(const QByteArray & part, parts)
+	{
+		path += node;
+		node = node->child(part.constData(), part.size());
+		Q_ASSERT(node != NULL);
+	}
+
+	for (int i = 0; i < node->subscriptions.size(); ++i)
+	{
+		if (node->subscriptions.at(i).id == subscription)
+		{
+			node->subscriptions.removeAt(i);
+			break;
+		}
+	}
+
+	// prune the branch if nothing else hangs off of it
+	for (int i = parts.size() - 1; i >= 0; --i)
+	{
+		if (!node->subscriptions.isEmpty() || !node->children.isEmpty())
+		{
+			break;
+		}
+		Node * parent = path.at(i);
+		uint hash = hashComponent(parts.at(i).constData(), parts.at(i).size());
+		for (QHash<uint, Node::Child>::iterator child = parent->children.find(hash); child != parent->children.end() && child.key() == hash; ++child)
+		{
+			if (child.value().node == node)
+			{
+				parent->children.erase(child);
+				break;
+			}
+		}
+		delete node;
+		node = parent;
+	}
+	return true;
+}
+
+bool SubscriptionIndex::isEmpty() const
+{
+	return sinks.isEmpty();
+}
+
+void SubscriptionIndex::collect(const QByteArray & path, int type, int index) const
+{
+	const Node * node = &root;
+	int start = 0;
+	while (node != NULL)
+	{
+		foreach(const Subscription & subscription, node->subscriptions)
+		{
+			if ((subscription.mask & type) == 0)
+			{
+				continue;
+			}
+			QVector<int> & selected = matches[subscription.id];
+			if (selected.isEmpty())
+			{
+				if (selected.capacity() == 0)
+				{
+					// first time round - emptying it never gives the memory back after this
+					selected.reserve(16);
+				}
+				matched += subscription.id;
+			}
+			// a move can match the same subscription through both of its paths
+			if (selected.isEmpty() || selected.last() != index)
+			{
+				selected += index;
+			}
+		}
+
+		while (start < path.length() && path.at(start) == '/')
+		{
+			++start;
+		}
+		if (start >= path.length())
+		{
+			break;
+		}
+		int end = path.indexOf('/', start);
+		if (end == -1)
+		{
+			end = path.length();
+		}
+		node = node->child(path.constData() + start, end - start);
+		start = end;
+	}
+}
+
+void SubscriptionIndex::route(const EventBatch & batch) const
+{
+	if (sinks.isEmpty() || batch.isEmpty())
+	{
+		return;
+	}
+
+	for (int i = 0; i < batch.size(); ++i)
+	{
+		const FileEvent & event = batch.at(i);
+		collect(event.nativePath(), event.type(), i);
+		if (!event.nativeOtherPath().isEmpty())
+		{
+			collect(event.nativeOtherPath(), event.type(), i);
+		}
+	}
+
+	// by handle, so the earliest subscriber is always delivered to first
+	qSort(matched.begin(), matched.end());
+	foreach(int subscription, matched)
+	{
+		// a sink may unsubscribe itself or a later one while being delivered to.  The copy
+		// only shares the matches, and is gone again before they're emptied.
+		EventSink * sink = sinks.value(subscription);
+		QHash<int, QVector<int> >::const_iterator found = matches.constFind(subscription);
+		if (sink != NULL && found != matches.constEnd())
+		{
+			QVector<int> selected = found.value();
+			sink->deliver(batch, selected);
+		}
+	}
+
+	for (int i = 0; i < matched.size(); ++i)
+	{
+		QHash<int, QVector<int> >::iterator found = matches.find(matched.at(i));
+		if (found != matches.end())
+		{
+			found.value().resize(0);
+		}
+	}
+	matched.resize(0);
+}
@@ -0,0 +1,126 @@
+#ifndef SUBSCRIPTION_INDEX_H_
+#define SUBSCRIPTION_INDEX_H_
+//
+// C++ Interface: SubscriptionIndex
+//
+// Description: 
+//
+//
+// Author: Vitali Lovich <vlovich@gmail.com>, (C) 2008
+//
+// Copyright: See COPYING file that comes with this distribution
+//
+//
+#include <QByteArray>
+#include <QHash>
+#include <QList>
+#include <QVector>
+#include <QString>
+
+class EventBatch;
+class EventSink;
+
+/**
+ * Routes events to subscribers by path prefix.  Subscriptions are stored in a tree keyed by
+ * path component, so finding the subscribers for an event only walks the components of its
+ * path instead of testing every subscription.  Components are kept in the native encoding
+ * (@see FileEvent::nativePath) so that routing never has to decode a path.
+ *
+ * Routing doesn't allocate once the index has routed to each subscription: components are
+ * looked up where they lie in the path, and the matches are gathered in buffers kept from
+ * one batch to the next.
+ *
+ * Not thread-safe - FileWatcher guards it with a read/write lock, and only ever routes from
+ * one thread at a time.
+ */
+class SubscriptionIndex
+{
+public:
+	SubscriptionIndex();
+	~SubscriptionIndex();
+
+	/**
+	 * @param pathPrefix Only events at or below this directory are delivered.  An empty
+	 * prefix matches everything.
+	 * @param mask Combination of FileEvent::Type flags.
+	 * @param sink Where to deliver the events.  Not owned.
+	 * @return A handle that can be passed to remove().
+	 */
+	int add(const QString & pathPrefix, int mask, EventSink * sink);
+
+	/**
+	 * @return Whether a subscription with the given handle existed.
+	 */
+	bool remove(int subscription);
+
+	bool isEmpty() const;
+
+	/**
+	 * Delivers every event in batch to the matching subscribers.  Each subscriber is called
+	 * at most once per batch.  Not to be called from more than one thread at a time.
+	 */
+	void route(const EventBatch & batch) const;
+
+private:
+	struct Subscription
+	{
+		int id;
+		int mask;
+		EventSink * sink;
+	};
+
+	struct Node
+	{
+		~Node();
+
+		struct Child
+		{
+			QByteArray name;
+			Node * node;
+		};
+
+		/**
+		 * @return The child with the given name, or NULL.
+		 */
+		Node * child(const char * name, int length) const;
+
+		/**
+		 * Keyed by hashComponent() of the name, so that a component can be looked up without
+		 * being copied out of its path.  Names that hash the same share the key.
+		 */
+		QHash<uint, Child> children;
+		QList<Subscription> subscriptions;
+	};
+
+	static uint hashComponent(const char * name, int length);
+
+	/**
+	 * Adds index to the matches of every subscription along path that wants events of type.
+	 */
+	void collect(const QByteArray & path, int type, int index) const;
+
+	static QList<QByteArray> components(const QString & path);
+
+	Node root;
+
+	/**
+	 * Maps the subscription handle to the components of its prefix, so it can be found again.
+	 */
+	QHash<int, QList<QByteArray> > prefixes;
+
+	/**
+	 * Maps the subscription handle to its sink.
+	 */
+	QHash<int, EventSink *> sinks;
+
+	/**
+	 * The events matched by each subscription in the batch being routed, and the
+	 * subscriptions with any - emptied after each batch, but kept for the next.
+	 */
+	mutable QHash<int, QVector<int> > matches;
+	mutable QVector<int> matched;
+
+	int nextId;
+};
+
+#endif /* SUBSCRIPTION_INDEX_H_ */
@@ -0,0 +1,199 @@
+//
+// C++ Implementation: Trace
+//
+// Description:
+//
+//
+// Author: Vitali Lovich <vlovich@gmail.com>, (C) 2008
+//
+// Copyright: See COPYING file that comes with this distribution
+//
+//
+#include "Trace.h"
+
+#include <QFile>
+#include <QIODevice>
+#include <QList>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QThread>
+#include <QThreadStorage>
+
+#include "WatcherStats.h"
+
+/**
+ * One thread's records.  Only ever written by that thread - readers copy out whatever is
+ * between head - TRACE_RING_SIZE and head.
+ */
+struct TraceRing
+{
+	explicit TraceRing(quint64 threadId) : thread(threadId), head(0)
+	{
+	}
+
+	quint64 thread;
+
+	/**
+	 * The total number of records ever written.
+	 */
+	volatile quint64 head;
+
+	Trace::Record records[TRACE_RING_SIZE];
+};
+
+/**
+ * The rings of the threads that are still tracing, along with those of exited threads, in
+ * the order they were taken.  Only locked to take or give back a ring or to dump.
+ */
+static QMutex ringsLock;
+static QList<TraceRing *> rings;
+
+/**
+ * The rings of exited threads, oldest first.  Kept so that what a thread was doing is
+ * still there after it has exited, until TRACE_RETIRED_RINGS of them have piled up.
+ */
+static QList<TraceRing *> retiredRings;
+
+static TraceRing * createRing()
+{
+	quint64 thread = (quint64)(quintptr)QThread::currentThreadId();
+	QMutexLocker locker(&ringsLock);
+	TraceRing * ring;
+	if (retiredRings.size() >= TRACE_RETIRED_RINGS)
+	{
+		// the records of the thread that exited first make way
+		ring = retiredRings.takeFirst();
+		rings.removeOne(ring);
+		ring->thread = thread;
+		ring->head = 0;
+	}
+	else
+	{
+		ring = new TraceRing(thread);
+	}
+	rings += ring;
+	return ring;
+}
+
+/**
+ * Held by every tracing thread in a QThreadStorage, which deletes it when the thread exits
+ * - that's what hands the ring back.
+ */
+struct RingHandle
+{
+	explicit RingHandle(TraceRing * ring_) : ring(ring_)
+	{
+	}
+
+	~RingHandle();
+
+	TraceRing * ring;
+};
+
+static QThreadStorage<RingHandle *> threadRing;
+
+#if defined(__GNUC__)
+/**
+ * Looked up on every record, where QThreadStorage would be too slow.
+ */
+static __thread TraceRing * cachedRing = NULL;
+#endif /* __GNUC__ */
+
+RingHandle::~RingHandle()
+{
+#if defined(__GNUC__)
+	cachedRing = NULL;
+#endif /* __GNUC__ */
+	QMutexLocker locker(&ringsLock);
+	retiredRings += ring;
+}
+
+static inline TraceRing * currentRing()
+{
+#if defined(__GNUC__)
+	if (cachedRing != NULL)
+	{
+		return cachedRing;
+	}
+#endif /* __GNUC__ */
+	if (!threadRing.hasLocalData())
+	{
+		threadRing.setLocalData(new RingHandle(createRing()));
+	}
+	TraceRing * ring = threadRing.localData()->ring;
+#if defined(__GNUC__)
+	cachedRing = ring;
+#endif /* __GNUC__ */
+	return ring;
+}
+
+void Trace::record(Event event, int handle, quint32 mask, quint64 value)
+{
+	TraceRing * ring = currentRing();
+	quint64 head = ring->head;
+
+	Record & record = ring->records[head & (TRACE_RING_SIZE - 1)];
+	record.timestamp = monotonicNanos();
+	record.event = event;
+	record.handle = handle;
+	record.mask = mask;
+	record.reserved = 0;
+	record.value = value;
+
+#if defined(__GNUC__)
+	__atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+#else
+	ring->head = head + 1;
+#endif
+}
+
+bool Trace::dump(QIODevice * device)
+{
+	Q_ASSERT(device != NULL);
+
+	QMutexLocker locker(&ringsLock);
+
+	quint32 recordSize = sizeof(Record);
+	quint32 numRings = rings.size();
+	bool ok = device->write("FNTRACE1", 8) == 8;
+	ok = ok && device->write((const char *)&recordSize, sizeof(recordSize)) == sizeof(recordSize);
+	ok = ok && device->write((const char *)&numRings, sizeof(numRings)) == sizeof(numRings);
+
+	foreach(TraceRing * ring, rings)
+	{
+#if defined(__GNUC__)
+		quint64 head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+#else
+		quint64 head = ring->head;
+#endif
+		quint32 count = (quint32)qMin(head, (quint64)TRACE_RING_SIZE);
+		ok = ok && device->write((const char *)&ring->thread, sizeof(ring->thread)) == sizeof(ring->thread);
+		ok = ok && device->write((const char *)&count, sizeof(count)) == sizeof(count);
+
+		for (quint64 i = head - count; ok && i < head; ++i)
+		{
+			const Record & record = ring->records[i & (TRACE_RING_SIZE - 1)];
+			ok = device->write((const char *)&record, sizeof(record)) == sizeof(record);
+		}
+	}
+	return ok;
+}
+
+bool Trace::dump(const QString & fileName)
+{
+	QFile file(fileName);
+	if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+	{
+		return false;
+	}
+	return dump(&file);
+}
+
+const char * Trace::eventName(quint32 event)
+{
+	static const char * NAMES[NumEvents] = {
+		NULL, "watch-added", "watch-removed", "read", "native-event", "batch", "overflow",
+		"poll-error", "poll-stopped"
+	};
+	return event < NumEvents ? NAMES[event] : NULL;
+}
@@ -0,0 +1,113 @@
+#ifndef TRACE_H_
+#define TRACE_H_
+//
+// C++ Interface: Trace
+//
+// Description:
+//
+//
+// Author: Vitali Lovich <vlovich@gmail.com>, (C) 2008
+//
+// Copyright: See COPYING file that comes with this distribution
+//
+//
+#include <QtGlobal>
+#include <QString>
+
+class QIODevice;
+
+/**
+ * The number of records kept per thread.  Must be a power of 2.
+ */
+#ifndef TRACE_RING_SIZE
+#define TRACE_RING_SIZE 4096
+#endif /* TRACE_RING_SIZE */
+
+/**
+ * The number of exited threads whose records are kept.  Beyond that, a thread that starts
+ * tracing takes over the ring of the thread that exited first, so that applications that
+ * keep creating threads (or watchers) don't keep growing.
+ */
+#ifndef TRACE_RETIRED_RINGS
+#define TRACE_RETIRED_RINGS 16
+#endif /* TRACE_RETIRED_RINGS */
+
+/**
+ * Flight recorder for diagnosing the watcher in production.  Records are fixed-size and
+ * binary - nothing is formatted until the trace is dumped and decoded with the tracedump
+ * tool - and every thread writes to its own ring buffer without taking any locks, so
+ * tracing is cheap enough to leave on.  The last TRACE_RING_SIZE records of every thread
+ * that traced something are kept, including the last TRACE_RETIRED_RINGS threads that have
+ * since exited.
+ *
+ * Only compiled in when FNOTIFY_TRACE is defined (TRACE_ON in global.pri).  Use
+ * FNOTIFY_TRACE_EVENT rather than calling record() directly so that the calls disappear
+ * otherwise.
+ */
+class Trace
+{
+public:
+	/**
+	 * What a record is about, and what its fields mean.
+	 */
+	enum Event
+	{
+		WatchAdded = 1,		/**< handle, mask = the native mask, value = whether it's recursive */
+		WatchRemoved,		/**< handle */
+		ReadCompleted,		/**< value = the number of bytes read */
+		NativeEvent,		/**< handle, mask, value = the move cookie */
+		BatchPublished,		/**< value = the number of events */
+		Overflow,		/**< the kernel dropped events */
+		PollError,		/**< value = errno */
+		PollStopped,
+
+		NumEvents
+	};
+
+	/**
+	 * The layout of the records in a dump.  32 bytes, in the byte order of the machine that
+	 * wrote it.
+	 */
+	struct Record
+	{
+		quint64 timestamp;	/**< @see monotonicNanos */
+		quint32 event;		/**< @see Event */
+		qint32 handle;		/**< The native watch handle, or -1. */
+		quint32 mask;
+		quint32 reserved;
+		quint64 value;
+	};
+
+	/**
+	 * Appends a record to the calling thread's ring buffer, overwriting the oldest one once
+	 * the ring is full.
+	 */
+	static void record(Event event, int handle = -1, quint32 mask = 0, quint64 value = 0);
+
+	/**
+	 * Writes out everything that is currently recorded.  The format is the magic string
+	 * "FNTRACE1", the record size and the number of threads (both quint32), then for each
+	 * thread its id (quint64), the number of records (quint32) and that many records, oldest
+	 * first.
+	 *
+	 * Safe to call while other threads are tracing - a record that is overwritten while it
+	 * is being dumped may come out garbled.
+	 *
+	 * @return Whether everything was written.
+	 */
+	static bool dump(QIODevice * device);
+	static bool dump(const QString & fileName);
+
+	/**
+	 * @return A short name for the event, or NULL if it's not one.
+	 */
+	static const char * eventName(quint32 event);
+};
+
+#ifdef FNOTIFY_TRACE
+#define FNOTIFY_TRACE_EVENT(event, handle, mask, value) Trace::record(Trace::event, (handle), (mask), (value))
+#else
+#define FNOTIFY_TRACE_EVENT(event, handle, mask, value) ((void)0)
+#endif /* FNOTIFY_TRACE */
+
+#endif /* TRACE_H_ */
@@ -0,0 +1,34 @@
+#ifndef WATCH_SPEC_H_
+#define WATCH_SPEC_H_
+//
+// C++ Interface: WatchSpec
+//
+// Description: 
+//
+//
+// Author: Vitali Lovich <vlovich@gmail.com>, (C) 2008
+//
+// Copyright: See COPYING file that comes with this distribution
+//
+//
+#include <QString>
+
+/**
+ * One root for FileWatcher::addWatches - the arguments addWatch would have been called
+ * with.
+ */
+struct WatchSpec
+{
+	WatchSpec() : recursive(false)
+	{
+	}
+
+	WatchSpec(const QString & watchPath, bool watchRecursive) : path(watchPath), recursive(watchRecursive)
+	{
+	}
+
+	QString path;
+	bool recursive;
+};
+
+#endif /* WATCH_SPEC_H_ */
@@ -48,7 +48,7 @@ WatcherFactory * WatcherFactory::getInstance(const QString & searchPath)
 		QDir pathDir(searchPath);
 		foreach(QString file, pathDir.entryList(QDir::Files))
 		{
-			QPluginLoader loader(file);
+			QPluginLoader loader(pathDir.absoluteFilePath(file));
 			instance = qobject_cast<WatcherFactory *>(loader.instance());
 			if (instance != NULL)
 				return instance;
@@ -65,3 +65,18 @@ FileWatcher * WatcherFactory::createWatcher()
 	createdWatchers += result;
 	return result;
 }
+
+FileWatcher * WatcherFactory::createSharedWatcher()
+{
+	FileWatcher * result = createSharedWatcherImpl();
+	if (result != NULL)
+	{
+		createdWatchers += result;
+	}
+	return result;
+}
+
+FileWatcher * WatcherFactory::createSharedWatcherImpl()
+{
+	return NULL;
+}
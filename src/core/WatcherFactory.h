@@ -25,15 +25,30 @@ public:
 	virtual ~WatcherFactory();
 	FileWatcher * createWatcher();
 
+	/**
+	 * Creates a watcher that doesn't get a thread of its own.  Its notifications are
+	 * processed by a small pool of threads owned by the factory and shared by every watcher
+	 * created this way (@see FileWatcher::setSharedLoop).  The watcher is live as soon as
+	 * it's created - it must not be start()ed - until stopPolling() is called.
+	 *
+	 * @return The watcher, or NULL if the implementation can't share threads.
+	 */
+	FileWatcher * createSharedWatcher();
+
 protected:
 	virtual FileWatcher * createWatcherImpl() = 0;
 
+	/**
+	 * @return NULL unless overridden.
+	 */
+	virtual FileWatcher * createSharedWatcherImpl();
+
 private:
 	static WatcherFactory * instance;
 
 	QList<QPointer<FileWatcher> > createdWatchers;
 };
 
-Q_DECLARE_INTERFACE(WatcherFactory, "com.streamunrar.interfaces.WatcherFactory/1.0.0");
+Q_DECLARE_INTERFACE(WatcherFactory, "com.streamunrar.interfaces.WatcherFactory/1.1.0");
 
 #endif /* WATCHER_FACTORY_H_ */
@@ -0,0 +1,53 @@
+//
+// C++ Implementation: WatcherStats
+//
+// Description: 
+//
+//
+// Author: Vitali Lovich <vlovich@gmail.com>, (C) 2008
+//
+// Copyright: See COPYING file that comes with this distribution
+//
+//
+#include "WatcherStats.h"
+
+WatcherStats::WatcherStats()
+	: created(0), deleted(0), modified(0), moved(0), movedSelf(0), existing(0), batches(0),
+	reads(0), bytesRead(0), largestRead(0), watchesAdded(0), watchesRemoved(0), activeWatches(0),
+	overflows(0), unpairedMoves(0), pollErrors(0), queuedBatches(0), queuedEvents(0), queuedBytes(0),
+	peakQueuedEvents(0), peakQueuedBytes(0), coalescedEvents(0), droppedEvents(0), blockedNanos(0), refusedBlocks(0), resyncs(0),
+	readNanos(0), parseNanos(0), deliverNanos(0)
+{
+}
+
+WatcherStats WatcherCounters::snapshot(quint64 queuedBatches) const
+{
+	WatcherStats result;
+	result.created = created.load();
+	result.deleted = deleted.load();
+	result.modified = modified.load();
+	result.moved = moved.load();
+	result.movedSelf = movedSelf.load();
+	result.existing = existing.load();
+	result.batches = batches.load();
+	result.reads = reads.load();
+	result.bytesRead = bytesRead.load();
+	result.largestRead = largestRead.load();
+	result.watchesAdded = watchesAdded.load();
+	result.watchesRemoved = watchesRemoved.load();
+	// removals can be counted before the matching addition is visible
+	result.activeWatches = result.watchesAdded > result.watchesRemoved ? result.watchesAdded - result.watchesRemoved : 0;
+	result.overflows = overflows.load();
+	result.unpairedMoves = unpairedMoves.load();
+	result.pollErrors = pollErrors.load();
+	result.queuedBatches = queuedBatches;
+	result.coalescedEvents = coalescedEvents.load();
+	result.droppedEvents = droppedEvents.load();
+	result.blockedNanos = blockedNanos.load();
+	result.refusedBlocks = refusedBlocks.load();
+	result.resyncs = resyncs.load();
+	result.readNanos = readNanos.load();
+	result.parseNanos = parseNanos.load();
+	result.deliverNanos = deliverNanos.load();
+	return result;
+}
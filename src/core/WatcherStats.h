@@ -0,0 +1,242 @@
+#ifndef WATCHER_STATS_H_
+#define WATCHER_STATS_H_
+//
+// C++ Interface: WatcherStats
+//
+// Description: 
+//
+//
+// Author: Vitali Lovich <vlovich@gmail.com>, (C) 2008
+//
+// Copyright: See COPYING file that comes with this distribution
+//
+//
+#include <QtGlobal>
+#include <QMetaType>
+
+#ifdef WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif /* WIN32 */
+
+/**
+ * @return A monotonic timestamp in nanoseconds, for measuring intervals.
+ */
+inline quint64 monotonicNanos()
+{
+#ifdef WIN32
+	LARGE_INTEGER frequency;
+	LARGE_INTEGER now;
+	QueryPerformanceFrequency(&frequency);
+	QueryPerformanceCounter(&now);
+	return (quint64)(now.QuadPart / (double)frequency.QuadPart * 1e9);
+#else
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (quint64)now.tv_sec * Q_UINT64_C(1000000000) + now.tv_nsec;
+#endif /* WIN32 */
+}
+
+/**
+ * A 64-bit counter that is cheap enough to update on every event.  Updates are relaxed
+ * atomics - they never tear, but there is no ordering between different counters.
+ */
+class StatCounter
+{
+public:
+	StatCounter() : value(0) {}
+
+	inline void add(quint64 amount = 1)
+	{
+#if defined(__GNUC__)
+		__atomic_fetch_add(&value, amount, __ATOMIC_RELAXED);
+#elif defined(WIN32)
+		InterlockedExchangeAdd64((volatile LONGLONG *)&value, (LONGLONG)amount);
+#else
+		value += amount;
+#endif
+	}
+
+	inline void set(quint64 amount)
+	{
+#if defined(__GNUC__)
+		__atomic_store_n(&value, amount, __ATOMIC_RELAXED);
+#else
+		value = amount;
+#endif
+	}
+
+	/**
+	 * Raises the value to amount if it's lower.  Safe with any number of threads updating
+	 * it at once - the largest of them always wins.
+	 */
+	inline void setMax(quint64 amount)
+	{
+		quint64 current = load();
+		while (amount > current)
+		{
+#if defined(__GNUC__)
+			if (__atomic_compare_exchange_n(&value, &current, amount, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+			{
+				return;
+			}
+#elif defined(WIN32)
+			quint64 seen = (quint64)InterlockedCompareExchange64((volatile LONGLONG *)&value, (LONGLONG)amount, (LONGLONG)current);
+			if (seen == current)
+			{
+				return;
+			}
+			current = seen;
+#else
+			value = amount;
+			return;
+#endif
+		}
+	}
+
+	inline quint64 load() const
+	{
+#if defined(__GNUC__)
+		return __atomic_load_n(&value, __ATOMIC_RELAXED);
+#else
+		return value;
+#endif
+	}
+
+private:
+	volatile quint64 value;
+
+	StatCounter(const StatCounter &);
+	StatCounter & operator=(const StatCounter &);
+};
+
+/**
+ * A snapshot of what a watcher has been doing since it was created.  Gauges reflect the
+ * moment the snapshot was taken, everything else is cumulative.
+ *
+ * @see FileWatcher::stats
+ */
+struct WatcherStats
+{
+	WatcherStats();
+
+	/**
+	 * Events delivered, by FileEvent::Type.
+	 */
+	quint64 created;
+	quint64 deleted;
+	quint64 modified;
+	quint64 moved;
+	quint64 movedSelf;
+	quint64 existing;
+
+	/**
+	 * Number of batches published.
+	 */
+	quint64 batches;
+
+	/**
+	 * Number of reads from the native notification queue, the total bytes they returned
+	 * and the largest single read.
+	 */
+	quint64 reads;
+	quint64 bytesRead;
+	quint64 largestRead;
+
+	quint64 watchesAdded;
+	quint64 watchesRemoved;
+
+	/**
+	 * Gauge: watches currently held.
+	 */
+	quint64 activeWatches;
+
+	/**
+	 * Number of times the kernel queue overflowed and events were lost.
+	 */
+	quint64 overflows;
+
+	/**
+	 * Gauge: half of a move waiting for its other half (@see LinuxWatcher::cookieMap).
+	 */
+	quint64 unpairedMoves;
+
+	/**
+	 * Number of failures to wait for or read notifications.
+	 */
+	quint64 pollErrors;
+
+	/**
+	 * Gauge: batches waiting to be pulled (@see FileWatcher::nextBatch).
+	 */
+	quint64 queuedBatches;
+
+	/**
+	 * Gauges: the events in those batches & the memory they take, and the most there have
+	 * ever been (@see FileWatcher::setQueueLimits).
+	 */
+	quint64 queuedEvents;
+	quint64 queuedBytes;
+	quint64 peakQueuedEvents;
+	quint64 peakQueuedBytes;
+
+	/**
+	 * What keeping the queue within its limits took: events merged away, events dropped,
+	 * nanoseconds the poll thread waited for room, batches that coalesced rather than wait
+	 * because nothing may wait in an external loop, and runs of drops (@see
+	 * FileWatcher::resyncNeeded).
+	 */
+	quint64 coalescedEvents;
+	quint64 droppedEvents;
+	quint64 blockedNanos;
+	quint64 refusedBlocks;
+	quint64 resyncs;
+
+	/**
+	 * Time spent, in nanoseconds, reading from the kernel, turning what was read into
+	 * events and delivering those events to listeners and subscribers.
+	 */
+	quint64 readNanos;
+	quint64 parseNanos;
+	quint64 deliverNanos;
+};
+
+Q_DECLARE_METATYPE(WatcherStats)
+
+/**
+ * The live counters behind WatcherStats.  Updated by the implementation as it goes.
+ */
+struct WatcherCounters
+{
+	StatCounter created;
+	StatCounter deleted;
+	StatCounter modified;
+	StatCounter moved;
+	StatCounter movedSelf;
+	StatCounter existing;
+	StatCounter batches;
+	StatCounter reads;
+	StatCounter bytesRead;
+	StatCounter largestRead;
+	StatCounter watchesAdded;
+	StatCounter watchesRemoved;
+	StatCounter overflows;
+	StatCounter unpairedMoves;
+	StatCounter pollErrors;
+	StatCounter coalescedEvents;
+	StatCounter droppedEvents;
+	StatCounter blockedNanos;
+	StatCounter refusedBlocks;
+	StatCounter resyncs;
+	StatCounter readNanos;
+	StatCounter parseNanos;
+	StatCounter deliverNanos;
+
+	/**
+	 * @param queuedBatches The current value of the gauge that isn't kept here.
+	 */
+	WatcherStats snapshot(quint64 queuedBatches) const;
+};
+
+#endif /* WATCHER_STATS_H_ */
@@ -5,7 +5,32 @@ CONFIG += dll
 include(../global.pri)
 
 SOURCES += FileWatcher.cpp \
+ EventBatch.cpp \
+ BatchQueue.cpp \
+ SubscriptionIndex.cpp \
+ WatcherStats.cpp \
+ LatencyHistogram.cpp \
+ HotDirectories.cpp \
+ DeliveryController.cpp \
+ PartitionedExecutor.cpp \
+ Trace.cpp \
+ Recording.cpp \
  WatcherFactory.cpp
 
 HEADERS += FileWatcher.h \
+ FileEvent.h \
+ WatchSpec.h \
+ FileEventListener.h \
+ PartitionedExecutor.h \
+ EventBatch.h \
+ BatchQueue.h \
+ AsyncWatcher.h \
+ EventSink.h \
+ SubscriptionIndex.h \
+ WatcherStats.h \
+ LatencyHistogram.h \
+ HotDirectories.h \
+ DeliveryController.h \
+ Trace.h \
+ Recording.h \
  WatcherFactory.h
@@ -1,5 +1,8 @@
 DEBUG_ON = yes
 
+# the flight recorder (see core/Trace.h) - cheap enough to leave on in release builds
+TRACE_ON = yes
+
 contains(DEBUG_ON, yes) {
 	CONFIG += debug
 	CONFIG -= release
@@ -22,6 +25,10 @@ release {
 	DEFINES -= NDEBUG
 }
 
+contains(TRACE_ON, yes) {
+	DEFINES += FNOTIFY_TRACE
+}
+
 DESTDIR = $$BASE/../bin
 OBJECTS_DIR = $$BASE/../obj/$$PROJECT/
 MOC_DIR = $$OBJECTS_DIR
@@ -0,0 +1,224 @@
+//
+// C++ Implementation: CrawlEngine
+//
+// Description: 
+//
+//
+// Author: Vitali Lovich <vlovich@gmail.com>, (C) 2008
+//
+// Copyright: See COPYING file that comes with this distribution
+//
+//
+#include "CrawlEngine.h"
+#include "InventoryStock.h"
+
+#include <QFile>
+#include <QMutexLocker>
+#include <QRunnable>
+
+#include <sys/eventfd.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdint.h>
+
+/**
+ * Lists one submitted directory.
+ */
+class ListingJob : public QRunnable
+{
+public:
+	ListingJob(CrawlEngine * engine, int crawl, const QString & path, const QByteArray & nativePath, bool followLinks, InventoryStock * stock)
+		: engine(engine), followLinks(followLinks), stock(stock)
+	{
+		listing.crawl = crawl;
+		listing.path = path;
+		listing.nativePath = nativePath;
+		listing.directory = false;
+		listing.device = 0;
+		listing.inode = 0;
+	}
+
+	void run()
+	{
+		struct stat info;
+		int result = followLinks ? stat(listing.nativePath.constData(), &info) : lstat(listing.nativePath.constData(), &info);
+		if (result == 0 && S_ISDIR(info.st_mode))
+		{
+			listing.directory = true;
+			listing.device = info.st_dev;
+			listing.inode = info.st_ino;
+
+			QList<QByteArray> children;
+			if (stock != NULL)
+			{
+				QList<QByteArray> others;
+				quint64 at = stock->listing();
+				CrawlEngine::listDirectories(listing.nativePath, followLinks, children, &others);
+				stock->add(at, children + others);
+			}
+			else
+			{
+				CrawlEngine::listDirectories(listing.nativePath, followLinks, children);
+			}
+			foreach(const QByteArray & child, children)
+			{
+				// links have been dealt with - this only needs the device & inode
+				struct stat childInfo;
+				if (stat(child.constData(), &childInfo) != 0)
+				{
+					continue;
+				}
+				CrawlEngine::Entry entry;
+				entry.path = QFile::decodeName(child);
+				entry.nativePath = child;
+				entry.device = childInfo.st_dev;
+				entry.inode = childInfo.st_ino;
+				listing.children += entry;
+			}
+		}
+		engine->complete(listing);
+	}
+
+private:
+	CrawlEngine * engine;
+	bool followLinks;
+	InventoryStock * stock;
+	CrawlEngine::Listing listing;
+};
+
+CrawlEngine::CrawlEngine(QThreadPool * sharedPool) : eventHandle(eventfd(0, EFD_NONBLOCK)), inProgress(0), pool(sharedPool)
+{
+	if (pool == NULL)
+	{
+		ownPool.setMaxThreadCount(CRAWL_THREADS);
+		pool = &ownPool;
+	}
+}
+
+CrawlEngine::~CrawlEngine()
+{
+	// not the pool's other work, if it's shared
+	drain();
+	if (eventHandle != -1)
+	{
+		close(eventHandle);
+	}
+}
+
+void CrawlEngine::drain()
+{
+	QMutexLocker locker(&completedLock);
+	while (inProgress > 0)
+	{
+		drained.wait(&completedLock);
+	}
+}
+
+bool CrawlEngine::isValid() const
+{
+	return eventHandle != -1;
+}
+
+void CrawlEngine::submit(int crawl, const QString & path, const QByteArray & nativePath, bool followLinks, InventoryStock * stock)
+{
+	Q_ASSERT(isValid());
+	{
+		QMutexLocker locker(&completedLock);
+		++inProgress;
+	}
+	pool->start(new ListingJob(this, crawl, path, nativePath, followLinks, stock));
+}
+
+QList<CrawlEngine::Listing> CrawlEngine::takeCompleted()
+{
+	uint64_t count;
+	if (read(eventHandle, &count, sizeof(count)) != sizeof(count))
+	{
+		// nothing has completed since the last call
+		return QList<Listing>();
+	}
+
+	QMutexLocker locker(&completedLock);
+	QList<Listing> result = completed;
+	completed.clear();
+	return result;
+}
+
+int CrawlEngine::readyHandle() const
+{
+	return eventHandle;
+}
+
+void CrawlEngine::complete(const Listing & listing)
+{
+	{
+		QMutexLocker locker(&completedLock);
+		completed += listing;
+	}
+	wake();
+
+	// the engine may go as soon as this is let go
+	QMutexLocker locker(&completedLock);
+	if (--inProgress == 0)
+	{
+		drained.wakeAll();
+	}
+}
+
+void CrawlEngine::wake()
+{
+	if (eventHandle == -1)
+	{
+		return;
+	}
+	uint64_t one = 1;
+	ssize_t written = write(eventHandle, &one, sizeof(one));
+	Q_ASSERT(written == sizeof(one));
+	Q_UNUSED(written);
+}
+
+void CrawlEngine::listDirectories(const QByteArray & nativePath, bool followLinks, QList<QByteArray> & children, QList<QByteArray> * others)
+{
+	// read the names as they are on disk - going through QDir would decode them, and
+	// names that aren't valid in the local encoding wouldn't survive the round trip
+	DIR * dir = opendir(nativePath.constData());
+	if (dir == NULL)
+	{
+		return;
+	}
+	struct dirent * entry;
+	while ((entry = readdir(dir)) != NULL)
+	{
+		if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+		{
+			continue;
+		}
+		QByteArray childPath = nativePath;
+		if (!childPath.endsWith('/'))
+		{
+			childPath += '/';
+		}
+		childPath += entry->d_name;
+
+		bool isDir = entry->d_type == DT_DIR;
+		if (entry->d_type == DT_UNKNOWN || (entry->d_type == DT_LNK && followLinks))
+		{
+			// links to directories are followed unless asked not to, same as QDir::Dirs.
+			// lstat doesn't follow them, so they don't come out as directories.
+			struct stat childInfo;
+			int result = followLinks ? stat(childPath.constData(), &childInfo) : lstat(childPath.constData(), &childInfo);
+			isDir = result == 0 && S_ISDIR(childInfo.st_mode);
+		}
+		if (isDir)
+		{
+			children += childPath;
+		}
+		else if (others != NULL)
+		{
+			*others += childPath;
+		}
+	}
+	closedir(dir);
+}
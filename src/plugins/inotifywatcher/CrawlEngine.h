@@ -0,0 +1,158 @@
+#ifndef CRAWL_ENGINE_H_
+#define CRAWL_ENGINE_H_
+//
+// C++ Interface: CrawlEngine
+//
+// Description: 
+//
+//
+// Author: Vitali Lovich <vlovich@gmail.com>, (C) 2008
+//
+// Copyright: See COPYING file that comes with this distribution
+//
+//
+#include <QString>
+#include <QByteArray>
+#include <QList>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QThreadPool>
+
+class InventoryStock;
+
+/**
+ * The number of threads listing directories for a watcher with a poll thread of its own,
+ * and for all the shared watchers of a factory together.
+ */
+#ifndef CRAWL_THREADS
+#define CRAWL_THREADS 2
+#endif /* CRAWL_THREADS */
+
+/**
+ * Lists directories off the poll thread, for the directories that appear under recursive
+ * watches.  The poll thread submits a directory, a worker lists it & stats the directories
+ * in it, and the listing waits in the engine until the poll thread takes it - readyHandle()
+ * becomes readable when there is one.  The engine never touches the watcher, so all of the
+ * watcher's state stays on the poll thread.
+ *
+ * When the watcher reports its inventory, a listing also hands everything in the directory
+ * to the watcher's stock.
+ *
+ * The work is done by a thread pool of its own, or by one shared with other engines.  io_uring
+ * would be the other obvious backend, but it can't read directories, and listing is most of
+ * the work.
+ */
+class CrawlEngine
+{
+public:
+	/**
+	 * A directory found in a listing.
+	 */
+	struct Entry
+	{
+		QString path;
+		QByteArray nativePath;
+		quint64 device;
+		quint64 inode;
+	};
+
+	/**
+	 * The result of a submitted directory.
+	 */
+	struct Listing
+	{
+		/**
+		 * As submitted.
+		 */
+		int crawl;
+		QString path;
+		QByteArray nativePath;
+
+		/**
+		 * Whether the path turned out to be a directory.  Nothing else is filled in otherwise.
+		 */
+		bool directory;
+		quint64 device;
+		quint64 inode;
+
+		QList<Entry> children;
+	};
+
+	/**
+	 * @param sharedPool The pool to list directories on, which must outlive anything
+	 * submitted.  One of the engine's own if NULL.
+	 */
+	CrawlEngine(QThreadPool * sharedPool = NULL);
+
+	/**
+	 * Waits for the listings in progress, which are then thrown away.
+	 */
+	~CrawlEngine();
+
+	/**
+	 * Waits for the listings in progress.  Nothing may be submitted meanwhile.  Whatever
+	 * they were given to submit() is safe to destroy afterwards.
+	 */
+	void drain();
+
+	/**
+	 * @return Whether the engine can be used.  If not, directories have to be listed inline.
+	 */
+	bool isValid() const;
+
+	/**
+	 * Lists a directory in the background.
+	 *
+	 * @param crawl Returned with the listing, for the caller to know what it was for.
+	 * @param path The path the caller knows the directory by.  Children are named after it.
+	 * @param followLinks Whether links to directories are listed as directories, and whether
+	 * the path itself may be one.
+	 * @param stock If not NULL, receives everything in the directory.
+	 */
+	void submit(int crawl, const QString & path, const QByteArray & nativePath, bool followLinks, InventoryStock * stock = NULL);
+
+	/**
+	 * @return Every listing completed since the last call, without blocking.
+	 */
+	QList<Listing> takeCompleted();
+
+	/**
+	 * @return A descriptor that is readable while completed listings are waiting, or -1.
+	 */
+	int readyHandle() const;
+
+	/**
+	 * Makes readyHandle() readable without a listing, for the watcher to wake its poll
+	 * thread up with.
+	 */
+	void wake();
+
+	/**
+	 * Lists the directories in a directory, as raw paths.
+	 *
+	 * @param followLinks Whether links to directories count.
+	 * @param others If not NULL, receives everything else in the directory.
+	 */
+	static void listDirectories(const QByteArray & nativePath, bool followLinks, QList<QByteArray> & children, QList<QByteArray> * others = NULL);
+
+private:
+	friend class ListingJob;
+
+	void complete(const Listing & listing);
+
+	int eventHandle;
+
+	QMutex completedLock;
+	QList<Listing> completed;
+
+	/**
+	 * The listings submitted but not completed yet.  Guarded by completedLock.
+	 */
+	int inProgress;
+	QWaitCondition drained;
+
+	QThreadPool ownPool;
+	QThreadPool * pool;
+};
+
+#endif /* CRAWL_ENGINE_H_ */
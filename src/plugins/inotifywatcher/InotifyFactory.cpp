@@ -12,12 +12,62 @@
 #include "InotifyFactory.h"
 
 #include <QtPlugin>
+#include <QMutexLocker>
 
 #include "LinuxWatcher.h"
+#include "InotifyReactor.h"
+
+/**
+ * The number of threads serving every watcher created with createSharedWatcher().
+ */
+#ifndef SHARED_POLL_THREADS
+#define SHARED_POLL_THREADS 2
+#endif /* SHARED_POLL_THREADS */
+
+InotifyFactory::InotifyFactory()
+{
+	crawlPool.setMaxThreadCount(CRAWL_THREADS);
+}
+
+InotifyFactory::~InotifyFactory()
+{
+	qDeleteAll(reactors);
+}
 
 FileWatcher * InotifyFactory::createWatcherImpl()
 {
 	return new LinuxWatcher();
 }
 
+FileWatcher * InotifyFactory::createSharedWatcherImpl()
+{
+	QMutexLocker locker(&reactorsLock);
+	if (reactors.isEmpty())
+	{
+		for (int i = 0; i < SHARED_POLL_THREADS; ++i)
+		{
+			InotifyReactor * reactor = new InotifyReactor();
+			reactor->startReactor();
+			reactors += reactor;
+		}
+	}
+
+	InotifyReactor * quietest = reactors.first();
+	foreach(InotifyReactor * reactor, reactors)
+	{
+		if (reactor->size() < quietest->size())
+		{
+			quietest = reactor;
+		}
+	}
+
+	LinuxWatcher * watcher = new LinuxWatcher(&crawlPool);
+	if (!watcher->setReactor(quietest))
+	{
+		delete watcher;
+		return NULL;
+	}
+	return watcher;
+}
+
 Q_EXPORT_PLUGIN2(inotifywatcher, InotifyFactory);
@@ -12,15 +12,45 @@
 //
 //
 #include <QObject>
+#include <QMutex>
+#include <QList>
+#include <QThreadPool>
 #include <core/WatcherFactory.h>
 
+class InotifyReactor;
+
 class InotifyFactory : public QObject, public WatcherFactory
 {
 	Q_OBJECT
 	Q_INTERFACES(WatcherFactory);
 
+public:
+	InotifyFactory();
+
+	/**
+	 * Stops the shared reactors, and with them every shared watcher.
+	 */
+	~InotifyFactory();
+
 protected:
 	FileWatcher * createWatcherImpl();
+
+	/**
+	 * Spreads the watchers over SHARED_POLL_THREADS reactors, started on first use.
+	 *
+	 * @see WatcherFactory::createSharedWatcher
+	 */
+	FileWatcher * createSharedWatcherImpl();
+
+private:
+	QMutex reactorsLock;
+	QList<InotifyReactor *> reactors;
+
+	/**
+	 * Lists new directories for every shared watcher, so that they don't need threads of
+	 * their own for it.  Goes after the reactors, once no shared watcher can use it.
+	 */
+	QThreadPool crawlPool;
 };
 
 #endif /* INOTIFY_FACTORY_H_ */
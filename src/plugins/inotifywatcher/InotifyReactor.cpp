@@ -0,0 +1,168 @@
+//
+// C++ Implementation: InotifyReactor
+//
+// Description:
+//
+//
+// Author: Vitali Lovich <vlovich@gmail.com>, (C) 2008
+//
+// Copyright: See COPYING file that comes with this distribution
+//
+//
+#include "InotifyReactor.h"
+
+#include <QMutexLocker>
+#include <QList>
+
+#include <core/Trace.h>
+
+#include "LinuxWatcher.h"
+
+#include <sys/epoll.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+
+/**
+ * How long, in milliseconds, the reactor waits for notifications before checking whether
+ * it has been asked to stop.
+ */
+#ifndef REACTOR_POLL_INTERVAL
+#define REACTOR_POLL_INTERVAL 500
+#endif /* REACTOR_POLL_INTERVAL */
+
+/**
+ * The most handles reported ready by a single wait.  More just take another wait.
+ */
+#define MAX_READY_HANDLES 64
+
+InotifyReactor::InotifyReactor() : epollHandle(epoll_create(MAX_READY_HANDLES)), running(false), lock(QMutex::Recursive)
+{
+	if (epollHandle == -1)
+	{
+		throw QString(strerror(errno));
+	}
+}
+
+InotifyReactor::~InotifyReactor()
+{
+	stop();
+	wait();
+
+	QList<LinuxWatcher *> remaining;
+	{
+		QMutexLocker locker(&lock);
+		remaining = watchers.values();
+	}
+	// stopping a watcher detaches it
+	foreach(LinuxWatcher * watcher, remaining)
+	{
+		watcher->stopPolling();
+	}
+	Q_ASSERT(watchers.isEmpty());
+
+	close(epollHandle);
+}
+
+bool InotifyReactor::attach(LinuxWatcher * watcher)
+{
+	Q_ASSERT(watcher->isSharedLoop());
+	int handle = watcher->readinessHandle();
+	if (handle == -1)
+	{
+		return false;
+	}
+
+	QMutexLocker locker(&lock);
+	if (!watch(handle, watcher))
+	{
+		return false;
+	}
+	// finished listings of new directories are dispatched the same way
+	int crawlHandle = watcher->crawlHandle();
+	if (crawlHandle != -1 && !watch(crawlHandle, watcher))
+	{
+		unwatch(handle);
+		return false;
+	}
+	return true;
+}
+
+bool InotifyReactor::watch(int handle, LinuxWatcher * watcher)
+{
+	Q_ASSERT(!watchers.contains(handle));
+
+	struct epoll_event interest;
+	interest.events = EPOLLIN;
+	interest.data.u64 = 0;
+	interest.data.fd = handle;
+	if (-1 == epoll_ctl(epollHandle, EPOLL_CTL_ADD, handle, &interest))
+	{
+		return false;
+	}
+	watchers.insert(handle, watcher);
+	return true;
+}
+
+void InotifyReactor::unwatch(int handle)
+{
+	watchers.remove(handle);
+	epoll_ctl(epollHandle, EPOLL_CTL_DEL, handle, NULL);
+}
+
+void InotifyReactor::detach(LinuxWatcher * watcher)
+{
+	QMutexLocker locker(&lock);
+	// the inotify handle & the crawl handle
+	foreach(int handle, watchers.keys(watcher))
+	{
+		unwatch(handle);
+	}
+}
+
+int InotifyReactor::size() const
+{
+	QMutexLocker locker(&lock);
+	return watchers.size();
+}
+
+void InotifyReactor::startReactor()
+{
+	running = true;
+	start();
+}
+
+void InotifyReactor::stop()
+{
+	running = false;
+}
+
+void InotifyReactor::run()
+{
+	struct epoll_event ready[MAX_READY_HANDLES];
+	while (running)
+	{
+		int count = epoll_wait(epollHandle, ready, MAX_READY_HANDLES, REACTOR_POLL_INTERVAL);
+		if (count == -1)
+		{
+			if (errno != EINTR)
+			{
+				// not tied to any one watcher, and each of them is still fine - keep going
+				FNOTIFY_TRACE_EVENT(PollError, -1, 0, errno);
+				msleep(REACTOR_POLL_INTERVAL);
+			}
+			continue;
+		}
+
+		QMutexLocker locker(&lock);
+		for (int i = 0; i < count; ++i)
+		{
+			// the watcher may have been detached since the wait returned
+			LinuxWatcher * watcher = watchers.value(ready[i].data.fd);
+			if (watcher != NULL)
+			{
+				watcher->processReady();
+			}
+		}
+	}
+}
@@ -0,0 +1,95 @@
+#ifndef INOTIFY_REACTOR_H_
+#define INOTIFY_REACTOR_H_
+//
+// C++ Interface: InotifyReactor
+//
+// Description:
+//
+//
+// Author: Vitali Lovich <vlovich@gmail.com>, (C) 2008
+//
+// Copyright: See COPYING file that comes with this distribution
+//
+//
+#include <QThread>
+#include <QMutex>
+#include <QHash>
+
+class LinuxWatcher;
+
+/**
+ * A poll thread shared by many watchers.  It waits on all of their inotify (and crawl) handles
+ * at once with epoll and runs LinuxWatcher::processReady() for whichever become readable,
+ * so that hundreds of watchers don't need hundreds of threads.  Each watcher keeps its
+ * own state - the reactor only knows which handle belongs to which watcher.
+ *
+ * @see InotifyFactory::createSharedWatcherImpl
+ */
+class InotifyReactor : public QThread
+{
+public:
+	InotifyReactor();
+
+	/**
+	 * Stops the thread and then every watcher still attached.
+	 */
+	~InotifyReactor();
+
+	/**
+	 * Starts dispatching the watcher's notifications.  The watcher must already be in shared
+	 * loop mode.  Use LinuxWatcher::setReactor rather than calling this directly.
+	 *
+	 * @return Whether the watcher's handle could be added.
+	 */
+	bool attach(LinuxWatcher * watcher);
+
+	/**
+	 * Stops dispatching the watcher's notifications.  Once this returns, processReady() is
+	 * not running for the watcher and won't be called again.  Can be called from a
+	 * processReady() call.
+	 */
+	void detach(LinuxWatcher * watcher);
+
+	/**
+	 * @return The number of watchers attached.
+	 */
+	int size() const;
+
+	/**
+	 * Starts the thread.  Use this rather than start(), so that a stop() that comes before
+	 * the thread gets to run isn't lost.
+	 */
+	void startReactor();
+
+	/**
+	 * Asks the thread to exit.  It exits at most REACTOR_POLL_INTERVAL ms later.
+	 */
+	void stop();
+
+protected:
+	void run();
+
+private:
+	int epollHandle;
+
+	volatile bool running;
+
+	/**
+	 * Held while dispatching & while the set of watchers changes, so that detach() can
+	 * wait out a dispatch.  Recursive because watchers may be detached from within one.
+	 */
+	mutable QMutex lock;
+
+	/**
+	 * Maps the inotify & crawl handles to their watcher.
+	 */
+	QHash<int, LinuxWatcher *> watchers;
+
+	/**
+	 * Start & stop waiting on a handle.  The lock must be held.
+	 */
+	bool watch(int handle, LinuxWatcher * watcher);
+	void unwatch(int handle);
+};
+
+#endif /* INOTIFY_REACTOR_H_ */
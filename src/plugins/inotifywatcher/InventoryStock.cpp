@@ -0,0 +1,59 @@
+//
+// C++ Implementation: InventoryStock
+//
+// Description: 
+//
+//
+// Author: Vitali Lovich <vlovich@gmail.com>, (C) 2008
+//
+// Copyright: See COPYING file that comes with this distribution
+//
+//
+#include "InventoryStock.h"
+
+#include <QMutexLocker>
+
+InventoryStock::InventoryStock() : reads(0), inProgress(0)
+{
+}
+
+quint64 InventoryStock::listing()
+{
+	QMutexLocker locker(&lock);
+	++inProgress;
+	return reads;
+}
+
+void InventoryStock::add(quint64 at, const QList<QByteArray> & paths)
+{
+	QMutexLocker locker(&lock);
+	Q_ASSERT(inProgress > 0);
+	--inProgress;
+	if (!paths.isEmpty())
+	{
+		Listed listed;
+		listed.at = at;
+		listed.paths = paths;
+		stocked += listed;
+	}
+}
+
+QList<InventoryStock::Listed> InventoryStock::take()
+{
+	QMutexLocker locker(&lock);
+	QList<Listed> result = stocked;
+	stocked.clear();
+	return result;
+}
+
+quint64 InventoryStock::read()
+{
+	QMutexLocker locker(&lock);
+	return ++reads;
+}
+
+bool InventoryStock::listingInProgress() const
+{
+	QMutexLocker locker(&lock);
+	return inProgress > 0;
+}
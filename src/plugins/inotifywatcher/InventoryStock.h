@@ -0,0 +1,85 @@
+#ifndef INVENTORY_STOCK_H_
+#define INVENTORY_STOCK_H_
+//
+// C++ Interface: InventoryStock
+//
+// Description: 
+//
+//
+// Author: Vitali Lovich <vlovich@gmail.com>, (C) 2008
+//
+// Copyright: See COPYING file that comes with this distribution
+//
+//
+#include <QByteArray>
+#include <QList>
+#include <QMutex>
+
+/**
+ * What crawls have found for the inventory, until the poll thread reports it.
+ *
+ * Directories are listed without holding anything up: a listing only notes how many reads
+ * the poll thread has done from inotify before it starts, and hands what it found over
+ * once it's done.  If the poll thread has read since, the events it read may have raced
+ * the listing - it has to leave out what they say is gone.  Otherwise the listing was
+ * complete before anything it hasn't read yet, and is reported ahead of it.
+ *
+ * The lock is only ever held briefly, and never while anything is delivered or emitted.
+ */
+class InventoryStock
+{
+public:
+	/**
+	 * What one listing found.
+	 */
+	struct Listed
+	{
+		/**
+		 * The reads done before the listing started.
+		 */
+		quint64 at;
+		QList<QByteArray> paths;
+	};
+
+	InventoryStock();
+
+	/**
+	 * Called before a directory is listed.  Every call has to be followed by add().
+	 *
+	 * @return What the listing is added with.
+	 */
+	quint64 listing();
+
+	/**
+	 * What a listing found, even if nothing.
+	 *
+	 * @param at As returned by listing().
+	 */
+	void add(quint64 at, const QList<QByteArray> & paths);
+
+	/**
+	 * @return Every listing added since the last call.  Poll thread only.
+	 */
+	QList<Listed> take();
+
+	/**
+	 * Called by the poll thread as soon as it has read from inotify.
+	 *
+	 * @return The reads done, this one included - what the events read are numbered with.
+	 */
+	quint64 read();
+
+	/**
+	 * @return Whether any listing is in progress, in which case whatever vanishes has to be
+	 * remembered for it.
+	 */
+	bool listingInProgress() const;
+
+private:
+	mutable QMutex lock;
+	quint64 reads;
+	int inProgress;
+	QList<Listed> stocked;
+};
+
+#endif /* INVENTORY_STOCK_H_ */
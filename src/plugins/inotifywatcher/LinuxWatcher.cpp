@@ -15,10 +15,23 @@
 #include <QDir>
 #include <QMutexLocker>
 #include <QCoreApplication>
+#include <QVarLengthArray>
+#include <QThreadPool>
+#include <QRunnable>
+#include <QSemaphore>
 #include <QtDebug>
 
+#include <core/Trace.h>
+
+#include "InotifyReactor.h"
+
 #include <sys/inotify.h>
 #include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <string.h>
 #include <errno.h>
 
@@ -34,6 +47,14 @@
 #define MAX_POLL_ERRORS 3
 #endif /* MAX_POLL_ERRORS */
 
+/**
+ * How long, in milliseconds, the poll thread waits for events before checking whether it
+ * has been asked to stop.
+ */
+#ifndef POLL_INTERVAL
+#define POLL_INTERVAL 500
+#endif /* POLL_INTERVAL */
+
 /**
  * Determines whether or not a given bit was set in a number.
  * @NOTE: This is not a safe macro - it assumes that the bit number is within the boundaries of the bis
@@ -43,19 +64,81 @@
 #define BIT_SET(number, bit) ( ( (number) & (bit) ) != 0 )
 
 /**
- * Returns the name of the file within the directory.
+ * What every watch asks inotify for.
+ */
+#define WATCH_MASK (IN_CREATE | IN_DELETE | IN_DELETE_SELF | IN_MOVED_FROM | IN_MOVED_TO | IN_MOVE_SELF | IN_MODIFY)
+
+/**
+ * @return The length of the name of the file within the directory, or 0 if the event is
+ * about the watched file or directory itself.
  */
-static QString getChildName(struct inotify_event * event)
+static int childNameLength(struct inotify_event * event)
 {
-	QString result = QString::fromUtf8(event->name);
+	int length = event->len == 0 ? 0 : qstrnlen(event->name, event->len);
 
 	// for some reason inotify sometimes gives us a path names that
 	// have an ASCII ETX at the end.
-	while (result.length() && result.endsWith(QChar(QLatin1Char(3))))
+	while (length > 0 && event->name[length - 1] == 3)
 	{
-		result = result.left(result.length() - 1);
+		--length;
 	}
-	return result;
+	return length;
+}
+
+/**
+ * Returns the name of the file within the directory, exactly as the kernel gave it to us.
+ */
+static QByteArray getChildName(struct inotify_event * event)
+{
+	return QByteArray(event->name, childNameLength(event));
+}
+
+/**
+ * Builds the path of the file an event is about in a single allocation, without decoding
+ * anything.
+ *
+ * @param basePath The absolute, native path of the watch the event came from.
+ */
+static QByteArray eventNativePath(const QByteArray & basePath, struct inotify_event * event)
+{
+	int length = childNameLength(event);
+	if (length == 0)
+	{
+		return basePath;
+	}
+
+	QByteArray path;
+	path.reserve(basePath.size() + 1 + length);
+	path += basePath;
+	if (!basePath.endsWith('/'))
+	{
+		path += '/';
+	}
+	path.append(event->name, length);
+	return path;
+}
+
+/**
+ * @return The absolute, clean path in the native encoding - what events are built from &
+ * what watches are indexed by, so that every spelling of a path finds the same watch.
+ */
+static QByteArray nativeWatchPath(const QString & path)
+{
+	return QFile::encodeName(QDir::cleanPath(QFileInfo(path).absoluteFilePath()));
+}
+
+/**
+ * Decodes a native path the first time it's needed.
+ *
+ * @param decoded Where the decoded path is cached - null until then.
+ */
+static const QString & decodedPath(QString & decoded, const QByteArray & nativePath)
+{
+	if (decoded.isNull())
+	{
+		decoded = QFile::decodeName(nativePath);
+	}
+	return decoded;
 }
 
 #ifdef _DEBUG
@@ -82,10 +165,8 @@ static QStringList eventsToString(struct inotify_event* event)
 		"parsing inotify event",
 		"mismatch between masks tested for and the corresponding event name");
 
-	qDebug() << "Parsing event";
-
 	QStringList result;
-	QString toAdd = "Inotify event (" + QString::number(event->mask) + ") for " + getChildName(event) + ": ";
+	QString toAdd = "Inotify event (" + QString::number(event->mask) + ") for " + QFile::decodeName(getChildName(event)) + ": ";
 
 	QString separator("");
 
@@ -103,7 +184,8 @@ static QStringList eventsToString(struct inotify_event* event)
 }
 #endif
 
-LinuxWatcher::LinuxWatcher() : inotifyHandle(INVALID_HANDLE), destroyed(false), running(false)
+LinuxWatcher::LinuxWatcher(QThreadPool * crawlPool)
+	: deletionsRead(0), changeGeneration(0), readSequence(0), crawler(crawlPool), nextCrawl(0), inotifyHandle(INVALID_HANDLE), destroyed(false), running(false), reactor(NULL), errorCnt(0), drainPosition(0)
 {
 	if (-1 == (inotifyHandle = inotify_init()))
 	{
@@ -136,6 +218,8 @@ LinuxWatcher::~LinuxWatcher()
 	}
 	Q_ASSERT(running == false);
 	Q_ASSERT(inotifyHandle == INVALID_HANDLE);
+	// listings in progress still use the stock & the crawler
+	crawler.drain();
 
 	qDebug() << "LinuxWatcher destructor";
 }
@@ -146,155 +230,382 @@ void LinuxWatcher::selfDestroyListener()
 	destroyed = true;
 
 	qDebug() << "We were destroyed so removing all of our watches";
-	foreach(QString watch, watches)
+	// however many times each one was added
+	QMutexLocker locker(internalLock(&lock));
+	deletedWatches.clear();
+	while (!pathWatches.isEmpty())
 	{
-		qDebug() << "Removing watch " << watch;
-		this->removeWatch(watch);
-	}	
+		dropTree(pathWatches.begin().key(), true);
+	}
 
 	qDebug() << "Finished tearing self down";
 }
 
 
-QString LinuxWatcher::getName(struct inotify_event * event)
+QByteArray LinuxWatcher::getName(struct inotify_event * event)
 {
 	return getChildName(event);
 }
 
 void LinuxWatcher::poll()
 {
-	static int errorCnt = 0;
-	static int timeSlept = 0;
-	static const size_t EVENT_SIZE = sizeof(struct inotify_event);
-	QByteArray buffer;
-
 	running = true;
 
 	while(errorCnt < MAX_POLL_ERRORS && running)
 	{
 		QCoreApplication::sendPostedEvents();
-		int bytesPending;
-		if (-1 == ioctl(inotifyHandle, FIONREAD, &bytesPending))
+		// wakes up in time for whatever adaptive batching is holding back
+		if (!waitForEvents(publishTimeout(POLL_INTERVAL)))
 		{
-			emit error("Trouble reading inotify info: " + QString(strerror(errno)));
-			++errorCnt;
+			{
+				// quiet - whatever was being deleted is gone by now
+				QMutexLocker locker(internalLock(&lock));
+				dropDeleted();
+			}
+			publishEvents();
 			continue;
 		}
-		if (bytesPending < 0 || (size_t)bytesPending < EVENT_SIZE)
+		applyListings();
+		EventBatch batch;
+		readEvents(batch);
+	}
+
+	// nothing is held back once polling stops
+	flushEvents();
+	stopPolling();
+}
+
+size_t LinuxWatcher::drain(FileEvent * out, size_t max, int timeout)
+{
+	Q_ASSERT_X(!running, "draining inotify events", "the poll thread owns the inotify handle while it is running");
+
+	if (drainPosition >= drained.size())
+	{
+		drained = EventBatch();
+		drainPosition = 0;
+
+		// a read may well publish nothing (events for watches already torn down, the first
+		// half of a move) - that's no reason to give up before the timeout has
+		quint64 deadline = timeout < 0 ? 0 : monotonicNanos() + (quint64)timeout * 1000000;
+		while (drained.isEmpty())
 		{
-			// No data to read, so let's not bother
-			if (++timeSlept < MAX_POLL_ERRORS && inotifyHandle != INVALID_HANDLE)
+			int remaining = -1;
+			if (timeout >= 0)
 			{
-				sleep(timeSlept);
+				quint64 now = monotonicNanos();
+				remaining = now >= deadline ? 0 : (int)((deadline - now + 999999) / 1000000);
 			}
-			else
+			if (inotifyHandle == INVALID_HANDLE || errorCnt >= MAX_POLL_ERRORS || !waitForEvents(remaining))
 			{
-				emit error("Unable to read inotify info properly");
-				running = false;
+				return 0;
 			}
-			continue;
+			applyListings();
+			readEvents(drained);
+			if (remaining == 0 && drained.isEmpty())
+			{
+				return 0;
+			}
+		}
+	}
+
+	size_t count = 0;
+	while (count < max && drainPosition < drained.size())
+	{
+		out[count++] = drained.at(drainPosition++);
+	}
+	return count;
+}
+
+bool LinuxWatcher::setExternalLoop(bool external)
+{
+	if (running || inotifyHandle == INVALID_HANDLE)
+	{
+		return false;
+	}
+
+	// the caller's loop must never block on us
+	int flags = fcntl(inotifyHandle, F_GETFL);
+	if (flags == -1 || -1 == fcntl(inotifyHandle, F_SETFL, external ? flags | O_NONBLOCK : flags & ~O_NONBLOCK))
+	{
+		emit error("Unable to change inotify blocking mode: " + QString(strerror(errno)));
+		return false;
+	}
+	return FileWatcher::setExternalLoop(external);
+}
+
+bool LinuxWatcher::setReactor(InotifyReactor * reactor)
+{
+	Q_ASSERT(reactor != NULL);
+	if (this->reactor != NULL || !setSharedLoop(true))
+	{
+		return false;
+	}
+	if (!reactor->attach(this))
+	{
+		setSharedLoop(false);
+		return false;
+	}
+	this->reactor = reactor;
+	return true;
+}
+
+int LinuxWatcher::readinessHandle() const
+{
+	return inotifyHandle;
+}
+
+void LinuxWatcher::processReady()
+{
+	Q_ASSERT_X(isExternalLoop(), "processing ready inotify events", "only valid in external loop mode");
+	if (inotifyHandle == INVALID_HANDLE)
+	{
+		return;
+	}
+
+	applyListings();
+	EventBatch batch;
+	readEvents(batch);
+
+	if (errorCnt >= MAX_POLL_ERRORS)
+	{
+		stopPolling();
+	}
+}
+
+bool LinuxWatcher::waitForEvents(int timeout)
+{
+	// a finished listing wakes us up as well.  poll skips it if it's -1.
+	struct pollfd pending[2];
+	pending[0].fd = inotifyHandle;
+	pending[1].fd = crawlHandle();
+	for (int i = 0; i < 2; ++i)
+	{
+		pending[i].events = POLLIN;
+		pending[i].revents = 0;
+	}
+
+	int result = ::poll(pending, 2, timeout);
+	if (result == -1)
+	{
+		if (errno != EINTR)
+		{
+			FNOTIFY_TRACE_EVENT(PollError, -1, 0, errno);
+			emit error("Trouble waiting for inotify events: " + QString(strerror(errno)));
+			++errorCnt;
+			counters.pollErrors.add();
+		}
+		return false;
+	}
+	return result > 0 && (BIT_SET(pending[0].revents, POLLIN) || BIT_SET(pending[1].revents, POLLIN));
+}
+
+void LinuxWatcher::readEvents(EventBatch & batch)
+{
+	static const size_t EVENT_SIZE = sizeof(struct inotify_event);
+
+	// whatever has been found so far goes first - it was listed before anything read now
+	bool stocked = queueInventory();
+
+	int bytesPending;
+	if (-1 == ioctl(inotifyHandle, FIONREAD, &bytesPending))
+	{
+		FNOTIFY_TRACE_EVENT(PollError, -1, 0, errno);
+		emit error("Trouble reading inotify info: " + QString(strerror(errno)));
+		++errorCnt;
+		counters.pollErrors.add();
+		return;
+	}
+	if (bytesPending < 0 || (size_t)bytesPending < EVENT_SIZE)
+	{
+		// No data to read, so let's not bother
+		if (stocked)
+		{
+			batch = publish();
 		}
-		timeSlept = 0;
+		return;
+	}
 
-		buffer.resize(bytesPending);
-		ssize_t numBytesRead = read(inotifyHandle, buffer.data(), bytesPending);
+	quint64 readStart = monotonicNanos();
+	buffer.resize(bytesPending);
+	ssize_t numBytesRead = read(inotifyHandle, buffer.data(), bytesPending);
+	counters.readNanos.add(monotonicNanos() - readStart);
+	// listings that started before this raced what it read
+	readSequence = stock.read();
 
-		if (numBytesRead == -1)
+	if (numBytesRead == -1)
+	{
+		if (errno == EINTR || errno == EAGAIN)
 		{
-			if (numBytesRead == EINTR)
+			// interrupted before anything was read, or someone else (external loop)
+			// got to the data first - this is an OK error
+			if (stocked)
 			{
-				// interrupted before anything was read - this is an OK error
-				continue;
+				batch = publish();
 			}
-			emit error("Trouble reading inotify data: " + QString(strerror(errno)));
-			++errorCnt;
-			continue;
+			return;
+		}
+		FNOTIFY_TRACE_EVENT(PollError, -1, 0, errno);
+		emit error("Trouble reading inotify data: " + QString(strerror(errno)));
+		++errorCnt;
+		counters.pollErrors.add();
+		return;
+	}
+	Q_ASSERT(numBytesRead == bytesPending);
+	if (numBytesRead != bytesPending)
+	{
+		FNOTIFY_TRACE_EVENT(PollError, -1, 0, 0);
+		emit error("Information about inotify stream doesn't match actual data read");
+		++ errorCnt;
+		counters.pollErrors.add();
+		return;
+	}
+	errorCnt = 0;
+
+	FNOTIFY_TRACE_EVENT(ReadCompleted, -1, 0, numBytesRead);
+	counters.reads.add();
+	counters.bytesRead.add(numBytesRead);
+	counters.largestRead.setMax(numBytesRead);
+	readCompleted(readStart);
+
+	record(Recording::NativeEvents, -1, buffer.constData(), numBytesRead);
+
+	processEvents(buffer.data(), numBytesRead, batch);
+
+	{
+		// the poll thread waits for the deletions to stop.  Without one, there's no telling
+		// when the next read comes.
+		QMutexLocker locker(internalLock(&lock));
+		if (!running || deletionsRead == 0)
+		{
+			dropDeleted();
 		}
-		Q_ASSERT(numBytesRead == bytesPending);
-		if (numBytesRead != bytesPending)
+	}
+}
+
+void LinuxWatcher::processEvents(char * data, int size, EventBatch & batch)
+{
+	static const size_t EVENT_SIZE = sizeof(struct inotify_event);
+	quint64 parseStart = monotonicNanos();
+	deletionsRead = 0;
+
+	// decoding paths for signals nobody is connected to would be wasted effort
+	bool signalCreated = receivers(SIGNAL(newChild(QString))) > 0;
+	bool signalDeleted = receivers(SIGNAL(deleted(QString))) > 0;
+	bool signalMovedSelf = receivers(SIGNAL(moved(QString))) > 0;
+	bool signalMoved = receivers(SIGNAL(moved(QString,QString))) > 0;
+	bool signalModified = receivers(SIGNAL(modified(QString))) > 0;
+
+	struct inotify_event * event;
+	for(int i = 0; i < size; i += EVENT_SIZE + event->len)
+	{
+		event = (struct inotify_event*)(data + i);
+		Q_ASSERT((size_t)i + event->len <= (size_t)size);
+		FNOTIFY_TRACE_EVENT(NativeEvent, event->wd, event->mask, event->cookie);
+
+		if (BIT_SET(event->mask, IN_Q_OVERFLOW))
 		{
-			emit error("Information about inotify stream doesn't match actual data read");
-			++ errorCnt;
+			// not tied to any watch - the kernel dropped events because we didn't keep up
+			FNOTIFY_TRACE_EVENT(Overflow, -1, event->mask, 0);
+			counters.overflows.add();
+			emit error("Inotify event queue overflowed - events were lost");
 			continue;
 		}
-		errorCnt = 0;
 
-		struct inotify_event * event;
-		for(int i = 0; i < buffer.size(); i += EVENT_SIZE + event->len)
+		// every path the directory is watched through gets its own copy of the event
+		Handle handle;
 		{
-			event = (struct inotify_event*)(buffer.data() + i);
-			Q_ASSERT((size_t)i + event->len <= (size_t)buffer.size());
-
-			QString filepath;
+			QMutexLocker locker(internalLock(&lock));
+			handle = handles.value(event->wd);
+		}
 
+		if (BIT_SET(event->mask, IN_IGNORED))
+		{
+			// the kernel has dropped the watch.  Normally because we removed it, or after the
+			// delete self that already tore it down - otherwise (an unmount, say) whatever
+			// still uses it goes now
+			QMutexLocker locker(internalLock(&lock));
+			foreach(const QByteArray & watchPath, handle.nativePaths)
 			{
-				QString eventBasePath = handles.value(event->wd);
-				QString eventPath = getName(event);
-	
-				if (QFileInfo(eventBasePath).isDir() || QFileInfo(eventBasePath).exists() == false)
-				{
-					filepath = QDir(eventBasePath).absoluteFilePath(eventPath);
-				}
-				else
+				if (pathWatches.contains(watchPath) && !deletedWatches.contains(watchPath))
 				{
-					if (!eventPath.isEmpty())
-					{
-						qDebug() << eventPath << " should be empty because event was generated for file " << eventBasePath;
-						Q_ASSERT(false);
-					}
-					filepath = eventBasePath;
+					dropTree(watchPath, true);
 				}
 			}
+			continue;
+		}
+		if (handle.nativePaths.isEmpty())
+		{
+			// still queued for a watch that has since been torn down
+			continue;
+		}
 
-			Q_ASSERT(!filepath.isEmpty());
+		QByteArray nativeBasePath = handle.nativePaths.first();
+		if (access(nativeBasePath.constData(), F_OK) != 0)
+		{
+			// watch was removed from out of under us without us expecting it.
+			// we'll now wait for the delete self event, filtering out all other events
+			// that may have been cause by recursive watches.
+			if (BIT_SET(event->mask, IN_DELETE_SELF))
+			{
+				// ignore all other events
+				event->mask = IN_DELETE_SELF;
+			}
+			else
+			{
+				continue;
+			}
+		}
 
-			if (handles.contains(event->wd) && 
-				QFileInfo(handles.value(event->wd)).exists() == false)
+		// only recursive watches follow new directories.  Looked up along the way, while
+		// the lock is held anyway.
+		QVarLengthArray<bool, 2> recursiveOwners;
+		{
+			// whatever the event, something in the directory changed
+			QMutexLocker locker(internalLock(&lock));
+			foreach(const QByteArray & watchPath, handle.nativePaths)
 			{
-				// watch was removed from out of under us without us expecting it.
-				// we'll now wait for the delete self event, filtering out all other events
-				// that may have been cause by recursive watches.
-				if (BIT_SET(event->mask, IN_DELETE_SELF))
-				{
-					// ignore all other events
-					event->mask = IN_DELETE_SELF;
-				}
-				else
+				RecursiveWatch * node = recursiveWatch.value(watchPath);
+				if (node != NULL)
 				{
-					continue;
+					node->touch(changeGeneration + 1);
 				}
+				QHash<QByteArray, PathWatch>::const_iterator owner = pathWatches.constFind(watchPath);
+				recursiveOwners.append(owner != pathWatches.constEnd() && owner->recursive);
 			}
+		}
+
+		QVarLengthArray<QByteArray, 2> nativePaths;
+		for (int owner = 0; owner < handle.nativePaths.size(); ++owner)
+		{
+			nativePaths.append(eventNativePath(handle.nativePaths.at(owner), event));
+		}
+
+		for (int owner = 0; owner < nativePaths.size(); ++owner)
+		{
+			const QByteArray & ownerBasePath = handle.nativePaths.at(owner);
+			const QByteArray & nativePath = nativePaths[owner];
+			// only decoded if something asks for it
+			QString filepath;
+
+			Q_ASSERT(!nativePath.isEmpty());
 
-			if (event->mask == IN_IGNORED)
+			if (BIT_SET(event->mask, IN_DELETE | IN_DELETE_SELF | IN_MOVED_FROM | IN_MOVE_SELF))
 			{
-				// inotify subsystem telling us the watch was removed
-				// TODO: We need to move the removeWatch logic here.  This is a major hack
-				// Look at assumption below
-				return;
+				vanish(nativePath);
 			}
-			// Assuming here that we cannot get watch removed events interleaved with any others - probably
-			// not a safe assumption
-			// TODO: Fix this assumption.
-			Q_ASSERT_X(!BIT_SET(event->mask, IN_IGNORED), 
-				"inotify event poll", "Assumption invalid that watch removed events come on their own");
-#ifdef _DEBUG
-			QString message = "Received unexpected event " + eventsToString(event).join(", ");
-			QByteArray messageStr = message.toAscii();
-			Q_ASSERT_X(handles.contains(event->wd), "inotify event poll", messageStr.data());
-#else
-			Q_ASSERT(handles.contains(event->wd));
-#endif /* _DEBUG */
-
-			QList<int> handledEvents;
 
 			if (BIT_SET(event->mask, IN_CREATE))
 			{
-				emit newChild(filepath);
+				if (signalCreated)
+				{
+					emit newChild(decodedPath(filepath, nativePath));
+				}
+				queueEvent(FileEvent::Created, nativePath);
 
 				// Now we need to handle the recursive case
 #ifdef _DEBUG
-				QString gotPath = QFileInfo(filepath).canonicalPath();
-				QString watching = QFileInfo(handles.value(event->wd)).canonicalPath();
+				QString gotPath = QFileInfo(decodedPath(filepath, nativePath)).canonicalPath();
+				QString watching = QFileInfo(QFile::decodeName(ownerBasePath)).canonicalPath();
 
 				if (gotPath == watching)
 				{
@@ -302,24 +613,17 @@ void LinuxWatcher::poll()
 					qDebug() << "Watch handle = " << watching;
 					qFatal("Not sure - something to do with recursive watches");
 				}
-				else
-				{
-					Q_ASSERT(QFileInfo(filepath).canonicalPath() != QFileInfo(handles.value(event->wd)).canonicalPath());
-				}
-#else
-				Q_ASSERT(QFileInfo(filepath).canonicalPath() != QFileInfo(handles.value(event->wd)).canonicalPath());
 #endif /* _DEBUG */
 				
 				// if something unexpected happens and for some reason
 				// we get a create event for the directory we're watching,
 				// then we should ignore it
-				if (filepath != handles.value(event->wd))
+				if (nativePath != ownerBasePath)
 				{
-					if (QFileInfo(filepath).isDir() && recursiveWatch.value(handles.value(event->wd)) != NULL)
+					// each recursive owner gets a path for it, all sharing the one kernel watch
+					if (recursiveOwners[owner])
 					{
-						bool watchAdded = addWatch(filepath, true);
-						Q_ASSERT(watchAdded);
-						recursiveWatch.value(handles.value(event->wd))->addChild(recursiveWatch.value(filepath));
+						watchCreated(ownerBasePath, nativePath, BIT_SET(event->mask, IN_ISDIR));
 					}
 				}
 				else
@@ -330,107 +634,147 @@ void LinuxWatcher::poll()
 			if (BIT_SET(event->mask, IN_DELETE))
 			{
 				Q_ASSERT(!BIT_SET(event->mask, IN_DELETE_SELF));
-				emit deleted(filepath);
+				if (BIT_SET(event->mask, IN_ISDIR))
+				{
+					++deletionsRead;
+				}
+				if (signalDeleted)
+				{
+					emit deleted(decodedPath(filepath, nativePath));
+				}
+				queueEvent(FileEvent::Deleted, nativePath);
 			}
 			else if (BIT_SET(event->mask, IN_DELETE_SELF))
 			{
 				Q_ASSERT(!BIT_SET(event->mask, IN_DELETE));
-				// if we've been deleted, then we should remove ourselves from
-				// any watches
-#ifdef _DEBUG
-				if (!hasWatch(filepath))
+				// if we've been deleted, then we should remove ourselves & everything under
+				// us from any watches - however many times each was added.  Once the rest of
+				// the tree has gone too.
 				{
-					qDebug() << "Don't have watch for " << filepath << " anymore";
-					Q_ASSERT(false);
+					QMutexLocker locker(internalLock(&lock));
+					if (pathWatches.contains(ownerBasePath))
+					{
+						deletedWatches.insert(ownerBasePath);
+					}
 				}
-#else
-				Q_ASSERT(hasWatch(filepath));
-#endif /* _DEBUG */
-				int watchID = handles.key(filepath);
-				Q_ASSERT(recursiveWatch.value(filepath) != NULL);
-				bool removed = removeWatch(filepath);
-#ifdef _DEBUG
-				if (removed == false)
+				++deletionsRead;
+				if (signalDeleted)
 				{
-					qDebug() << "Unable to remove watch for " << filepath;
-					Q_ASSERT(false);
+					emit deleted(decodedPath(filepath, nativePath));
 				}
-#else
-				Q_ASSERT(removed);
-#endif /* _DEBUG */
-				emit deleted(filepath);
+				queueEvent(FileEvent::Deleted, nativePath);
 			}
 			if (BIT_SET(event->mask, IN_MOVE_SELF))
 			{
-				emit moved(filepath);
+				if (signalMovedSelf)
+				{
+					emit moved(decodedPath(filepath, nativePath));
+				}
+				queueEvent(FileEvent::MovedSelf, nativePath);
 				// if we've moved, then we should remove ourselves from
-				// any watches
-				Q_ASSERT(hasWatch(filepath));
-				bool removed = removeWatch(filepath);
-				Q_ASSERT(removed == true);
+				// any watches - the paths under us are stale as well
+				QMutexLocker locker(internalLock(&lock));
+				if (pathWatches.contains(ownerBasePath))
+				{
+					dropTree(ownerBasePath, true);
+				}
 			}
-			if (BIT_SET(event->mask, IN_MOVED_TO | IN_MOVED_FROM))
+			if (BIT_SET(event->mask, IN_MODIFY))
 			{
-				// Is there another case where the cookie might be set for
-				// an event that doesn't involve a move
-				Q_ASSERT(event->cookie != 0);
+				if (signalModified)
+				{
+					emit modified(decodedPath(filepath, nativePath));
+				}
+				queueEvent(FileEvent::Modified, nativePath);
+			}
+		}
+
+		if (BIT_SET(event->mask, IN_MOVED_TO | IN_MOVED_FROM) && !nativePaths.isEmpty())
+		{
+			// Is there another case where the cookie might be set for
+			// an event that doesn't involve a move
+			Q_ASSERT(event->cookie != 0);
 
-				QString otherPath = cookieMap.value(event->cookie);
-				if (otherPath.isEmpty())
+			QList<QByteArray> otherPaths = cookieMap.take(event->cookie);
+			if (otherPaths.isEmpty())
+			{
+				// we haven't received our sibling event yet, so
+				// we cache the result for the future
+				Q_ASSERT(childNameLength(event) != 0);
+				for (int owner = 0; owner < nativePaths.size(); ++owner)
 				{
-					// we haven't received our sibling event yet, so
-					// we cache the result for the future
-					Q_ASSERT(!getName(event).isEmpty());
-					cookieMap[event->cookie] = event->name;
+					otherPaths += nativePaths[owner];
 				}
-				else
+				cookieMap.insert(event->cookie, otherPaths);
+			}
+			else
+			{
+				// pair the two halves up path by path.  If the two directories are watched
+				// through a different number of paths, the extra ones pair up with the last
+				// path of the other side.
+				int pairs = qMax(otherPaths.size(), nativePaths.size());
+				for (int pair = 0; pair < pairs; ++pair)
 				{
-					cookieMap.remove(event->cookie);
+					const QByteArray & nativePath = nativePaths[qMin(pair, nativePaths.size() - 1)];
+					const QByteArray & otherPath = otherPaths.at(qMin(pair, otherPaths.size() - 1));
 
-					QString eventPath = getName(event);
+					// the paths can't be told apart by checking which one exists - the file may
+					// well have been moved again (or deleted) by the time we get here
+					QByteArray from;
+					QByteArray to;
 
-					QString from;
-					QString to;
-
-					if (QFileInfo(eventPath).exists())
+					if (BIT_SET(event->mask, IN_MOVED_TO))
 					{
-						from = eventPath;
-						to = otherPath;
+						from = otherPath;
+						to = nativePath;
 					}
 					else
 					{
-						Q_ASSERT(QFileInfo(otherPath).exists());
-						from = otherPath;
-						to = eventPath;
+						from = nativePath;
+						to = otherPath;
+					}
+					if (signalMoved)
+					{
+						emit moved(QFile::decodeName(from), QFile::decodeName(to));
 					}
-					emit moved(from, to);
+					queueEvent(FileEvent::Moved, from, to);
 				}
 			}
-			if (BIT_SET(event->mask, IN_MODIFY))
-				emit modified(filepath);
 		}
 	}
-
-	stopPolling();
+	{
+		QMutexLocker locker(internalLock(&lock));
+		++changeGeneration;
+	}
+	counters.parseNanos.add(monotonicNanos() - parseStart);
+	counters.unpairedMoves.set(cookieMap.size());
+	batch = publish();
 }
 
 void LinuxWatcher::stopPolling()
 {
+	InotifyReactor * shared = reactor;
+	if (shared != NULL)
+	{
+		// waits out the reactor if it's in the middle of processing our events, so that we
+		// don't close the handle from under it
+		shared->detach(this);
+		reactor = NULL;
+	}
 
 	if (running)
 	{
 		int realHandle;
 
-		QMutexLocker locker(&lock);
-		qDebug() << "Locking to stop polling";
+		QMutexLocker locker(internalLock(&lock));
 
 		Q_ASSERT(inotifyHandle != INVALID_HANDLE);
 
 		realHandle = inotifyHandle;
 		inotifyHandle = INVALID_HANDLE;
 		running = false;
+		FNOTIFY_TRACE_EVENT(PollStopped, realHandle, 0, 0);
 
-		qDebug() << "Unlocking";
 		locker.unlock();
 
 		if (0 != close(realHandle))
@@ -449,114 +793,800 @@ void LinuxWatcher::stopPolling()
 	}
 	Q_ASSERT(inotifyHandle == INVALID_HANDLE);
 	Q_ASSERT(running == false);
+
+	// nothing more can be recorded
+	recorder.close();
+	pollingStopped();
 }
 
-bool LinuxWatcher::supportsRecursiveWatch() const
+EventBatch LinuxWatcher::publish()
 {
-	return true;
+	// only the poll thread comes back in time to deliver what adaptive batching holds
+	return running ? publishEvents() : flushEvents();
 }
 
-bool LinuxWatcher::addWatch(const QString & path, bool recursive)
+bool LinuxWatcher::setRecording(const QString & fileName)
 {
-	Q_ASSERT(path != ".." || !recursive);
-
-	QMutexLocker locker(&lock);
-	qDebug() << "Locked for adding watch";
-
-	Q_ASSERT(!path.isEmpty());
-	if (path.isEmpty())
-	{
-		emit error("Path for watch cannot be empty");
-		return false;
-	}
-	QFileInfo fInfo(path);
-	QByteArray utf8Path;
-	uint32_t masks;
-
-	if (!fInfo.exists())
+	// the table is written under the lock, so that no watch comes or goes unrecorded
+	QMutexLocker locker(internalLock(&lock));
+	recorder.close();
+	if (fileName.isEmpty())
 	{
-		emit error("Cannot set a watch for a non-existant path (" + path + ")");
-		return false;
+		return true;
 	}
-	
-	utf8Path = path.toUtf8();
-	masks = IN_CREATE | IN_DELETE |	IN_DELETE_SELF |
-		IN_MOVED_FROM | IN_MOVED_TO | IN_MOVE_SELF | IN_MODIFY;
-	
-	int result = inotify_add_watch(inotifyHandle, utf8Path.data(), masks);
-
-	if (result == -1)
+	if (!recorder.create(fileName))
 	{
-		emit error("Error adding watch(" + path + "): " + strerror(errno));
+		emit error("Unable to record to " + fileName + ": " + recorder.errorString());
 		return false;
 	}
-
-	if (fInfo.isDir() && recursive)
+	for (QHash<int, Handle>::const_iterator handle = handles.constBegin(); handle != handles.constEnd(); ++handle)
 	{
-		QDir dir(path);
-		foreach(QString child, dir.entryList(QDir::Dirs | QDir::NoDotAndDotDot))
+		foreach(const QByteArray & nativePath, handle->nativePaths)
 		{
-			locker.unlock();
-			addWatch(child, true);
-			locker.relock();
+			record(Recording::WatchAdded, handle.key(), nativePath.constData(), nativePath.size());
 		}
 	}
+	return recorder.isOpen();
+}
 
-	Q_ASSERT(!handles.contains(result));
-	Q_ASSERT(!recursiveWatch.contains(path));
-
-	handles[result] = path;
-	recursiveWatch[path] = new RecursiveWatch(path);
+QString LinuxWatcher::recording() const
+{
+	return recorder.isOpen() ? recorder.fileName() : QString();
+}
 
-	emit watchAdded(path);
+void LinuxWatcher::record(Recording::Type type, int handle, const char * data, int size)
+{
+	if (recorder.isOpen() && !recorder.write(type, handle, data, size))
+	{
+		emit error("Stopped recording to " + recorder.fileName() + ": " + recorder.errorString());
+		recorder.close();
+	}
+}
 
+bool LinuxWatcher::supportsRecursiveWatch() const
+{
 	return true;
 }
 
-bool LinuxWatcher::removeWatch(const QString & path)
+bool LinuxWatcher::addWatch(const QString & path, bool recursive)
 {
-	QMutexLocker locker(&lock);
-	qDebug() << "Removing watch for " << path;
 	Q_ASSERT(!path.isEmpty());
 	if (path.isEmpty())
 	{
 		emit error("Path for watch cannot be empty");
 		return false;
 	}
+	// events are reported with absolute paths, whatever the watch was added with
+	return addNativeWatch(path, nativeWatchPath(path), recursive);
+}
+
+/**
+ * Crawls every step-th root of an addWatches batch, starting from the first.
+ */
+class PlanRunner : public QRunnable
+{
+public:
+	PlanRunner(LinuxWatcher * watcher, LinuxWatcher::WatchPlan * plans, int count, int first, int step, QSemaphore & finished)
+		: watcher(watcher), plans(plans), count(count), first(first), step(step), finished(finished)
+	{
+	}
+
+	void run()
+	{
+		for (int i = first; i < count; i += step)
+		{
+			watcher->addTree(plans[i]);
+		}
+		finished.release();
+	}
+
+private:
+	LinuxWatcher * watcher;
+	LinuxWatcher::WatchPlan * plans;
+	int count;
+	int first;
+	int step;
+	QSemaphore & finished;
+};
+
+int LinuxWatcher::addWatches(const QList<WatchSpec> & specs)
+{
+	QVector<WatchPlan> plans(specs.size());
+	for (int i = 0; i < specs.size(); ++i)
+	{
+		plans[i].spec = specs.at(i);
+	}
 
-	QByteArray utf8Path = path.toUtf8();
+	// stat & readdir are where the time goes.  Without a lock (an external loop of our own)
+	// nothing may touch our state but the calling thread.
+	int workers = internalLock(&lock) == NULL ? 1 : qMin(plans.size(), qMax(1, QThread::idealThreadCount()));
+	QSemaphore finished;
+	// the pool gets its share first, so that it's busy while we do ours
+	QList<PlanRunner *> unstarted;
+	for (int worker = 1; worker < workers; ++worker)
+	{
+		PlanRunner * runner = new PlanRunner(this, plans.data(), plans.size(), worker, workers, finished);
+		if (!QThreadPool::globalInstance()->tryStart(runner))
+		{
+			// the pool is busy - don't wait on it
+			unstarted += runner;
+		}
+	}
+	unstarted.prepend(new PlanRunner(this, plans.data(), plans.size(), 0, workers, finished));
+	foreach(PlanRunner * runner, unstarted)
+	{
+		runner->run();
+		delete runner;
+	}
+	finished.acquire(workers);
 
-	QList<QString> values = const_cast<const QHash<int, QString> &>(handles).values();
-	if (!values.contains(path))
+	QList<QString> added;
+	QStringList failed;
+	for (int i = 0; i < plans.size(); ++i)
+	{
+		const WatchPlan & plan = plans.at(i);
+		if (!plan.error.isEmpty())
+		{
+			emit error(plan.error);
+		}
+		if (!plan.watched)
+		{
+			failed += plan.spec.path;
+		}
+		added += plan.added;
+	}
+
+	counters.watchesAdded.add(added.size());
+	emit watchesAdded(added.size(), failed);
+	return failed.size();
+}
+
+void LinuxWatcher::addTree(WatchPlan & plan)
+{
+	plan.watched = false;
+	const QString & path = plan.spec.path;
+	if (path.isEmpty())
+	{
+		plan.error = "Path for watch cannot be empty";
+		return;
+	}
+	QByteArray nativePath = nativeWatchPath(path);
+
+	struct stat info;
+	if (stat(nativePath.constData(), &info) != 0)
+	{
+		plan.error = "Cannot set a watch for a non-existant path (" + path + ")";
+		return;
+	}
+	plan.crawl.device = info.st_dev;
+	plan.crawl.visited.insert(qMakePair((quint64)info.st_dev, (quint64)info.st_ino));
+
+	PlannedWatch root;
+	root.path = path;
+	root.nativePath = nativePath;
+	root.parent = -1;
+	plan.watches += root;
+
+	bool recursive = plan.spec.recursive;
+	bool descend = recursive && S_ISDIR(info.st_mode);
+	// NULL for the directories whose children are skipped.  Guarded, since a teardown can
+	// come in whenever the lock is released.
+	QList<QPointer<RecursiveWatch> > nodes;
+
+	// breadth first, so that parents come before their children
+	for (int i = 0; i < plan.watches.size(); ++i)
+	{
+		// copied, as the list grows
+		PlannedWatch planned = plan.watches.at(i);
+		RecursiveWatch * node = NULL;
+		{
+			QMutexLocker locker(internalLock(&lock));
+			if (deletedWatches.contains(planned.nativePath))
+			{
+				dropDeleted();
+			}
+			RecursiveWatch * parent = planned.parent == -1 ? NULL : (RecursiveWatch *)nodes.at(planned.parent);
+			QHash<QByteArray, PathWatch>::iterator existing = pathWatches.find(planned.nativePath);
+			if (planned.parent != -1 && parent == NULL)
+			{
+				// its parent has been torn down since it was listed
+			}
+			else if (existing != pathWatches.end())
+			{
+				// someone else is already watching it - share.  Same as addNativeWatch, a
+				// directory that was already recursive has its children covered.
+				++existing->refs;
+				bool covered = existing->recursive;
+				existing->recursive = existing->recursive || recursive;
+				RecursiveWatch * shared = recursiveWatch.value(planned.nativePath);
+				if (parent != NULL && shared != NULL)
+				{
+					parent->addChild(shared);
+				}
+				node = covered ? NULL : shared;
+				plan.watched = plan.watched || i == 0;
+			}
+			else
+			{
+				node = installWatch(planned.path, planned.nativePath, recursive, parent, i != 0);
+				if (node != NULL)
+				{
+					// known before the lock goes, as a teardown may forget it right after
+					rememberWatch(planned.path);
+					plan.added += planned.path;
+					plan.watched = plan.watched || i == 0;
+				}
+				else if (i == 0)
+				{
+					plan.error = "Error adding watch(" + planned.path + "): " + strerror(errno);
+				}
+				// otherwise gone since it was listed, or already watched through another path
+			}
+		}
+		nodes += node;
+		if (node == NULL || !descend)
+		{
+			continue;
+		}
+
+		// listed once it is watched, so that nothing created in the meantime is missed
+		QList<QByteArray> children;
+		listStocked(planned.nativePath, children);
+
+		foreach(const QByteArray & child, children)
+		{
+			struct stat childInfo;
+			if (stat(child.constData(), &childInfo) != 0)
+			{
+				continue;
+			}
+			QPair<quint64, quint64> id((quint64)childInfo.st_dev, (quint64)childInfo.st_ino);
+			if ((!crossesFilesystems() && id.first != plan.crawl.device) || plan.crawl.visited.contains(id))
+			{
+				continue;
+			}
+			plan.crawl.visited.insert(id);
+
+			PlannedWatch found;
+			found.path = QFile::decodeName(child);
+			found.nativePath = child;
+			found.parent = i;
+			plan.watches += found;
+		}
+	}
+}
+
+RecursiveWatch * LinuxWatcher::installWatch(const QString & name, const QByteArray & nativePath, bool recursive, RecursiveWatch * parent, bool reached)
+{
+	int result = inotify_add_watch(inotifyHandle, nativePath.constData(), WATCH_MASK);
+	if (result == -1)
+	{
+		return NULL;
+	}
+	if (reached && handles.contains(result))
+	{
+		// a link back to a directory that is watched already - an ancestor, say.  Whatever
+		// crawl got here, following it would only watch the same tree all over again.
+		errno = EEXIST;
+		return NULL;
+	}
+
+	Handle & handle = handles[result];
+	FNOTIFY_TRACE_EVENT(WatchAdded, result, WATCH_MASK, recursive);
+	record(Recording::WatchAdded, result, nativePath.constData(), nativePath.size());
+	handle.nativePaths += nativePath;
+
+	PathWatch watch;
+	watch.handle = result;
+	watch.refs = 1;
+	watch.recursive = recursive;
+	watch.name = name;
+	pathWatches.insert(nativePath, watch);
+
+	RecursiveWatch * node = new RecursiveWatch(nativePath, parent);
+	recursiveWatch[nativePath] = node;
+	// a new directory is a change as far as its parent's subtree goes
+	node->touch(changeGeneration + 1);
+	return node;
+}
+
+quint64 LinuxWatcher::generation() const
+{
+	QMutexLocker locker(internalLock(&lock));
+	return changeGeneration;
+}
+
+QStringList LinuxWatcher::changedSince(const QString & root, quint64 generation) const
+{
+	QStringList changed;
+	QByteArray key = nativeWatchPath(root);
+	QMutexLocker locker(internalLock(&lock));
+	RecursiveWatch * node = recursiveWatch.value(key);
+	if (node != NULL)
+	{
+		node->changedSince(generation, changed);
+	}
+	return changed;
+}
+
+bool LinuxWatcher::crawlsAsynchronously() const
+{
+	// an external loop only expects to be called back on its own thread
+	return crawler.isValid() && (running || reactor != NULL);
+}
+
+int LinuxWatcher::crawlHandle() const
+{
+	return crawler.isValid() ? crawler.readyHandle() : -1;
+}
+
+void LinuxWatcher::watchCreated(const QByteArray & parentPath, const QByteArray & nativePath, bool isDirectory)
+{
+	bool followLinks = symlinkPolicy() == FollowSymlinks;
+	if (!crawlsAsynchronously())
+	{
+		struct stat info;
+		int result = followLinks ? stat(nativePath.constData(), &info) : lstat(nativePath.constData(), &info);
+		if (result == 0 && S_ISDIR(info.st_mode))
+		{
+			// it was reached, not asked for - if it leads to a directory that is already
+			// watched, it isn't watched again
+			Crawl crawl;
+			crawl.device = info.st_dev;
+			bool watchAdded = addNativeWatch(QFile::decodeName(nativePath), nativePath, true, &crawl);
+			QMutexLocker locker(internalLock(&lock));
+			RecursiveWatch * parent = recursiveWatch.value(parentPath);
+			RecursiveWatch * child = recursiveWatch.value(nativePath);
+			if (watchAdded && parent != NULL && child != NULL)
+			{
+				parent->addChild(child);
+			}
+		}
+		return;
+	}
+
+	if (isDirectory)
+	{
+		// watched straight away, so that nothing created in it is missed while it is listed
+		QMutexLocker locker(internalLock(&lock));
+		if (installCrawled(parentPath, nativePath) == NULL)
+		{
+			return;
+		}
+	}
+	else if (!followLinks)
+	{
+		return;
+	}
+	// otherwise it may be a link to a directory - its listing will tell
+
+	PendingCrawl crawl;
+	crawl.parent = parentPath;
+	crawl.root = nativePath;
+	crawl.crawl.device = 0;
+	crawl.listings = 1;
+	int id = nextCrawl++;
+	pendingCrawls.insert(id, crawl);
+	crawler.submit(id, QFile::decodeName(nativePath), nativePath, followLinks, crawlStock());
+}
+
+RecursiveWatch * LinuxWatcher::installCrawled(const QByteArray & parentPath, const QByteArray & nativePath)
+{
+	if (deletedWatches.contains(nativePath))
+	{
+		// created again straight after it was deleted
+		dropDeleted();
+	}
+	RecursiveWatch * parent = recursiveWatch.value(parentPath);
+	if (parent == NULL || pathWatches.contains(nativePath))
+	{
+		// the parent has been torn down since, or the directory was found twice - through its
+		// create event & through the listing of its parent
+		return NULL;
+	}
+
+	QString path = QFile::decodeName(nativePath);
+	RecursiveWatch * node = installWatch(path, nativePath, true, parent, true);
+	if (node != NULL)
+	{
+		counters.watchesAdded.add();
+		emit watchAdded(path);
+	}
+	return node;
+}
+
+void LinuxWatcher::applyListings()
+{
+	QList<CrawlEngine::Listing> listings = crawler.takeCompleted();
+	if (listings.isEmpty())
+	{
+		return;
+	}
+
+	bool followLinks = symlinkPolicy() == FollowSymlinks;
+	QMutexLocker locker(internalLock(&lock));
+	foreach(const CrawlEngine::Listing & listing, listings)
+	{
+		QHash<int, PendingCrawl>::iterator crawl = pendingCrawls.find(listing.crawl);
+		Q_ASSERT(crawl != pendingCrawls.end());
+		if (crawl == pendingCrawls.end())
+		{
+			continue;
+		}
+
+		bool watched = listing.directory;
+		if (watched && listing.nativePath == crawl->root)
+		{
+			crawl->crawl.device = listing.device;
+			crawl->crawl.visited.insert(qMakePair(listing.device, listing.inode));
+			if (!pathWatches.contains(listing.nativePath))
+			{
+				// a link that turned out to lead to a directory
+				watched = installCrawled(crawl->parent, listing.nativePath) != NULL;
+			}
+		}
+		// the directory may have been torn down while it was being listed
+		watched = watched && pathWatches.contains(listing.nativePath);
+
+		foreach(const CrawlEngine::Entry & child, listing.children)
+		{
+			if (!watched)
+			{
+				break;
+			}
+			QPair<quint64, quint64> id(child.device, child.inode);
+			if ((!crossesFilesystems() && child.device != crawl->crawl.device) || crawl->crawl.visited.contains(id))
+			{
+				continue;
+			}
+			crawl->crawl.visited.insert(id);
+
+			if (installCrawled(listing.nativePath, child.nativePath) != NULL)
+			{
+				++crawl->listings;
+				crawler.submit(listing.crawl, child.path, child.nativePath, followLinks, crawlStock());
+			}
+		}
+
+		if (--crawl->listings == 0)
+		{
+			pendingCrawls.erase(crawl);
+		}
+	}
+}
+
+bool LinuxWatcher::addNativeWatch(const QString & path, const QByteArray & nativePath, bool recursive, Crawl * crawl)
+{
+	Q_ASSERT(path != ".." || !recursive);
+
+	QMutexLocker locker(internalLock(&lock));
+
+	struct stat info;
+	if (stat(nativePath.constData(), &info) != 0)
+	{
+		emit error("Cannot set a watch for a non-existant path (" + path + ")");
+		return false;
+	}
+
+	QPair<quint64, quint64> id((quint64)info.st_dev, (quint64)info.st_ino);
+	Crawl root;
+	if (crawl != NULL)
+	{
+		if (!crossesFilesystems() && id.first != crawl->device)
+		{
+			// a mount point
+			return false;
+		}
+		if (crawl->visited.contains(id))
+		{
+			// reached again through a link loop or a bind mount - watched once is enough
+			return false;
+		}
+		crawl->visited.insert(id);
+	}
+	else
+	{
+		root.device = id.first;
+		root.visited.insert(id);
+		crawl = &root;
+	}
+
+	if (deletedWatches.contains(nativePath))
+	{
+		dropDeleted();
+	}
+	// however the path is spelt
+	QHash<QByteArray, PathWatch>::iterator existing = pathWatches.find(nativePath);
+	if (existing != pathWatches.end())
+	{
+		// someone else is already watching it - share
+		++existing->refs;
+		if (recursive && !existing->recursive && S_ISDIR(info.st_mode))
+		{
+			existing->recursive = true;
+			watchChildren(nativePath, *crawl, locker);
+		}
+		return true;
+	}
+
+	Q_ASSERT(!recursiveWatch.contains(nativePath));
+
+	// the same inode always gets the same handle, so a path leading to a directory that is
+	// already watched under another name doesn't cost another kernel watch
+	if (installWatch(path, nativePath, recursive, NULL, crawl != &root) == NULL)
+	{
+		if (errno != EEXIST)
+		{
+			emit error("Error adding watch(" + path + "): " + strerror(errno));
+		}
+		return false;
+	}
+	// reported before the lock is let go to list the children, as a teardown may follow
+	counters.watchesAdded.add();
+	emit watchAdded(path);
+
+	if (S_ISDIR(info.st_mode) && recursive)
+	{
+		watchChildren(nativePath, *crawl, locker);
+	}
+
+	return true;
+}
+
+void LinuxWatcher::listChildren(const QByteArray & nativePath, QList<QByteArray> & children, QList<QByteArray> * others) const
+{
+	CrawlEngine::listDirectories(nativePath, symlinkPolicy() == FollowSymlinks, children, others);
+}
+
+void LinuxWatcher::listStocked(const QByteArray & nativePath, QList<QByteArray> & children)
+{
+	if (!reportsInventory())
+	{
+		listChildren(nativePath, children);
+		return;
+	}
+	QList<QByteArray> others;
+	quint64 at = stock.listing();
+	listChildren(nativePath, children, &others);
+	stock.add(at, children + others);
+	crawler.wake();
+}
+
+InventoryStock * LinuxWatcher::crawlStock()
+{
+	return reportsInventory() ? &stock : NULL;
+}
+
+bool LinuxWatcher::queueInventory()
+{
+	bool queued = false;
+	QList<InventoryStock::Listed> listings = stock.take();
+	foreach(const InventoryStock::Listed & listed, listings)
+	{
+		// read from inotify while it was being listed - some of it may be gone already
+		bool raced = listed.at != readSequence;
+		foreach(const QByteArray & path, listed.paths)
+		{
+			if (raced && vanishedSince(path, listed.at))
+			{
+				continue;
+			}
+			queueEvent(FileEvent::Existing, path);
+			queued = true;
+		}
+	}
+	if (!vanished.isEmpty() && !stock.listingInProgress())
+	{
+		// whatever starts listing now starts after all of it
+		vanished.clear();
+	}
+	return queued;
+}
+
+void LinuxWatcher::vanish(const QByteArray & nativePath)
+{
+	if (reportsInventory() && stock.listingInProgress())
+	{
+		vanished.insert(nativePath, readSequence);
+	}
+}
+
+bool LinuxWatcher::vanishedSince(const QByteArray & nativePath, quint64 read) const
+{
+	// the path & every directory above it, without copying any of them
+	int length = nativePath.size();
+	while (length > 0)
+	{
+		QHash<QByteArray, quint64>::const_iterator gone = vanished.constFind(QByteArray::fromRawData(nativePath.constData(), length));
+		if (gone != vanished.constEnd() && gone.value() > read)
+		{
+			return true;
+		}
+		length = nativePath.lastIndexOf('/', length - 1);
+	}
+	return false;
+}
+
+void LinuxWatcher::watchChildren(const QByteArray & nativePath, Crawl & crawl, QMutexLocker & locker)
+{
+	// nothing is held up while the directory is read
+	QList<QByteArray> children;
+	locker.unlock();
+	listStocked(nativePath, children);
+	locker.relock();
+	if (!recursiveWatch.contains(nativePath))
+	{
+		// torn down meanwhile - its children would be left watched on their own
+		return;
+	}
+
+	foreach(const QByteArray & child, children)
+	{
+		locker.unlock();
+		bool childAdded = addNativeWatch(QFile::decodeName(child), child, true, &crawl);
+		locker.relock();
+
+		RecursiveWatch * parent = recursiveWatch.value(nativePath);
+		RecursiveWatch * childWatch = recursiveWatch.value(child);
+		if (childAdded && parent != NULL && childWatch != NULL)
+		{
+			parent->addChild(childWatch);
+		}
+	}
+}
+
+bool LinuxWatcher::removeWatch(const QString & path)
+{
+	QMutexLocker locker(internalLock(&lock));
+	Q_ASSERT(!path.isEmpty());
+	if (path.isEmpty())
+	{
+		emit error("Path for watch cannot be empty");
+		return false;
+	}
+
+	QByteArray key = nativeWatchPath(path);
+	QHash<QByteArray, PathWatch>::iterator watch = pathWatches.find(key);
+	if (watch == pathWatches.end())
 	{
 		emit error("Attempting to remove a path for which there is no watch(" + path + ")");
 		return false;
 	}
-	Q_ASSERT(values.count(path) == 1);
+	if (--watch->refs > 0)
+	{
+		// still wanted by whoever else added it
+		return true;
+	}
+	return dropTree(key, false);
+}
 
-	int watchHandle = handles.key(path);
-	int numRemoved;
+void LinuxWatcher::dropDeleted()
+{
+	if (deletedWatches.isEmpty())
+	{
+		return;
+	}
+	// the tops of the deleted trees take the rest with them
+	QList<QByteArray> tops;
+	foreach(const QByteArray & path, deletedWatches)
+	{
+		RecursiveWatch * node = recursiveWatch.value(path);
+		RecursiveWatch * parent = node == NULL ? NULL : node->parentWatch();
+		if (parent == NULL || !deletedWatches.contains(parent->path()))
+		{
+			tops += path;
+		}
+	}
+	deletedWatches.clear();
+	foreach(const QByteArray & top, tops)
+	{
+		if (pathWatches.contains(top))
+		{
+			dropTree(top, true);
+		}
+	}
+}
 
-	numRemoved = handles.remove(watchHandle);
-	Q_ASSERT(numRemoved == 1);
+bool LinuxWatcher::dropTree(const QByteArray & root, bool force)
+{
+	Q_ASSERT(pathWatches.contains(root));
 
-	Q_ASSERT(recursiveWatch.value(path) != NULL);
-	delete recursiveWatch.value(path);
-	numRemoved = recursiveWatch.remove(path);
-	Q_ASSERT(numRemoved == 1);
+	// find everything that goes first.  Directories that were also added on their own keep
+	// their watch & their subtree - they are cut loose from the tree instead.
+	QList<QByteArray> doomed;
+	QList<QPair<RecursiveWatch *, RecursiveWatch *> > staying;
+	QVector<RecursiveWatch *> pending;
 
-	if (-1 == inotify_rm_watch(inotifyHandle, watchHandle))
+	doomed += root;
+	RecursiveWatch * top = recursiveWatch.value(root);
+	if (top != NULL)
+	{
+		pending.append(top);
+	}
+	while (!pending.isEmpty())
 	{
-		if (QFile::exists(path) || errno != 2)
+		RecursiveWatch * node = pending.last();
+		pending.pop_back();
+
+		foreach(RecursiveWatch * child, node->childWatches())
 		{
-			// we swallow error that are generated from attempting to
-			// remove a watch from a file that has been removed
-			emit error("Error removing watch (" + path + "): (" + QString::number(errno) + ") " + strerror(errno));
-			return false;
+			QHash<QByteArray, PathWatch>::iterator watch = pathWatches.find(child->path());
+			Q_ASSERT(watch != pathWatches.end());
+			if (!force && watch != pathWatches.end() && watch->refs > 1)
+			{
+				--watch->refs;
+				staying += qMakePair(node, child);
+				continue;
+			}
+			doomed += child->path();
+			pending.append(child);
 		}
 	}
 
-	emit watchRemoved(path);
+	typedef QPair<RecursiveWatch *, RecursiveWatch *> Link;
+	foreach(const Link & link, staying)
+	{
+		link.first->removeChild(link.second);
+	}
+	// takes the rest of the tree with it
+	delete top;
 
+	// reported as they were added
+	QList<QString> names;
+	bool ok = true;
+	foreach(const QByteArray & path, doomed)
+	{
+		names += pathWatches.value(path).name;
+		recursiveWatch.remove(path);
+		ok = unwatch(path, force) && ok;
+	}
+
+	counters.watchesRemoved.add(doomed.size());
+	if (doomed.size() == 1)
+	{
+		emit watchRemoved(names.first());
+	}
+	else
+	{
+		forgetWatches(names);
+		emit subtreeRemoved(names.first(), doomed.size());
+	}
+	return ok;
+}
+
+bool LinuxWatcher::unwatch(const QByteArray & path, bool force)
+{
+	QHash<QByteArray, PathWatch>::iterator watch = pathWatches.find(path);
+	if (watch == pathWatches.end())
+	{
+		return true;
+	}
+	int watchHandle = watch->handle;
+	pathWatches.erase(watch);
+
+	Q_ASSERT(handles.contains(watchHandle));
+	Handle & handle = handles[watchHandle];
+	int index = handle.nativePaths.indexOf(path);
+	Q_ASSERT(index != -1);
+	record(Recording::WatchRemoved, watchHandle, path.constData(), path.size());
+	handle.nativePaths.removeAt(index);
+	bool lastPath = handle.nativePaths.isEmpty();
+	if (lastPath)
+	{
+		handles.remove(watchHandle);
+	}
+	FNOTIFY_TRACE_EVENT(WatchRemoved, watchHandle, 0, lastPath);
+
+	if (lastPath && -1 == inotify_rm_watch(inotifyHandle, watchHandle))
+	{
+		// we swallow error that are generated from attempting to
+		// remove a watch from a file that has been removed
+		int removeError = errno;
+		if (!force && (access(path.constData(), F_OK) == 0 || removeError != ENOENT))
+		{
+			emit error("Error removing watch (" + QFile::decodeName(path) + "): (" + QString::number(removeError) + ") " + strerror(removeError));
+			return false;
+		}
+	}
 	return true;
 }
@@ -14,12 +14,23 @@
 #include <core/FileWatcher.h>
 
 #include <QHash>
+#include <QByteArray>
+#include <QStringList>
+#include <QPointer>
+#include <QSet>
+#include <QPair>
+#include <core/EventBatch.h>
+#include <core/Recording.h>
 
 #include "RecursiveWatch.h"
+#include "CrawlEngine.h"
+#include "InventoryStock.h"
 
 #define INVALID_HANDLE -1
 
 struct inotify_event;
+class InotifyReactor;
+class QMutexLocker;
 
 /**
  * The inotfiy implementation for file notification.
@@ -27,8 +38,16 @@ struct inotify_event;
  */
 class LinuxWatcher : public FileWatcher
 {
+	Q_OBJECT
+	Q_PROPERTY(QString recording READ recording WRITE setRecording)
+
 public:
-	LinuxWatcher();
+	/**
+	 * @param crawlPool Where new directories are listed, shared with other watchers - it
+	 * must outlive anything the watcher does once it has stopped polling.  A pool of the
+	 * watcher's own if NULL.
+	 */
+	LinuxWatcher(QThreadPool * crawlPool = NULL);
 	~LinuxWatcher();
 
 	/**
@@ -40,6 +59,88 @@ public:
 	 */
 	bool supportsRecursiveWatch() const;
 
+	/**
+	 * Reads and parses whatever inotify has queued on the calling thread.  Events that don't
+	 * fit in out are kept for the next call.  Signals, subscribers and listeners still see
+	 * every event.  Must not be used while the poll thread is running.
+	 *
+	 * @see FileWatcher::drain
+	 */
+	size_t drain(FileEvent * out, size_t max, int timeout);
+
+	/**
+	 * Puts the inotify handle in non-blocking mode so that processReady() never blocks.
+	 *
+	 * @see FileWatcher::setExternalLoop
+	 */
+	bool setExternalLoop(bool external);
+
+	/**
+	 * @return The inotify handle itself - it is readable whenever events are queued.
+	 *
+	 * @see FileWatcher::readinessHandle
+	 */
+	int readinessHandle() const;
+
+	/**
+	 * Reads and parses everything queued on the calling thread.  Stops polling if reading
+	 * keeps failing.
+	 *
+	 * @see FileWatcher::processReady
+	 */
+	void processReady();
+
+	/**
+	 * Hands the watcher over to a reactor shared with other watchers, in shared loop mode,
+	 * instead of running a poll thread of its own.  The watcher must not be start()ed
+	 * afterwards.  stopPolling() takes it off the reactor again.
+	 *
+	 * @return Whether the watcher could be attached.
+	 * @see FileWatcher::setSharedLoop
+	 */
+	bool setReactor(InotifyReactor * reactor);
+
+	/**
+	 * @return A descriptor that becomes readable when a directory that appeared under a
+	 * recursive watch has been listed, or -1.  processReady() needs calling then as well.
+	 * Only used with a poll thread or a reactor - with an external loop of its own, the
+	 * watcher lists new directories inline.
+	 */
+	int crawlHandle() const;
+
+	/**
+	 * Advanced after every read from inotify.
+	 *
+	 * @see FileWatcher::generation
+	 */
+	quint64 generation() const;
+
+	/**
+	 * Walks only the branches of the watch tree with a change in them, so it costs as much as
+	 * the number of directories that changed rather than the size of the tree.  Empty if
+	 * root isn't watched.
+	 *
+	 * @see FileWatcher::changedSince
+	 */
+	QStringList changedSince(const QString & root, quint64 generation) const;
+
+	/**
+	 * Records the raw inotify stream - everything each read returns, and which paths each
+	 * watch descriptor stands for as watches come & go - for the replay plugin to play back.
+	 * Also available as the "recording" property, for callers that only have a FileWatcher.
+	 *
+	 * @param fileName Where to record, replacing whatever is there, or empty to stop.  The
+	 * recording also stops with polling.
+	 * @return Whether the recording could be started.
+	 * @see Recording
+	 */
+	bool setRecording(const QString & fileName);
+
+	/**
+	 * @return The file being recorded to, or an empty string.
+	 */
+	QString recording() const;
+
 public slots:
 	/**
 	 * Adds the watch to be monitored.  For inotify, we mimic recursion by 
@@ -47,20 +148,34 @@ public slots:
 	 *
 	 * @param path The path to monitor
 	 * @param recursive Whether or no the watch should be recursive.
-	 * @return Whether or not the watch was added successfully.  Can fail if the watch is already
-	 * being monitored.
+	 * @return Whether or not the watch was added successfully.  Adding a path that is already
+	 * watched, however it is spelt, just takes another reference to it - it then needs as
+	 * many removeWatch calls - and makes it recursive if asked to.  It keeps being reported
+	 * as the path it was first added with.  Paths leading to a directory that is already watched
+	 * under another name share the kernel watch.
 	 *
 	 * @see FileWatcher::addWatch
 	 * @see http://linux.die.net/man/1/inotifywatch For limitation about recursive watches on Linux.
 	 */
 	bool addWatch(const QString & path, bool recursive);
 
+	/**
+	 * Crawls the roots in parallel on the global thread pool.  Each directory is watched
+	 * before it is listed, so nothing created in the meantime is missed, and the lock is
+	 * only held to put each watch in place - never across a listing.  Every watch added,
+	 * however deep, is reported through the one watchesAdded signal.
+	 *
+	 * @see FileWatcher::addWatches
+	 */
+	int addWatches(const QList<WatchSpec> & specs);
+
 	/**
 	 * Removes the requested watch from being monitored.
 	 * 
 	 * @param path The path to stop watching
 	 * @return True if the watch was successfully removed, or false if it failed for some reason
-	 * (i.e. no such path is being watched).
+	 * (i.e. no such path is being watched).  Only the last reference to a path actually removes
+	 * it.
 	 *
 	 * @see FileWatcher::removeWatch
 	 */
@@ -84,27 +199,159 @@ protected:
 private:
 	/**
 	 * Used to ensure that this class accesses its data structures in a thread-safe manner.
+	 * Not taken in external loop mode.
+	 * @see FileWatcher::internalLock
+	 */
+	mutable QMutex lock;
+
+	/**
+	 * A kernel watch.  inotify hands out one watch per inode, so every path that leads to
+	 * the same directory - a duplicate root, a root inside another recursive root, a link
+	 * added as a root of its own - shares it, & its events are reported once for each of
+	 * those paths.  A crawl doesn't follow a link to a directory that is watched already.
 	 */
-	QMutex lock;
+	struct Handle
+	{
+		/**
+		 * The logical watches sharing the kernel watch, in the order they were added, by
+		 * their key in pathWatches.  Events are built from these so that they never need to
+		 * be decoded.
+		 * @see FileEvent::nativePath
+		 */
+		QList<QByteArray> nativePaths;
+	};
 
 	/**
-	 * Maps the watch handle to the path being watched.
+	 * A path being watched, however many times it was asked for.
+	 */
+	struct PathWatch
+	{
+		int handle;
+		/**
+		 * The number of addWatch calls not yet matched by a removeWatch.
+		 */
+		int refs;
+		bool recursive;
+
+		/**
+		 * What it's reported as - the path it was first added with.
+		 */
+		QString name;
+	};
+
+	/**
+	 * Maps the watch handle to the paths being watched through it.
 	 * @see inotify_event::wd
 	 */
-	QHash<int, QString> handles;
+	QHash<int, Handle> handles;
+
+	/**
+	 * Maps the path to its watch.  Keyed by the absolute, clean path in the native encoding,
+	 * so that every way of spelling a path is the same watch - and names that aren't valid
+	 * in the locale's encoding, which decode to the same string, stay apart.
+	 */
+	QHash<QByteArray, PathWatch> pathWatches;
+
+	/**
+	 * Maps the path (keyed like pathWatches) to any recursive watches held.  Each value is the root
+	 * of a set of recursive watches.  Cleared by QPointer when a parent takes its
+	 * children down with it.
+	 */
+	QHash<QByteArray, QPointer<RecursiveWatch> > recursiveWatch;
+
+	/**
+	 * Watched directories that have been deleted, waiting for the rest of their tree.  The
+	 * kernel reports deletions from the bottom up, so each directory of a tree that is
+	 * removed goes on its own - they are held until the deletions stop coming, and then
+	 * dropped from the top of each tree, so that a tree is reported with one subtreeRemoved.
+	 * @see dropDeleted
+	 */
+	QSet<QByteArray> deletedWatches;
+
+	/**
+	 * The deletions of directories in the last read.  Only touched by the poll thread.
+	 */
+	int deletionsRead;
 
 	/**
-	 * Maps the path to any recursive watches held.  Each value is the root
-	 * of a set of recursive watches.
+	 * @see generation.  Changes are stamped with the one after it, so that whatever happens
+	 * after someone has taken the current generation counts as changed since.
 	 */
-	QHash<QString, RecursiveWatch *> recursiveWatch;
+	quint64 changeGeneration;
 
 	/**
-	 * Maps cookies to watch file paths.  Used to handle inotify events that
-	 * span multiple reads.
+	 * Maps cookies to the paths the first half of a move was seen at - one per path watching
+	 * the directory.  Used to handle inotify events that span multiple reads.
 	 * @see inotify_event::cookie
 	 */
-	QHash<uint32_t, QString> cookieMap;
+	QHash<uint32_t, QList<QByteArray> > cookieMap;
+
+	/**
+	 * What a recursive crawl has been through so far.  Only covers the one crawl - a
+	 * directory already watched through another path is caught by its handle instead.
+	 * @see installWatch
+	 */
+	struct Crawl
+	{
+		/**
+		 * The device the crawl started on.
+		 * @see FileWatcher::setCrossFilesystems
+		 */
+		quint64 device;
+
+		/**
+		 * The device & inode of every directory the crawl has reached.
+		 */
+		QSet<QPair<quint64, quint64> > visited;
+	};
+
+	/**
+	 * What crawls have found, until the poll thread reports it.  Before the crawler, which
+	 * hands its listings in here until it's gone.
+	 * @see FileWatcher::setInventory
+	 */
+	InventoryStock stock;
+
+	/**
+	 * The reads from inotify so far, as numbered by the stock.  Poll thread only.
+	 */
+	quint64 readSequence;
+
+	/**
+	 * What was deleted or moved away while listings were in progress, with the read that
+	 * said so, for leaving out of the listings that raced it.  Poll thread only.
+	 */
+	QHash<QByteArray, quint64> vanished;
+
+	/**
+	 * Lists the directories that appear under recursive watches, so that the poll thread
+	 * doesn't have to.
+	 */
+	CrawlEngine crawler;
+
+	/**
+	 * A directory that appeared under a recursive watch, while its subtree is being listed.
+	 */
+	struct PendingCrawl
+	{
+		/**
+		 * The watch it appeared in.
+		 */
+		QByteArray parent;
+		QByteArray root;
+		Crawl crawl;
+
+		/**
+		 * The number of listings still to come.
+		 */
+		int listings;
+	};
+
+	/**
+	 * Keyed by the id the listings come back with.  Only touched by the poll thread.
+	 */
+	QHash<int, PendingCrawl> pendingCrawls;
+	int nextCrawl;
 
 	/**
 	 * File descriptor handle to the inotify event queue.
@@ -120,11 +367,250 @@ private:
 	volatile bool running;
 
 	/**
-	 * Returns the path that was responsible for generating the given event.
+	 * The reactor dispatching our notifications, if we don't have a poll thread.
+	 * @see setReactor
+	 */
+	InotifyReactor * volatile reactor;
+
+	/**
+	 * Number of consecutive failures to read from inotify.
+	 * @see MAX_POLL_ERRORS
+	 */
+	int errorCnt;
+
+	/**
+	 * Reused between reads so that the poll loop doesn't allocate once it has seen its
+	 * largest read.
+	 */
+	QByteArray buffer;
+
+	/**
+	 * Publishes what has been queued - through adaptive batching on the poll thread.
+	 */
+	EventBatch publish();
+
+	/**
+	 * @see setRecording
+	 */
+	Recording recorder;
+
+	/**
+	 * Appends to the recording, if there is one.  Recording stops if it can't be written.
+	 */
+	void record(Recording::Type type, int handle, const char * data, int size);
+
+	/**
+	 * The batch drain() is handing out, and how far into it the caller has got.
+	 */
+	EventBatch drained;
+	int drainPosition;
+
+	/**
+	 * Waits for the inotify handle (or a finished listing) to become readable.
+	 *
+	 * @param timeout In milliseconds, or -1 to wait forever.
+	 * @return Whether there is something to read.
+	 */
+	bool waitForEvents(int timeout);
+
+	/**
+	 * Reads everything inotify has queued and processes it.
+	 *
+	 * @param batch Receives the events published from what was read.
+	 */
+	void readEvents(EventBatch & batch);
+
+	/**
+	 * Translates raw inotify records into signals and published events.  Watches being
+	 * removed along the way don't interrupt it.
+	 *
+	 * @see readEvents
+	 */
+	void processEvents(char * data, int size, EventBatch & batch);
+
+	/**
+	 * Returns the path that was responsible for generating the given event, as raw bytes.
 	 *
 	 * @see inotify_event::name
 	 */
-	QString getName(struct inotify_event * event);
+	QByteArray getName(struct inotify_event * event);
+
+	/**
+	 * A directory found while crawling a root of an addWatches batch.
+	 */
+	struct PlannedWatch
+	{
+		QString path;
+		QByteArray nativePath;
+
+		/**
+		 * The index of the directory it was found in, or -1 for the root.
+		 */
+		int parent;
+	};
+
+	/**
+	 * A root of an addWatches batch & what came of it.
+	 */
+	struct WatchPlan
+	{
+		WatchSpec spec;
+
+		/**
+		 * What went wrong, for the calling thread to report.
+		 */
+		QString error;
+
+		/**
+		 * Whether the root is watched.
+		 */
+		bool watched;
+
+		/**
+		 * The paths watched for the first time.
+		 */
+		QList<QString> added;
+
+		Crawl crawl;
+
+		/**
+		 * Parents always come before their children.
+		 */
+		QList<PlannedWatch> watches;
+	};
+
+	friend class PlanRunner;
+
+	/**
+	 * Watches a root of an addWatches batch & crawls it, breadth first.  Takes the lock for
+	 * each watch, so that roots can be crawled on any number of threads at once.  Emits
+	 * nothing - that's left to the calling thread.
+	 */
+	void addTree(WatchPlan & plan);
+
+	/**
+	 * Puts a single watch in place & indexes it, without reporting it.  The lock must be held.
+	 *
+	 * @param name What the watch is reported as.
+	 * @param reached Whether a crawl got to the directory, rather than it being asked for.
+	 * Such a directory is left alone if it is already watched under another path, which is
+	 * what keeps a link to an ancestor from having the whole tree watched again - whichever
+	 * crawl it turns up in.
+	 * @return The watch's node, or NULL if inotify refused it (errno says why) or, with
+	 * errno set to EEXIST, if it was reached & is already watched.
+	 */
+	RecursiveWatch * installWatch(const QString & name, const QByteArray & nativePath, bool recursive, RecursiveWatch * parent, bool reached);
+
+	/**
+	 * @return Whether new directories are listed by the crawler rather than inline.
+	 */
+	bool crawlsAsynchronously() const;
+
+	/**
+	 * Follows something created under a recursive watch, if it's a directory.  A directory
+	 * is watched straight away & its contents once they have been listed - in the background
+	 * if possible.
+	 *
+	 * @param parentPath The recursive watch it was created in.
+	 * @param isDirectory Whether inotify said so.  If not, it may still be a link to one.
+	 */
+	void watchCreated(const QByteArray & parentPath, const QByteArray & nativePath, bool isDirectory);
+
+	/**
+	 * Watches a directory found by an asynchronous crawl & reports it.  The lock must be held.
+	 *
+	 * @return The watch's node, or NULL if it's already watched, its parent has gone or
+	 * inotify refused it.
+	 */
+	RecursiveWatch * installCrawled(const QByteArray & parentPath, const QByteArray & nativePath);
+
+	/**
+	 * Installs the watches for whatever the crawler has listed, and has the new directories
+	 * listed in turn.  Poll thread only.
+	 */
+	void applyListings();
+
+	/**
+	 * Lists the directories in a directory, following links according to the symlink
+	 * policy.
+	 *
+	 * @param others If not NULL, receives everything else in the directory.
+	 */
+	void listChildren(const QByteArray & nativePath, QList<QByteArray> & children, QList<QByteArray> * others = NULL) const;
+
+	/**
+	 * listChildren(), adding everything in the directory to the stock if the inventory is
+	 * reported, and waking the poll thread up to report it.  Nothing is held meanwhile.
+	 */
+	void listStocked(const QByteArray & nativePath, QList<QByteArray> & children);
+
+	/**
+	 * Queues the inventory waiting to be reported.  Poll thread only, before it reads.
+	 *
+	 * @return Whether there was any.
+	 */
+	bool queueInventory();
+
+	/**
+	 * @return What the crawler's listings are stocked in - NULL unless the inventory is
+	 * reported.
+	 */
+	InventoryStock * crawlStock();
+
+	/**
+	 * Remembers that something was deleted or moved away, if any listing may have raced it.
+	 * Poll thread only.
+	 */
+	void vanish(const QByteArray & nativePath);
+
+	/**
+	 * @return Whether the path, or a directory above it, is gone according to a read after
+	 * the one given.
+	 */
+	bool vanishedSince(const QByteArray & nativePath, quint64 read) const;
+
+	/**
+	 * addWatch() for a path that is already absolute & encoded, so that paths taken from
+	 * the file system never have to go through QString.
+	 *
+	 * @param path What the watch is known as - reported in watchAdded & used by removeWatch.
+	 * @param nativePath The absolute path in the native encoding.
+	 * @param crawl The crawl that reached the path, or NULL if the path starts one.
+	 * @return False as well if the crawl has already been through the directory or isn't
+	 * allowed into it.
+	 */
+	bool addNativeWatch(const QString & path, const QByteArray & nativePath, bool recursive, Crawl * crawl = NULL);
+
+	/**
+	 * Adds recursive watches for the directories under a watched directory.  Releases the
+	 * lock while listing them & while adding each one.
+	 */
+	void watchChildren(const QByteArray & nativePath, Crawl & crawl, QMutexLocker & locker);
+
+	/**
+	 * Drops the deleted watches, a tree at a time.  The lock must be held.  Also called
+	 * before a deleted path is watched again, since its old watch is still in the indexes.
+	 */
+	void dropDeleted();
+
+	/**
+	 * Removes a watch along with the recursive watches under it, in one pass over the
+	 * subtree, and reports them with a single subtreeRemoved (or watchRemoved if there is
+	 * only the one).  The lock must be held.
+	 *
+	 * @param force Whether the directory is gone, so that every path goes however many
+	 * references it has.  Otherwise directories under the root that were added on their
+	 * own as well stay, subtree included.
+	 * @param root Its key in pathWatches.
+	 * @return Whether every kernel watch could be removed.
+	 */
+	bool dropTree(const QByteArray & root, bool force);
+
+	/**
+	 * Removes a path from the indexes.  The kernel watch goes once no other path shares it.
+	 * Doesn't report anything or touch the tree of recursive watches.
+	 */
+	bool unwatch(const QByteArray & path, bool force);
 
 private slots:
 	/**
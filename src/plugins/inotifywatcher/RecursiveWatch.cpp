@@ -11,7 +11,9 @@
 //
 #include "RecursiveWatch.h"
 
-RecursiveWatch::RecursiveWatch(QString watchPath, RecursiveWatch * parent_) : parent(parent_), watch(watchPath)
+#include <QFile>
+
+RecursiveWatch::RecursiveWatch(const QByteArray & watchPath, RecursiveWatch * parent_) : parent(parent_), watch(watchPath), changed(0), subtreeChanged(0)
 {
 	if (parent != NULL)
 	{
@@ -23,19 +25,16 @@ RecursiveWatch::~RecursiveWatch()
 {
 	if (parent != NULL)
 	{
-		int numRemoved = parent->children.removeAll(this);
-#ifdef _DEBUG
-		QByteArray assertMsg = ("Parent had " + QString::number(numRemoved) + " references to this class, instead of 1").toAscii();
-		Q_ASSERT_X(numRemoved == 1, "RecursiveWatch removal", assertMsg.data());
-#else
-		Q_ASSERT(numRemoved == 1);
-#endif
+		bool removed = parent->children.remove(this);
+		Q_ASSERT_X(removed, "RecursiveWatch removal", "Parent had no reference to this class");
 	}
 
-	while (!children.isEmpty())
+	QSet<RecursiveWatch *> doomed = children;
+	children.clear();
+	foreach(RecursiveWatch * child, doomed)
 	{
-		QPointer<RecursiveWatch> child = children.takeLast();
-		Q_ASSERT_X(child != NULL, "Removing recursive watch", "child was null - should've removed itself when it was deleted instead");
+		// already out of our children, so it doesn't need to look for itself there
+		child->parent = NULL;
 		delete child;
 	}
 }
@@ -44,17 +43,69 @@ void RecursiveWatch::addChild(RecursiveWatch * child)
 {
 	Q_ASSERT(child != NULL);
 	Q_ASSERT(child->parent == NULL || child->parent == this);
-	if (!children.contains(child))
+	if (child != NULL)
 	{
-		children += child;
-		if (child)
+		children.insert(child);
+		child->parent = this;
+
+		// whatever changed in it before it was linked in changed under its new ancestors too
+		for (RecursiveWatch * node = this; node != NULL && node->subtreeChanged < child->subtreeChanged; node = node->parent)
 		{
-			child->parent = this;
+			node->subtreeChanged = child->subtreeChanged;
 		}
 	}
 }
 
-bool RecursiveWatch::operator==(const QString & other)
+void RecursiveWatch::removeChild(RecursiveWatch * child)
+{
+	Q_ASSERT(child != NULL && child->parent == this);
+	if (children.remove(child))
+	{
+		child->parent = NULL;
+	}
+}
+
+const QByteArray & RecursiveWatch::path() const
+{
+	return watch;
+}
+
+const QSet<RecursiveWatch *> & RecursiveWatch::childWatches() const
+{
+	return children;
+}
+
+RecursiveWatch * RecursiveWatch::parentWatch() const
+{
+	return parent;
+}
+
+void RecursiveWatch::touch(quint64 generation)
+{
+	changed = generation;
+	for (RecursiveWatch * node = this; node != NULL && node->subtreeChanged < generation; node = node->parent)
+	{
+		node->subtreeChanged = generation;
+	}
+}
+
+void RecursiveWatch::changedSince(quint64 generation, QStringList & result) const
+{
+	if (subtreeChanged <= generation)
+	{
+		return;
+	}
+	if (changed > generation)
+	{
+		result += QFile::decodeName(watch);
+	}
+	foreach(RecursiveWatch * child, children)
+	{
+		child->changedSince(generation, result);
+	}
+}
+
+bool RecursiveWatch::operator==(const QByteArray & other)
 {
 	return watch == other;
 }
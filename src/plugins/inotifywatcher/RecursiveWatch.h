@@ -11,8 +11,10 @@
 // Copyright: See COPYING file that comes with this distribution
 //
 //
-#include <QList>
+#include <QSet>
+#include <QByteArray>
 #include <QString>
+#include <QStringList>
 #include <QPointer>
 #include <QObject>
 
@@ -23,17 +25,67 @@ class RecursiveWatch : public QObject
 {
 	Q_OBJECT
 public:
-	RecursiveWatch(QString watchPath, RecursiveWatch * parent = NULL);
+	/**
+	 * @param watchPath The absolute path of the directory, in the native encoding.
+	 */
+	RecursiveWatch(const QByteArray & watchPath, RecursiveWatch * parent = NULL);
+
+	/**
+	 * Takes the whole subtree with it.
+	 */
 	~RecursiveWatch();
+
+	/**
+	 * Links a child in, along with the changes already stamped on its subtree.
+	 */
 	void addChild(RecursiveWatch * child);
 
-	bool operator==(const QString & other);
+	/**
+	 * Detaches a child without deleting it - it becomes the root of its own tree.
+	 */
+	void removeChild(RecursiveWatch * child);
+
+	const QByteArray & path() const;
+	const QSet<RecursiveWatch *> & childWatches() const;
+
+	/**
+	 * @return NULL for the root of a tree.
+	 */
+	RecursiveWatch * parentWatch() const;
+
+	/**
+	 * Marks something in this directory as having changed in the given generation, along
+	 * with the subtree of each of its ancestors.  Stops at the first ancestor that already
+	 * knows, so a generation costs each directory at most once however many events it has.
+	 *
+	 * @param generation Never less than one touched before.
+	 */
+	void touch(quint64 generation);
+
+	/**
+	 * Collects the directories in this subtree with a change after the given generation,
+	 * decoded.  Only descends into subtrees that have one.
+	 */
+	void changedSince(quint64 generation, QStringList & changed) const;
+
+	bool operator==(const QByteArray & other);
 	bool operator==(const RecursiveWatch & other);
 
 private:
 	QPointer<RecursiveWatch> parent;
-	QString watch;
-	QList<QPointer<RecursiveWatch> > children;
+	QByteArray watch;
+
+	/**
+	 * A set so that a child leaving a parent with many children stays cheap.  Children always
+	 * leave their parent before they go, so these never dangle.
+	 */
+	QSet<RecursiveWatch *> children;
+
+	/**
+	 * The generation of the last change in this directory, and in this whole subtree.
+	 */
+	quint64 changed;
+	quint64 subtreeChanged;
 };
 
 #endif /* RECURSIVE_WATCH_H_ */
@@ -6,10 +6,16 @@ include(../../global.pri)
 
 SOURCES += LinuxWatcher.cpp \
  RecursiveWatch.cpp \
+ CrawlEngine.cpp \
+ InventoryStock.cpp \
+ InotifyReactor.cpp \
  InotifyFactory.cpp
 
 HEADERS += LinuxWatcher.h \
  RecursiveWatch.h \
+ CrawlEngine.h \
+ InventoryStock.h \
+ InotifyReactor.h \
  InotifyFactory.h
 
 LIBS += -lfnotify
@@ -1,2 +1,2 @@
 TEMPLATE = subdirs
-SUBDIRS += inotifywatcher test
+SUBDIRS += inotifywatcher replaywatcher test
@@ -0,0 +1,23 @@
+//
+// C++ Implementation: ReplayFactory
+//
+// Description:
+//
+//
+// Author: Vitali Lovich <vlovich@gmail.com>, (C) 2008
+//
+// Copyright: See COPYING file that comes with this distribution
+//
+//
+#include "ReplayFactory.h"
+
+#include <QtPlugin>
+
+#include "ReplayWatcher.h"
+
+FileWatcher * ReplayFactory::createWatcherImpl()
+{
+	return new ReplayWatcher();
+}
+
+Q_EXPORT_PLUGIN2(replaywatcher, ReplayFactory);
@@ -0,0 +1,33 @@
+#ifndef REPLAY_FACTORY_H_
+#define REPLAY_FACTORY_H_
+//
+// C++ Interface: ReplayFactory
+//
+// Description:
+//
+//
+// Author: Vitali Lovich <vlovich@gmail.com>, (C) 2008
+//
+// Copyright: See COPYING file that comes with this distribution
+//
+//
+#include <QObject>
+#include <core/WatcherFactory.h>
+
+/**
+ * Creates watchers that play back a recording instead of watching the file system (@see
+ * ReplayWatcher), for load testing consumers with the same events every time.  Meant to
+ * be loaded in place of the real plugin - WatcherFactory::getInstance takes the first
+ * plugin it finds, so this one is built into the replay directory under the real one's,
+ * and is loaded with getInstance("<plugin directory>/replay").
+ */
+class ReplayFactory : public QObject, public WatcherFactory
+{
+	Q_OBJECT
+	Q_INTERFACES(WatcherFactory);
+
+protected:
+	FileWatcher * createWatcherImpl();
+};
+
+#endif /* REPLAY_FACTORY_H_ */
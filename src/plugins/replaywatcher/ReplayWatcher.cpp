@@ -0,0 +1,461 @@
+//
+// C++ Implementation: ReplayWatcher
+//
+// Description:
+//
+//
+// Author: Vitali Lovich <vlovich@gmail.com>, (C) 2008
+//
+// Copyright: See COPYING file that comes with this distribution
+//
+//
+#include "ReplayWatcher.h"
+
+#include <QFile>
+#include <QDir>
+#include <QMutexLocker>
+#include <QCoreApplication>
+
+#include <sys/inotify.h>
+
+/**
+ * How long, in milliseconds, the poll thread waits for a read to be due before checking
+ * whether it has been asked to stop.
+ */
+#ifndef POLL_INTERVAL
+#define POLL_INTERVAL 500
+#endif /* POLL_INTERVAL */
+
+#define BIT_SET(number, bit) ( ( (number) & (bit) ) != 0 )
+
+/**
+ * @return The path of the file an event is about, the same way LinuxWatcher builds it.
+ */
+static QByteArray eventNativePath(const QByteArray & basePath, const struct inotify_event * event)
+{
+	int length = event->len == 0 ? 0 : qstrnlen(event->name, event->len);
+	while (length > 0 && event->name[length - 1] == 3)
+	{
+		--length;
+	}
+	if (length == 0)
+	{
+		return basePath;
+	}
+
+	QByteArray path;
+	path.reserve(basePath.size() + 1 + length);
+	path += basePath;
+	if (!basePath.endsWith('/'))
+	{
+		path += '/';
+	}
+	path.append(event->name, length);
+	return path;
+}
+
+/**
+ * @return The path as it's compared to the recorded ones.
+ */
+static QByteArray rootPath(const QString & path)
+{
+	QByteArray root = QFile::encodeName(QDir::cleanPath(path));
+	if (root.size() > 1 && root.endsWith('/'))
+	{
+		root.chop(1);
+	}
+	return root;
+}
+
+ReplayWatcher::ReplayWatcher()
+	: playSpeed(1), running(false), haveNext(false), started(false), recordedStart(0), playedStart(0), signalled(0), drainPosition(0)
+{
+}
+
+ReplayWatcher::~ReplayWatcher()
+{
+	stopPolling();
+	wait();
+}
+
+bool ReplayWatcher::supportsRecursiveWatch() const
+{
+	return true;
+}
+
+bool ReplayWatcher::setTrace(const QString & fileName)
+{
+	if (running)
+	{
+		return false;
+	}
+
+	handles.clear();
+	cookieMap.clear();
+	haveNext = false;
+	started = false;
+	drained = EventBatch();
+	drainPosition = 0;
+	if (!recording.open(fileName))
+	{
+		emit error("Unable to play " + fileName + ": not a recording, or " + recording.errorString());
+		return false;
+	}
+	return true;
+}
+
+QString ReplayWatcher::trace() const
+{
+	return recording.isOpen() ? recording.fileName() : QString();
+}
+
+void ReplayWatcher::setSpeed(double speed)
+{
+	playSpeed = qMax(speed, 0.0);
+	// pace from wherever the recording has got to
+	started = false;
+}
+
+double ReplayWatcher::speed() const
+{
+	return playSpeed;
+}
+
+bool ReplayWatcher::addWatch(const QString & path, bool recursive)
+{
+	bool added;
+	{
+		QMutexLocker locker(internalLock(&rootsLock));
+		QByteArray root = rootPath(path);
+		added = !roots.contains(root);
+		bool & watched = roots[root];
+		watched = watched || recursive;
+	}
+	// reported once, like the single removeWatch that takes it away
+	if (added)
+	{
+		emit watchAdded(path);
+	}
+	return true;
+}
+
+bool ReplayWatcher::removeWatch(const QString & path)
+{
+	{
+		QMutexLocker locker(internalLock(&rootsLock));
+		if (roots.remove(rootPath(path)) == 0)
+		{
+			return false;
+		}
+	}
+	emit watchRemoved(path);
+	return true;
+}
+
+void ReplayWatcher::stopPolling()
+{
+	running = false;
+	pollingStopped();
+}
+
+void ReplayWatcher::poll()
+{
+	running = true;
+
+	while (running && readNext())
+	{
+		QCoreApplication::sendPostedEvents();
+		// wakes up in time for whatever adaptive batching is holding back
+		if (!waitForNext(publishTimeout(POLL_INTERVAL)))
+		{
+			publishEvents();
+		}
+		else if (running)
+		{
+			EventBatch batch;
+			playNext(batch);
+		}
+	}
+
+	flushEvents();
+	stopPolling();
+}
+
+size_t ReplayWatcher::drain(FileEvent * out, size_t max, int timeout)
+{
+	Q_ASSERT_X(!running, "draining a replay", "the poll thread owns the recording while it is running");
+
+	if (drainPosition >= drained.size())
+	{
+		drained = EventBatch();
+		drainPosition = 0;
+
+		// a read may well publish nothing (events outside the watched paths) - keep going
+		// until the timeout is up
+		quint64 deadline = timeout < 0 ? 0 : monotonicNanos() + (quint64)timeout * 1000000;
+		while (drained.isEmpty())
+		{
+			int remaining = -1;
+			if (timeout >= 0)
+			{
+				quint64 now = monotonicNanos();
+				remaining = now >= deadline ? 0 : (int)((deadline - now + 999999) / 1000000);
+			}
+			if (!readNext() || !waitForNext(remaining))
+			{
+				return 0;
+			}
+			playNext(drained);
+			if (remaining == 0 && drained.isEmpty())
+			{
+				return 0;
+			}
+		}
+	}
+
+	size_t count = 0;
+	while (count < max && drainPosition < drained.size())
+	{
+		out[count++] = drained.at(drainPosition++);
+	}
+	return count;
+}
+
+bool ReplayWatcher::readNext()
+{
+	if (haveNext)
+	{
+		return true;
+	}
+
+	Recording::Record record;
+	while (recording.isOpen() && recording.read(record))
+	{
+		switch (record.type)
+		{
+			case Recording::WatchAdded:
+				handles[record.handle] += record.data;
+				break;
+			case Recording::WatchRemoved:
+			{
+				QList<QByteArray> & paths = handles[record.handle];
+				int index = paths.indexOf(record.data);
+				if (index != -1)
+				{
+					paths.removeAt(index);
+				}
+				if (paths.isEmpty())
+				{
+					handles.remove(record.handle);
+				}
+				break;
+			}
+			case Recording::NativeEvents:
+				next = record;
+				haveNext = true;
+				return true;
+			default:
+				// written by a later version - whatever it is, it isn't needed to play
+				break;
+		}
+	}
+	return false;
+}
+
+bool ReplayWatcher::waitForNext(int timeout)
+{
+	Q_ASSERT(haveNext);
+	quint64 now = monotonicNanos();
+	if (!started)
+	{
+		started = true;
+		recordedStart = next.timestamp;
+		playedStart = now;
+	}
+	if (playSpeed <= 0 || next.timestamp <= recordedStart)
+	{
+		return true;
+	}
+
+	quint64 due = playedStart + (quint64)((next.timestamp - recordedStart) / playSpeed);
+	if (due <= now)
+	{
+		return true;
+	}
+	quint64 wait = (due - now + 999999) / 1000000;
+	if (timeout >= 0 && wait > (quint64)timeout)
+	{
+		msleep(timeout);
+		return false;
+	}
+	msleep(wait);
+	return true;
+}
+
+void ReplayWatcher::playNext(EventBatch & batch)
+{
+	static const size_t EVENT_SIZE = sizeof(struct inotify_event);
+	Q_ASSERT(haveNext);
+	haveNext = false;
+
+	const QByteArray & data = next.data;
+	counters.reads.add();
+	counters.bytesRead.add(data.size());
+	counters.largestRead.setMax(data.size());
+	readCompleted(monotonicNanos());
+
+	// decoding paths for signals nobody is connected to would be wasted effort
+	signalled = 0;
+	if (receivers(SIGNAL(newChild(QString))) > 0)
+	{
+		signalled |= FileEvent::Created;
+	}
+	if (receivers(SIGNAL(deleted(QString))) > 0)
+	{
+		signalled |= FileEvent::Deleted;
+	}
+	if (receivers(SIGNAL(moved(QString))) > 0)
+	{
+		signalled |= FileEvent::MovedSelf;
+	}
+	if (receivers(SIGNAL(moved(QString,QString))) > 0)
+	{
+		signalled |= FileEvent::Moved;
+	}
+	if (receivers(SIGNAL(modified(QString))) > 0)
+	{
+		signalled |= FileEvent::Modified;
+	}
+
+	const struct inotify_event * event;
+	for (int i = 0; (size_t)i + EVENT_SIZE <= (size_t)data.size(); i += EVENT_SIZE + event->len)
+	{
+		event = (const struct inotify_event *)(data.constData() + i);
+		if ((size_t)i + EVENT_SIZE + event->len > (size_t)data.size())
+		{
+			emit error("Recording is corrupt - an event runs past the end of its read");
+			break;
+		}
+
+		if (BIT_SET(event->mask, IN_Q_OVERFLOW))
+		{
+			counters.overflows.add();
+			emit error("Inotify event queue overflowed while recording - events were lost");
+			continue;
+		}
+		if (BIT_SET(event->mask, IN_IGNORED))
+		{
+			handles.remove(event->wd);
+			continue;
+		}
+
+		QList<QByteArray> owners = handles.value(event->wd);
+		QList<QByteArray> nativePaths;
+		foreach(const QByteArray & owner, owners)
+		{
+			nativePaths += eventNativePath(owner, event);
+		}
+
+		foreach(const QByteArray & nativePath, nativePaths)
+		{
+			if (BIT_SET(event->mask, IN_CREATE))
+			{
+				deliver(FileEvent::Created, nativePath);
+			}
+			if (BIT_SET(event->mask, IN_DELETE | IN_DELETE_SELF))
+			{
+				deliver(FileEvent::Deleted, nativePath);
+			}
+			if (BIT_SET(event->mask, IN_MOVE_SELF))
+			{
+				deliver(FileEvent::MovedSelf, nativePath);
+			}
+			if (BIT_SET(event->mask, IN_MODIFY))
+			{
+				deliver(FileEvent::Modified, nativePath);
+			}
+		}
+
+		if (BIT_SET(event->mask, IN_MOVED_TO | IN_MOVED_FROM) && !nativePaths.isEmpty())
+		{
+			QList<QByteArray> otherPaths = cookieMap.take(event->cookie);
+			if (otherPaths.isEmpty())
+			{
+				cookieMap.insert(event->cookie, nativePaths);
+				continue;
+			}
+			// paired up path by path, like LinuxWatcher does
+			int pairs = qMax(otherPaths.size(), nativePaths.size());
+			for (int pair = 0; pair < pairs; ++pair)
+			{
+				const QByteArray & nativePath = nativePaths.at(qMin(pair, nativePaths.size() - 1));
+				const QByteArray & otherPath = otherPaths.at(qMin(pair, otherPaths.size() - 1));
+				if (BIT_SET(event->mask, IN_MOVED_TO))
+				{
+					deliver(FileEvent::Moved, otherPath, nativePath);
+				}
+				else
+				{
+					deliver(FileEvent::Moved, nativePath, otherPath);
+				}
+			}
+		}
+	}
+	counters.unpairedMoves.set(cookieMap.size());
+	batch = running ? publishEvents() : flushEvents();
+}
+
+void ReplayWatcher::deliver(FileEvent::Type type, const QByteArray & nativePath, const QByteArray & nativeOtherPath)
+{
+	if (!isWatched(nativePath) && (nativeOtherPath.isEmpty() || !isWatched(nativeOtherPath)))
+	{
+		return;
+	}
+
+	if (BIT_SET(signalled, type))
+	{
+		QString path = QFile::decodeName(nativePath);
+		switch (type)
+		{
+			case FileEvent::Created:
+				emit newChild(path);
+				break;
+			case FileEvent::Deleted:
+				emit deleted(path);
+				break;
+			case FileEvent::MovedSelf:
+				emit moved(path);
+				break;
+			case FileEvent::Moved:
+				emit moved(path, QFile::decodeName(nativeOtherPath));
+				break;
+			case FileEvent::Modified:
+				emit modified(path);
+				break;
+			default:
+				break;
+		}
+	}
+	queueEvent(type, nativePath, nativeOtherPath);
+}
+
+bool ReplayWatcher::isWatched(const QByteArray & nativePath)
+{
+	QMutexLocker locker(internalLock(&rootsLock));
+	if (roots.contains(nativePath))
+	{
+		return true;
+	}
+	// the parent may be watched either way, anything further up only recursively
+	int slash = nativePath.lastIndexOf('/');
+	for (bool parent = true; slash != -1; parent = false)
+	{
+		QHash<QByteArray, bool>::const_iterator root = roots.constFind(slash == 0 ? QByteArray("/") : nativePath.left(slash));
+		if (root != roots.constEnd() && (parent || root.value()))
+		{
+			return true;
+		}
+		slash = slash == 0 ? -1 : nativePath.lastIndexOf('/', slash - 1);
+	}
+	return false;
+}
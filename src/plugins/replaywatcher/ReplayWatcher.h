@@ -0,0 +1,177 @@
+#ifndef REPLAY_WATCHER_H_
+#define REPLAY_WATCHER_H_
+//
+// C++ Interface: ReplayWatcher
+//
+// Description:
+//
+//
+// Author: Vitali Lovich <vlovich@gmail.com>, (C) 2008
+//
+// Copyright: See COPYING file that comes with this distribution
+//
+//
+#include <core/FileWatcher.h>
+#include <core/EventBatch.h>
+#include <core/Recording.h>
+
+#include <QHash>
+#include <QList>
+#include <QByteArray>
+#include <QMutex>
+
+/**
+ * Plays back an inotify recording (@see LinuxWatcher::setRecording) instead of watching the
+ * file system, so that a consumer can be benchmarked against the same event storm as often
+ * as needed.  The events are parsed the way LinuxWatcher parses them and delivered the same
+ * ways - signals, subscribers, listeners, batches and drain().  Nothing on disk is looked at,
+ * so the recorded paths don't need to exist.
+ *
+ * Configured through properties, so that callers that only have a FileWatcher can use it:
+ * "trace" is the recording to play & "speed" how fast.  Polling stops at the end of the
+ * recording.
+ */
+class ReplayWatcher : public FileWatcher
+{
+	Q_OBJECT
+	Q_PROPERTY(QString trace READ trace WRITE setTrace)
+	Q_PROPERTY(double speed READ speed WRITE setSpeed)
+
+public:
+	ReplayWatcher();
+	~ReplayWatcher();
+
+	/**
+	 * Every recorded event is there already - recursive watches just let more of them through.
+	 */
+	bool supportsRecursiveWatch() const;
+
+	/**
+	 * Opens a recording to play from the start.  Can't be changed while polling.
+	 *
+	 * @return Whether it could be opened.
+	 */
+	bool setTrace(const QString & fileName);
+	QString trace() const;
+
+	/**
+	 * @param speed How much faster than it was recorded to play - 1 for real time, 2 for
+	 * twice as fast - or 0 to play as fast as the consumer keeps up.  1 by default.
+	 */
+	void setSpeed(double speed);
+	double speed() const;
+
+	/**
+	 * Plays the next read of the recording on the calling thread, once it's due.  Must not
+	 * be used while the poll thread is running.
+	 *
+	 * @return 0 on timeout or at the end of the recording.
+	 * @see FileWatcher::drain
+	 */
+	size_t drain(FileEvent * out, size_t max, int timeout);
+
+public slots:
+	/**
+	 * Lets through the events for the path - and for everything under it if recursive - that
+	 * the recording has.  Always succeeds.
+	 *
+	 * @see FileWatcher::addWatch
+	 */
+	bool addWatch(const QString & path, bool recursive);
+
+	/**
+	 * @see FileWatcher::removeWatch
+	 */
+	bool removeWatch(const QString & path);
+
+	/**
+	 * The poll thread stops before playing its next read.
+	 *
+	 * @see FileWatcher::stopPolling
+	 */
+	void stopPolling();
+
+protected:
+	/**
+	 * Plays the recording until it ends or polling is stopped.
+	 *
+	 * @see FileWatcher::poll
+	 */
+	void poll();
+
+private:
+	Recording recording;
+
+	double playSpeed;
+
+	volatile bool running;
+
+	/**
+	 * The watched paths, native & without a trailing slash, and whether they are recursive.
+	 */
+	QHash<QByteArray, bool> roots;
+	QMutex rootsLock;
+
+	/**
+	 * The paths each recorded watch descriptor stands for, as of the read being played.
+	 */
+	QHash<int, QList<QByteArray> > handles;
+
+	/**
+	 * The first half of each move, until its second half is played.
+	 */
+	QHash<quint32, QList<QByteArray> > cookieMap;
+
+	/**
+	 * The read to play next, once it is due.
+	 */
+	Recording::Record next;
+	bool haveNext;
+
+	/**
+	 * When the first read was recorded & when it was played, to pace the rest by.
+	 */
+	bool started;
+	quint64 recordedStart;
+	quint64 playedStart;
+
+	/**
+	 * Which FileEvent types have signals connected, for the read being played.
+	 */
+	int signalled;
+
+	/**
+	 * @see drain
+	 */
+	EventBatch drained;
+	int drainPosition;
+
+	/**
+	 * Reads up to the next read in the recording, applying the watch table on the way.
+	 *
+	 * @return False at the end of the recording.
+	 */
+	bool readNext();
+
+	/**
+	 * Waits until the next read is due.
+	 *
+	 * @param timeout In milliseconds, or -1 to wait as long as it takes.
+	 * @return Whether it is due.
+	 */
+	bool waitForNext(int timeout);
+
+	/**
+	 * Parses the next read & publishes what it holds as a batch.
+	 */
+	void playNext(EventBatch & batch);
+
+	/**
+	 * Queues & signals the event if it is for a watched path.
+	 */
+	void deliver(FileEvent::Type type, const QByteArray & nativePath, const QByteArray & nativeOtherPath = QByteArray());
+
+	bool isWatched(const QByteArray & nativePath);
+};
+
+#endif /* REPLAY_WATCHER_H_ */
@@ -0,0 +1,18 @@
+PROJECT = replaywatcher
+TEMPLATE = lib
+CONFIG += plugin
+
+include(../../global.pri)
+
+# kept apart from the real plugin, which WatcherFactory::getInstance would find first
+DESTDIR = $$DESTDIR/replay
+
+SOURCES += ReplayWatcher.cpp \
+ ReplayFactory.cpp
+
+HEADERS += ReplayWatcher.h \
+ ReplayFactory.h
+
+LIBS += -lfnotify
+
+DEPENDPATH += ../../core
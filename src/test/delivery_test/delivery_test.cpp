@@ -0,0 +1,370 @@
+//
+// C++ Implementation: delivery_test
+//
+// Description: Checks what the queue behind nextBatch() does once consumers fall behind,
+// and how the poll loop batches as the load changes.
+//
+//
+// Author: Vitali Lovich <vlovich@gmail.com>, (C) 2008
+//
+// Copyright: See COPYING file that comes with this distribution
+//
+//
+
+#include <QThread>
+#include <QtDebug>
+
+#include <core/BatchQueue.h>
+#include <core/FileWatcher.h>
+#include <core/DeliveryController.h>
+
+static EventBatch makeBatch(FileEvent::Type type, const char * path, const char * otherPath = "")
+{
+	QVector<FileEvent> events;
+	events += FileEvent(type, QByteArray(path), QByteArray(otherPath));
+	return EventBatch(events);
+}
+
+static EventBatch makeBatch(int count, const char * prefix)
+{
+	QVector<FileEvent> events;
+	for (int i = 0; i < count; ++i)
+	{
+		events += FileEvent(FileEvent::Modified, QByteArray(prefix) + QByteArray::number(i));
+	}
+	return EventBatch(events);
+}
+
+/**
+ * Takes batches off the queue, slowly, until it's cancelled & empty.
+ */
+class SlowConsumer : public QThread
+{
+public:
+	SlowConsumer(BatchQueue & queue_, int delayMs_) : queue(queue_), delayMs(delayMs_), events(0)
+	{
+	}
+
+	int taken() const
+	{
+		return events;
+	}
+
+protected:
+	void run()
+	{
+		for (;;)
+		{
+			EventBatch batch = queue.pop(-1);
+			if (batch.isEmpty())
+			{
+				return;
+			}
+			events += batch.size();
+			msleep(delayMs);
+		}
+	}
+
+private:
+	BatchQueue & queue;
+	int delayMs;
+	int events;
+};
+
+static void testBlock()
+{
+	BatchQueue queue;
+	queue.setLimits(10, 0, BatchQueue::Block);
+	SlowConsumer consumer(queue, 20);
+	consumer.start();
+
+	quint64 blocked = 0;
+	for (int i = 0; i < 20; ++i)
+	{
+		BatchQueue::Overflow overflow;
+		queue.push(makeBatch(5, "/block/"), true, &overflow);
+		Q_ASSERT(overflow.dropped == 0);
+		Q_ASSERT(overflow.coalesced == 0);
+		blocked += overflow.blockedNanos;
+	}
+	// the producer is much faster than the consumer, so it must have waited for room
+	Q_ASSERT(blocked > 0);
+	Q_ASSERT(queue.peakEvents() <= 10);
+
+	// what's queued is still taken once cancelled
+	queue.cancel();
+	consumer.wait();
+	Q_ASSERT(consumer.taken() == 100);
+	Q_ASSERT(queue.queuedBytes() == 0);
+
+	// the consumer's own thread can't wait for itself - it coalesces instead, and drops
+	// what it can't merge
+	BatchQueue self;
+	self.setLimits(1, 0, BatchQueue::Block);
+	self.push(makeBatch(1, "/self/"));
+	BatchQueue::Overflow overflow;
+	self.push(makeBatch(1, "/self/"), false, &overflow);
+	Q_ASSERT(overflow.blockRefused);
+	Q_ASSERT(overflow.coalesced == 1);
+	Q_ASSERT(overflow.dropped == 0);
+	Q_ASSERT(overflow.blockedNanos == 0);
+	Q_ASSERT(self.queuedEvents() == 1);
+
+	overflow = BatchQueue::Overflow();
+	self.push(makeBatch(1, "/other/"), false, &overflow);
+	Q_ASSERT(overflow.blockRefused);
+	Q_ASSERT(overflow.dropped == 1);
+	Q_ASSERT(self.queuedEvents() == 1);
+}
+
+static void testCoalesce()
+{
+	BatchQueue queue;
+	queue.setLimits(3, 0, BatchQueue::Coalesce);
+
+	queue.push(makeBatch(FileEvent::Modified, "/a"));
+	queue.push(makeBatch(FileEvent::Deleted, "/a"));
+
+	// the first repeats nothing (a was deleted since), the second repeats the first
+	QVector<FileEvent> again;
+	again += FileEvent(FileEvent::Modified, QByteArray("/a"));
+	again += FileEvent(FileEvent::Modified, QByteArray("/a"));
+	BatchQueue::Overflow overflow;
+	queue.push(EventBatch(again), true, &overflow);
+	Q_ASSERT(overflow.coalesced == 1);
+	Q_ASSERT(overflow.dropped == 0);
+	Q_ASSERT(queue.queuedEvents() == 3);
+
+	// repeats the last queued for a - merged even though the queue is full
+	queue.push(makeBatch(FileEvent::Modified, "/a"), true, &overflow);
+	Q_ASSERT(overflow.coalesced == 1);
+	Q_ASSERT(overflow.dropped == 0);
+
+	// nothing to merge & no room
+	queue.push(makeBatch(FileEvent::Modified, "/b"), true, &overflow);
+	Q_ASSERT(overflow.coalesced == 0);
+	Q_ASSERT(overflow.dropped == 1);
+
+	// what happened to a is all still there, in order
+	FileEvent::Type expected[] = { FileEvent::Modified, FileEvent::Deleted, FileEvent::Modified };
+	int seen = 0;
+	EventBatch batch;
+	while (queue.tryPop(batch))
+	{
+		for (int i = 0; i < batch.size(); ++i, ++seen)
+		{
+			Q_ASSERT(seen < 3);
+			Q_ASSERT(batch.at(i).type() == expected[seen]);
+			Q_ASSERT(batch.at(i).nativePath() == "/a");
+		}
+	}
+	Q_ASSERT(seen == 3);
+	Q_UNUSED(expected);
+
+	// a move only repeats if nothing happened to where it went either
+	queue.setLimits(2, 0, BatchQueue::Coalesce);
+	queue.push(makeBatch(FileEvent::Moved, "/c", "/d"));
+	queue.push(makeBatch(FileEvent::Created, "/d"));
+	queue.push(makeBatch(FileEvent::Moved, "/c", "/d"), true, &overflow);
+	Q_ASSERT(overflow.coalesced == 0);
+	Q_ASSERT(overflow.dropped == 1);
+	Q_ASSERT(queue.tryPop(batch));
+	queue.push(makeBatch(FileEvent::Moved, "/e", "/f"));
+	queue.push(makeBatch(FileEvent::Moved, "/e", "/f"), true, &overflow);
+	Q_ASSERT(overflow.coalesced == 1);
+	Q_ASSERT(queue.queuedEvents() == 2);
+}
+
+static void testDrop()
+{
+	BatchQueue queue;
+	queue.setLimits(2, 0, BatchQueue::Drop);
+	queue.push(makeBatch(2, "/drop/"));
+
+	BatchQueue::Overflow overflow;
+	queue.push(makeBatch(FileEvent::Modified, "/drop/0"), true, &overflow);
+	Q_ASSERT(overflow.dropped == 1);
+	Q_ASSERT(overflow.coalesced == 0);
+	Q_ASSERT(queue.size() == 1);
+
+	// a batch too large on its own is still taken by an empty queue
+	EventBatch batch;
+	Q_ASSERT(queue.tryPop(batch));
+	queue.push(makeBatch(5, "/drop/"), true, &overflow);
+	Q_ASSERT(overflow.dropped == 0);
+	Q_ASSERT(queue.queuedEvents() == 5);
+}
+
+static void testPeaks()
+{
+	BatchQueue queue;
+	queue.push(makeBatch(3, "/peak/"));
+	qint64 bytes = queue.queuedBytes();
+	Q_ASSERT(bytes > 0);
+	queue.push(makeBatch(4, "/peak/"));
+	Q_ASSERT(queue.queuedEvents() == 7);
+
+	EventBatch batch;
+	while (queue.tryPop(batch))
+	{
+	}
+	Q_ASSERT(queue.queuedEvents() == 0);
+	Q_ASSERT(queue.queuedBytes() == 0);
+	Q_ASSERT(queue.peakEvents() == 7);
+	Q_ASSERT(queue.peakBytes() > bytes);
+
+	queue.push(makeBatch(1, "/peak/"));
+	Q_ASSERT(queue.peakEvents() == 7);
+	Q_UNUSED(bytes);
+}
+
+/**
+ * A watcher without a backend, publishing whatever it's told to.
+ */
+class StubWatcher : public FileWatcher
+{
+public:
+	void publish(int count)
+	{
+		for (int i = 0; i < count; ++i)
+		{
+			queueEvent(FileEvent::Modified, QByteArray("/stub/") + QByteArray::number(i));
+		}
+		flushEvents();
+	}
+
+	bool supportsRecursiveWatch() const
+	{
+		return false;
+	}
+
+	size_t drain(FileEvent * out, size_t max, int timeout)
+	{
+		Q_UNUSED(out);
+		Q_UNUSED(max);
+		Q_UNUSED(timeout);
+		return 0;
+	}
+
+	bool addWatch(const QString & path, bool recursive)
+	{
+		Q_UNUSED(path);
+		Q_UNUSED(recursive);
+		return false;
+	}
+
+	bool removeWatch(const QString & path)
+	{
+		Q_UNUSED(path);
+		return false;
+	}
+
+	void stopPolling()
+	{
+	}
+
+protected:
+	void poll()
+	{
+	}
+};
+
+static void testResync()
+{
+	StubWatcher watcher;
+	watcher.setQueueLimits(2, 0, FileWatcher::DropWhenFull);
+	// the queue only collects once someone has asked
+	Q_ASSERT(watcher.nextBatch(0).isEmpty());
+
+	watcher.publish(2);
+	Q_ASSERT(watcher.stats().resyncs == 0);
+	watcher.publish(1);
+	Q_ASSERT(watcher.stats().resyncs == 1);
+	Q_ASSERT(watcher.stats().droppedEvents == 1);
+	// the same run of drops
+	watcher.publish(1);
+	Q_ASSERT(watcher.stats().resyncs == 1);
+	Q_ASSERT(watcher.stats().droppedEvents == 2);
+
+	Q_ASSERT(watcher.nextBatch(0).size() == 2);
+	watcher.publish(1);
+	watcher.publish(2);
+	Q_ASSERT(watcher.stats().resyncs == 2);
+
+	WatcherStats stats = watcher.stats();
+	Q_ASSERT(stats.queuedEvents == 1);
+	Q_ASSERT(stats.peakQueuedEvents == 2);
+	Q_ASSERT(stats.peakQueuedBytes >= stats.queuedBytes);
+	Q_UNUSED(stats);
+}
+
+static void testDeliveryModes()
+{
+	const quint64 MS = 1000000;
+	DeliveryController controller;
+	quint64 now = 1000 * MS;
+
+	// a trickle is delivered straight away
+	controller.update(ADAPTIVE_CALM_RATE / 20, 0, now);
+	Q_ASSERT(controller.mode() == DeliveryController::LowLatency);
+	Q_ASSERT(controller.delay() == 0);
+	Q_ASSERT(controller.batchSize() == 1);
+	Q_ASSERT(controller.shouldFlush(1, now, now));
+
+	// between calm & storm, events are held for somewhere between the bounds
+	now += MS;
+	controller.update(ADAPTIVE_CALM_RATE, 0, now);
+	Q_ASSERT(controller.mode() == DeliveryController::Balanced);
+	Q_ASSERT(controller.delay() > controller.idleLatency() * 1000);
+	Q_ASSERT(controller.delay() < controller.stormLatency() * 1000);
+	Q_ASSERT(controller.batchSize() > 1);
+	Q_ASSERT(!controller.shouldFlush(1, now, now));
+	Q_ASSERT(controller.shouldFlush(controller.batchSize(), now, now));
+	Q_ASSERT(controller.shouldFlush(1, now, now + (quint64)controller.delay() * 1000));
+	int wait = controller.timeout(1, now, now, 1000);
+	Q_ASSERT(wait > 0 && wait <= controller.stormLatency());
+	Q_ASSERT(controller.timeout(0, now, now, 1000) == 1000);
+
+	// a storm is held for as long as the storm bound allows
+	now += MS;
+	controller.update(ADAPTIVE_STORM_RATE, 0, now);
+	Q_ASSERT(controller.mode() == DeliveryController::Throughput);
+	Q_ASSERT(controller.delay() == controller.stormLatency() * 1000);
+	Q_ASSERT(controller.batchSize() <= ADAPTIVE_MAX_BATCH);
+
+	// once it's over the rate decays & delivery goes back to low latency
+	now += 100 * ADAPTIVE_RATE_WINDOW_MS * MS;
+	controller.update(0, 0, now);
+	Q_ASSERT(controller.mode() == DeliveryController::LowLatency);
+	Q_ASSERT(controller.batchSize() == 1);
+
+	// a consumer that has fallen behind gets batches as large as they can be, however calm
+	now += MS;
+	controller.update(1, ADAPTIVE_DEEP_QUEUE, now);
+	Q_ASSERT(controller.mode() == DeliveryController::Throughput);
+	now += MS;
+	controller.update(1, ADAPTIVE_DEEP_QUEUE - 1, now);
+	Q_ASSERT(controller.mode() == DeliveryController::LowLatency);
+
+	// the bounds follow what they're set to
+	controller.setLatencyBounds(5, 20);
+	now += MS;
+	controller.update(0, ADAPTIVE_DEEP_QUEUE, now);
+	Q_ASSERT(controller.mode() == DeliveryController::Throughput);
+	Q_ASSERT(controller.delay() == 20 * 1000);
+	controller.setLatencyBounds(30, 20);
+	Q_ASSERT(controller.stormLatency() == 30);
+	Q_UNUSED(wait);
+}
+
+int main()
+{
+	testBlock();
+	testCoalesce();
+	testDrop();
+	testPeaks();
+	testResync();
+	testDeliveryModes();
+	qDebug() << "delivery_test passed";
+	return 0;
+}
@@ -0,0 +1,10 @@
+PROJECT = delivery_test
+TEMPLATE = app
+
+include(../test.pri)
+
+SOURCES += delivery_test.cpp
+LIBS += -lfnotify
+
+DEPENDPATH += $$BASE/core
+INCLUDEPATH += $$BASE
@@ -19,10 +19,11 @@
 
 #include <core/WatcherFactory.h>
 #include <core/FileWatcher.h>
+#include <core/EventBatch.h>
 
 #define STEP_DELAY 300
 
-FuncValidator::FuncValidator() : m_toreDown(true), m_watcher(NULL)
+FuncValidator::FuncValidator() : m_toreDown(true), m_subscription(0), m_subtreeCount(0), m_subtreesRemoved(0), m_watcher(NULL)
 {
 	
 }
@@ -46,11 +47,13 @@ void FuncValidator::setup()
 	Q_ASSERT(m_watcher != NULL);
 
 	m_watcher->addWatch(".", true);
+	m_subscription = m_watcher->subscribe(".", FileEvent::AllEvents, this);
 	m_watcher->start();
 
 	connect(m_watcher, SIGNAL(error(QString)), SLOT(error(QString)));
 	connect(m_watcher, SIGNAL(watchAdded(QString)), SLOT(watchAdded(QString)));
 	connect(m_watcher, SIGNAL(watchRemoved(QString)), SLOT(watchRemoved(QString)));
+	connect(m_watcher, SIGNAL(subtreeRemoved(QString, int)), SLOT(subtreeRemoved(QString, int)));
 	connect(m_watcher, SIGNAL(moved(QString)), SLOT(moved(QString)));
 	connect(m_watcher, SIGNAL(moved(QString, QString)), SLOT(moved(QString, QString)));
 	connect(m_watcher, SIGNAL(deleted(QString)), SLOT(deleted(QString)));
@@ -62,6 +65,8 @@ void FuncValidator::setup()
 
 void FuncValidator::tearDown()
 {
+	bool unsubscribed = m_watcher->unsubscribe(m_subscription);
+	Q_ASSERT(unsubscribed);
 	m_watcher->removeWatch(".");
 	delete m_watcher; m_watcher = NULL;
 
@@ -84,6 +89,7 @@ bool FuncValidator::step()
 	static QFile file(NULL);
 	static QDir cwd(".");
 	bool opened, removed, renamed, created;
+	bool delivered;
 	QString fName, prevFName;
 	QString msg;
 
@@ -178,6 +184,126 @@ bool FuncValidator::step()
 			Q_ASSERT(removed);
 			m_filesCreated.removeAll(fName);
 			break;
+		case 11:
+			fName = "step_11";
+			Q_ASSERT(cwd.exists(fName) == false);
+			created = cwd.mkdir(fName) && cwd.mkdir(fName + "/a") && cwd.mkdir(fName + "/a/b") && cwd.mkdir(fName + "/c");
+			Q_ASSERT(created);
+			break;
+		case 12:
+			// already watched as part of the tree - this is a second reference
+			created = m_watcher->addWatch("step_11/a", true);
+			Q_ASSERT(created);
+			break;
+		case 13:
+			// step_11 & c go, a was added on its own so it keeps its watch & its subtree
+			m_subtreeCount = 0;
+			removed = m_watcher->removeWatch("step_11");
+			Q_ASSERT(removed);
+			Q_ASSERT(m_subtreeRoot.endsWith("step_11"));
+			Q_ASSERT(m_subtreeCount == 2);
+			Q_ASSERT(!m_watcher->hasWatch("step_11"));
+			Q_ASSERT(!m_watcher->hasWatch("step_11/c"));
+			Q_ASSERT(m_watcher->hasWatch("step_11/a"));
+			Q_ASSERT(m_watcher->hasWatch("step_11/a/b"));
+			break;
+		case 14:
+			fName = "step_14";
+			Q_ASSERT(cwd.exists(fName) == false);
+			created = cwd.mkdir(fName);
+			for (int i = 0; i < 10; ++i)
+			{
+				created = cwd.mkdir(fName + "/" + QString::number(i)) && created;
+			}
+			Q_ASSERT(created);
+			break;
+		case 15:
+			{
+				QMutexLocker locker(&m_deliveredLock);
+				m_delivered.clear();
+			}
+			// fast enough that the IN_IGNOREDs share a read with what comes after them
+			fName = "step_14";
+			removed = true;
+			for (int i = 0; i < 10; ++i)
+			{
+				removed = cwd.rmdir(fName + "/" + QString::number(i)) && removed;
+			}
+			removed = cwd.rmdir(fName) && removed;
+			Q_ASSERT(removed);
+
+			fName = "step_15.tmp";
+			Q_ASSERT(cwd.exists(fName) == false);
+			file.setFileName(fName);
+			created = file.open(QFile::WriteOnly);
+			Q_ASSERT(created);
+			file.close();
+			m_filesCreated += fName;
+			break;
+		case 16:
+			delivered = false;
+			{
+				QMutexLocker locker(&m_deliveredLock);
+				foreach(const QString & path, m_delivered)
+				{
+					delivered = delivered || path.endsWith("step_15.tmp");
+				}
+			}
+			Q_ASSERT_X(delivered, "functionality validation test 16", "events after removing a tree were lost");
+
+			removed = file.remove();
+			Q_ASSERT(removed);
+			m_filesCreated.removeAll(prevFName);
+
+			m_subtreeCount = 0;
+			removed = m_watcher->removeWatch("step_11/a");
+			Q_ASSERT(removed);
+			Q_ASSERT(m_subtreeCount == 2);
+			removed = cwd.rmdir("step_11/a/b") && cwd.rmdir("step_11/a") && cwd.rmdir("step_11/c") && cwd.rmdir("step_11");
+			Q_ASSERT(removed);
+			break;
+		case 17:
+			fName = "step_17";
+			Q_ASSERT(cwd.exists(fName) == false);
+			created = cwd.mkdir(fName);
+			Q_ASSERT(created);
+			break;
+		case 18:
+			// moved away before the watches on it can have been reported
+			created = cwd.mkdir("step_17/x") && cwd.mkdir("step_17/x/y");
+			Q_ASSERT(created);
+			renamed = cwd.rename("step_17/x", "step_17/z");
+			Q_ASSERT(renamed);
+			break;
+		case 19:
+			Q_ASSERT(!m_watcher->hasWatch("step_17/x"));
+			Q_ASSERT(!m_watcher->hasWatch("step_17/x/y"));
+			removed = cwd.rmdir("step_17/z/y") && cwd.rmdir("step_17/z") && cwd.rmdir("step_17");
+			Q_ASSERT(removed);
+			break;
+		case 20:
+			fName = "step_20";
+			Q_ASSERT(cwd.exists(fName) == false);
+			created = cwd.mkdir(fName) && cwd.mkdir(fName + "/a") && cwd.mkdir(fName + "/a/b") && cwd.mkdir(fName + "/c");
+			Q_ASSERT(created);
+			break;
+		case 21:
+			// deleted from the bottom up, the way rm -r does it
+			m_subtreesRemoved = 0;
+			m_subtreeCount = 0;
+			removed = cwd.rmdir("step_20/a/b") && cwd.rmdir("step_20/a") && cwd.rmdir("step_20/c") && cwd.rmdir("step_20");
+			Q_ASSERT(removed);
+			break;
+		case 22:
+			// the tree is dropped once the watcher has gone quiet
+			break;
+		case 23:
+			Q_ASSERT(m_subtreesRemoved == 1);
+			Q_ASSERT(m_subtreeRoot.endsWith("step_20"));
+			Q_ASSERT(m_subtreeCount == 4);
+			Q_ASSERT(!m_watcher->hasWatch("step_20"));
+			Q_ASSERT(!m_watcher->hasWatch("step_20/a/b"));
+			break;
 		default:
 			qDebug() << "Stopping";
 			QCoreApplication::instance()->quit();
@@ -206,6 +332,15 @@ void FuncValidator::watchRemoved(QString path)
 	qDebug() << "Watch removed: " << path;
 }
 
+void FuncValidator::subtreeRemoved(QString root, int count)
+{
+	Q_ASSERT(m_toreDown == false);
+	qDebug() << "Subtree removed: " << root << " (" << count << " watches)";
+	m_subtreeRoot = root;
+	m_subtreeCount = count;
+	++m_subtreesRemoved;
+}
+
 void FuncValidator::moved(QString from)
 {
 	Q_ASSERT(m_toreDown == false);
@@ -235,3 +370,15 @@ void FuncValidator::modified(QString path)
 	Q_ASSERT(m_toreDown == false);
 	qDebug() << "File modified: " << path;
 }
+
+void FuncValidator::deliver(const EventBatch & batch, const QVector<int> & matches)
+{
+	Q_ASSERT(!matches.isEmpty());
+	QMutexLocker locker(&m_deliveredLock);
+	foreach(int i, matches)
+	{
+		const FileEvent & event = batch.at(i);
+		qDebug() << "Subscription event " << event.type() << ": " << event.path() << " " << event.otherPath();
+		m_delivered += event.path();
+	}
+}
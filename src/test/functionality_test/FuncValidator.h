@@ -13,16 +13,21 @@
 //
 
 #include <QStringList>
+#include <QMutex>
+
+#include <core/EventSink.h>
 
 class FileWatcher;
 
-class FuncValidator : public QObject
+class FuncValidator : public QObject, public EventSink
 {
 	Q_OBJECT
 public:
 	FuncValidator();
 	~FuncValidator();
 
+	void deliver(const EventBatch & batch, const QVector<int> & matches);
+
 private slots:
 	void setup();
 	bool step();
@@ -31,6 +36,7 @@ private slots:
 	void error(QString message);
 	void watchAdded(QString path);
 	void watchRemoved(QString path);
+	void subtreeRemoved(QString root, int count);
 	void moved(QString from);
 	void moved(QString from, QString to);
 	void deleted(QString path);
@@ -43,7 +49,16 @@ signals:
 private:
 	bool m_toreDown;
 	int m_stepCnt;
+	int m_subscription;
 	QStringList m_filesCreated;
+	QString m_subtreeRoot;
+	int m_subtreeCount;
+	int m_subtreesRemoved;
+	/**
+	 * Every path delivered to the subscription.  Delivered on the poll thread.
+	 */
+	QStringList m_delivered;
+	QMutex m_deliveredLock;
 	FileWatcher* m_watcher;
 };
 
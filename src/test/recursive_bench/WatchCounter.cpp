@@ -0,0 +1,55 @@
+//
+// C++ Implementation: WatchCounter
+//
+// Description: 
+//
+//
+// Author: Vitali Lovich <vlovich@gmail.com>, (C) 2008
+//
+// Copyright: See COPYING file that comes with this distribution
+//
+//
+#include "WatchCounter.h"
+
+WatchCounter::WatchCounter() : numAdded(0), numRemoved(0), numErrors(0)
+{
+}
+
+int WatchCounter::added() const
+{
+	return numAdded;
+}
+
+int WatchCounter::removed() const
+{
+	return numRemoved;
+}
+
+int WatchCounter::errors() const
+{
+	return numErrors;
+}
+
+void WatchCounter::watchAdded(QString path)
+{
+	Q_UNUSED(path);
+	numAdded.ref();
+}
+
+void WatchCounter::watchRemoved(QString path)
+{
+	Q_UNUSED(path);
+	numRemoved.ref();
+}
+
+void WatchCounter::subtreeRemoved(QString root, int count)
+{
+	Q_UNUSED(root);
+	numRemoved.fetchAndAddRelaxed(count);
+}
+
+void WatchCounter::error(QString message)
+{
+	Q_UNUSED(message);
+	numErrors.ref();
+}
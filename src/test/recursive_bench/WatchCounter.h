@@ -0,0 +1,43 @@
+#ifndef WATCH_COUNTER_H_
+#define WATCH_COUNTER_H_
+//
+// C++ Interface: WatchCounter
+//
+// Description: 
+//
+//
+// Author: Vitali Lovich <vlovich@gmail.com>, (C) 2008
+//
+// Copyright: See COPYING file that comes with this distribution
+//
+//
+#include <QObject>
+#include <QAtomicInt>
+
+/**
+ * Counts the watches a FileWatcher reports as added and removed.  Meant to be connected
+ * with direct connections, so the counts can be read from any thread.
+ */
+class WatchCounter : public QObject
+{
+	Q_OBJECT
+public:
+	WatchCounter();
+
+	int added() const;
+	int removed() const;
+	int errors() const;
+
+public slots:
+	void watchAdded(QString path);
+	void watchRemoved(QString path);
+	void subtreeRemoved(QString root, int count);
+	void error(QString message);
+
+private:
+	QAtomicInt numAdded;
+	QAtomicInt numRemoved;
+	QAtomicInt numErrors;
+};
+
+#endif /* WATCH_COUNTER_H_ */
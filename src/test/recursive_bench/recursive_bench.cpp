@@ -0,0 +1,322 @@
+//
+// C++ Implementation: recursive_bench
+//
+// Description: 
+//
+//
+// Author: Vitali Lovich <vlovich@gmail.com>, (C) 2008
+//
+// Copyright: See COPYING file that comes with this distribution
+//
+//
+// Measures how recursive watches scale with the size of the tree: how long it takes to
+// cover a synthesized tree, how much memory the watches take, how long it takes to react
+// to a watched subtree being deleted, how long unwatching the rest takes and how long
+// tearing the watcher down takes.  Each tree size produces one JSON object per line on
+// the output.
+//
+// Usage: recursive_bench [--dir DIR] [--sizes 10000,100000,1000000] [--fanout N] [--output FILE]
+//
+// Note that the kernel side of every watch (roughly 1KB each) is not part of the process'
+// RSS, and that fs.inotify.max_user_watches has to be raised for the larger trees.
+//
+#include <QCoreApplication>
+#include <QFile>
+#include <QDir>
+#include <QFileInfo>
+#include <QTextStream>
+#include <QStringList>
+#include <QVector>
+#include <QtDebug>
+
+#include <core/WatcherFactory.h>
+#include <core/FileWatcher.h>
+
+#include "WatchCounter.h"
+
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/resource.h>
+#include <ftw.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <time.h>
+
+/**
+ * How long to wait for the watcher to catch up with a deleted subtree once it stops
+ * making progress.
+ */
+#define SETTLE_TIME_MS 2000
+
+struct BenchOptions
+{
+	QString dir;
+	QList<int> sizes;
+	int fanout;
+	QString output;
+};
+
+static BenchOptions parseOptions(const QStringList & arguments)
+{
+	BenchOptions options;
+	options.dir = QFileInfo("/dev/shm").isDir() ? QString("/dev/shm") : QDir::tempPath();
+	// 1M directories is opt-in through --sizes - it needs a raised watch limit and a lot
+	// of time with the current data structures
+	options.sizes << 10000 << 100000;
+	options.fanout = 10;
+
+	for (int i = 1; i + 1 < arguments.size(); i += 2)
+	{
+		QString name = arguments.at(i);
+		QString value = arguments.at(i + 1);
+		if (name == "--dir")
+		{
+			options.dir = value;
+		}
+		else if (name == "--sizes")
+		{
+			options.sizes.clear();
+			foreach(QString size, value.split(',', QString::SkipEmptyParts))
+			{
+				options.sizes += size.toInt();
+			}
+		}
+		else if (name == "--fanout")
+		{
+			options.fanout = qMax(1, value.toInt());
+		}
+		else if (name == "--output")
+		{
+			options.output = value;
+		}
+		else
+		{
+			qWarning() << "Ignoring unknown option " << name;
+		}
+	}
+	return options;
+}
+
+static qint64 nowNanos()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (qint64)now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+static double millisSince(qint64 start)
+{
+	return (nowNanos() - start) / 1e6;
+}
+
+/**
+ * @return The resident set size of the process, in bytes.
+ */
+static qint64 currentRss()
+{
+	long pages = 0;
+	long resident = 0;
+	FILE * statm = fopen("/proc/self/statm", "r");
+	if (statm != NULL)
+	{
+		if (fscanf(statm, "%ld %ld", &pages, &resident) != 2)
+		{
+			resident = 0;
+		}
+		fclose(statm);
+	}
+	return (qint64)resident * sysconf(_SC_PAGESIZE);
+}
+
+/**
+ * @return The peak resident set size of the process so far, in bytes.
+ */
+static qint64 peakRss()
+{
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return (qint64)usage.ru_maxrss * 1024;
+}
+
+/**
+ * Creates numDirs directories below root, breadth first, fanout per directory.
+ *
+ * @param firstSubtree Receives the number of directories below (and including) the first
+ * child of root.
+ * @return The number of directories created.
+ */
+static int generateTree(const QByteArray & root, int numDirs, int fanout, int & firstSubtree)
+{
+	QList<QByteArray> pending;
+	QList<bool> inFirst;
+	pending += root;
+	inFirst += false;
+	firstSubtree = 0;
+
+	int created = 0;
+	while (created < numDirs && !pending.isEmpty())
+	{
+		QByteArray parent = pending.takeFirst();
+		bool parentInFirst = inFirst.takeFirst();
+		for (int i = 0; i < fanout && created < numDirs; ++i)
+		{
+			QByteArray child = parent + "/d" + QByteArray::number(i);
+			if (mkdir(child.constData(), 0755) != 0)
+			{
+				qWarning() << "Unable to create " << child;
+				return created;
+			}
+			++created;
+
+			bool childInFirst = parentInFirst || (parent == root && i == 0);
+			if (childInFirst)
+			{
+				++firstSubtree;
+			}
+			pending += child;
+			inFirst += childInFirst;
+		}
+	}
+	return created;
+}
+
+static int removeEntry(const char * path, const struct stat * info, int type, struct FTW * ftw)
+{
+	Q_UNUSED(info);
+	Q_UNUSED(type);
+	Q_UNUSED(ftw);
+	return remove(path);
+}
+
+static void removeTree(const QByteArray & root)
+{
+	nftw(root.constData(), removeEntry, 64, FTW_DEPTH | FTW_PHYS);
+}
+
+/**
+ * Waits until the counter has seen target removals, or until no more progress is made.
+ */
+static void waitForRemovals(const WatchCounter & counter, int target)
+{
+	int lastProgress = -1;
+	qint64 lastChange = nowNanos();
+	while (counter.removed() < target)
+	{
+		qint64 now = nowNanos();
+		if (counter.removed() != lastProgress)
+		{
+			lastProgress = counter.removed();
+			lastChange = now;
+		}
+		else if (now - lastChange > SETTLE_TIME_MS * 1000000LL)
+		{
+			break;
+		}
+		usleep(1000);
+	}
+}
+
+int main(int argc, char ** argv)
+{
+	QCoreApplication application(argc, argv);
+	BenchOptions options = parseOptions(application.arguments());
+
+	WatcherFactory * factory = WatcherFactory::getInstance(".");
+	Q_ASSERT(factory != NULL);
+	if (factory == NULL)
+	{
+		qCritical() << "No watcher plugin found";
+		return 1;
+	}
+
+	QFile outputFile;
+	if (options.output.isEmpty())
+	{
+		outputFile.open(stdout, QIODevice::WriteOnly);
+	}
+	else
+	{
+		outputFile.setFileName(options.output);
+		if (!outputFile.open(QIODevice::WriteOnly | QIODevice::Append))
+		{
+			qCritical() << "Unable to open " << options.output;
+			return 1;
+		}
+	}
+	QTextStream out(&outputFile);
+
+	foreach(int size, options.sizes)
+	{
+		QString root = QDir(options.dir).absoluteFilePath("fnotify_tree_" + QString::number(size));
+		QByteArray encodedRoot = QFile::encodeName(root);
+		removeTree(encodedRoot);
+		if (mkdir(encodedRoot.constData(), 0755) != 0)
+		{
+			qCritical() << "Unable to create " << root;
+			return 1;
+		}
+
+		qint64 start = nowNanos();
+		int firstSubtree;
+		int numDirs = generateTree(encodedRoot, size, options.fanout, firstSubtree);
+		double generateMs = millisSince(start);
+
+		WatchCounter counter;
+		FileWatcher * watcher = factory->createWatcher();
+		Q_ASSERT(watcher != NULL);
+		QObject::connect(watcher, SIGNAL(watchAdded(QString)), &counter, SLOT(watchAdded(QString)), Qt::DirectConnection);
+		QObject::connect(watcher, SIGNAL(watchRemoved(QString)), &counter, SLOT(watchRemoved(QString)), Qt::DirectConnection);
+		QObject::connect(watcher, SIGNAL(subtreeRemoved(QString,int)), &counter, SLOT(subtreeRemoved(QString,int)), Qt::DirectConnection);
+		QObject::connect(watcher, SIGNAL(error(QString)), &counter, SLOT(error(QString)), Qt::DirectConnection);
+
+		// full coverage: the crawl is synchronous, so every watch exists once this returns
+		qint64 rssBefore = currentRss();
+		start = nowNanos();
+		watcher->addWatch(root, true);
+		double coverMs = millisSince(start);
+		qint64 rssAfter = currentRss();
+		int watched = counter.added();
+
+		// deleting a watched subtree, as seen by the poll thread
+		watcher->start();
+		int removedBefore = counter.removed();
+		start = nowNanos();
+		removeTree(encodedRoot + "/d0");
+		waitForRemovals(counter, removedBefore + firstSubtree);
+		double subtreeMs = millisSince(start);
+		int subtreeRemoved = counter.removed() - removedBefore;
+
+		// unwatching whatever is left - a single subtree teardown
+		removedBefore = counter.removed();
+		start = nowNanos();
+		watcher->removeWatch(root);
+		double unwatchMs = millisSince(start);
+		int unwatched = counter.removed() - removedBefore;
+
+		start = nowNanos();
+		delete watcher;
+		double teardownMs = millisSince(start);
+
+		out << "{\"benchmark\":\"recursive\""
+			<< ",\"dirs\":" << numDirs
+			<< ",\"fanout\":" << options.fanout
+			<< ",\"generate_ms\":" << generateMs
+			<< ",\"watched\":" << watched
+			<< ",\"errors\":" << counter.errors()
+			<< ",\"cover_ms\":" << coverMs
+			<< ",\"peak_rss_bytes\":" << peakRss()
+			<< ",\"bytes_per_watch\":" << (watched > 0 ? (double)(rssAfter - rssBefore) / watched : 0.0)
+			<< ",\"subtree_dirs\":" << firstSubtree
+			<< ",\"subtree_removed\":" << subtreeRemoved
+			<< ",\"subtree_delete_ms\":" << subtreeMs
+			<< ",\"unwatched\":" << unwatched
+			<< ",\"unwatch_ms\":" << unwatchMs
+			<< ",\"teardown_ms\":" << teardownMs
+			<< "}\n";
+		out.flush();
+
+		removeTree(encodedRoot);
+	}
+
+	return 0;
+}
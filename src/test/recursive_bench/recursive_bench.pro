@@ -0,0 +1,12 @@
+PROJECT = recursive_bench
+TEMPLATE = app
+
+include(../test.pri)
+
+SOURCES += recursive_bench.cpp WatchCounter.cpp
+HEADERS += WatchCounter.h
+
+LIBS += -lfnotify
+
+DEPENDPATH += $$BASE/core
+INCLUDEPATH += $$BASE
@@ -1,3 +1,3 @@
 TEMPLATE = subdirs
 
-SUBDIRS += stub smoke_test functionality_test
+SUBDIRS += stub smoke_test functionality_test throughput_bench recursive_bench delivery_test
@@ -0,0 +1,149 @@
+//
+// C++ Implementation: ThroughputBench
+//
+// Description: 
+//
+//
+// Author: Vitali Lovich <vlovich@gmail.com>, (C) 2008
+//
+// Copyright: See COPYING file that comes with this distribution
+//
+//
+#include "ThroughputBench.h"
+
+#include <QtAlgorithms>
+#include <QtDebug>
+
+#include <time.h>
+
+qint64 nowNanos()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (qint64)now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+int operationFor(FileEvent::Type type, const QString & path)
+{
+	QString name = path.mid(path.lastIndexOf(QLatin1Char('/')) + 1);
+	if (name.length() < 2)
+	{
+		return -1;
+	}
+	bool ok;
+	int group = name.mid(1).toInt(&ok);
+	if (!ok)
+	{
+		return -1;
+	}
+	bool original = name.at(0) == QLatin1Char('f');
+	bool renamed = name.at(0) == QLatin1Char('r');
+
+	switch (type)
+	{
+		case FileEvent::Created:
+			return original ? 4 * group : -1;
+		case FileEvent::Modified:
+			return original ? 4 * group + 1 : -1;
+		case FileEvent::Moved:
+			return original ? 4 * group + 2 : -1;
+		case FileEvent::Deleted:
+			return renamed ? 4 * group + 3 : -1;
+		default:
+			return -1;
+	}
+}
+
+LatencyRecorder::LatencyRecorder(const QVector<qint64> & issuedAt_)
+	: issuedAt(issuedAt_), deliveredAt(issuedAt_.size(), 0), numDelivered(0), lastDeliveredAt(0)
+{
+}
+
+void LatencyRecorder::delivered(int op)
+{
+	if (op < 0 || op >= deliveredAt.size() || deliveredAt.at(op) != 0)
+	{
+		return;
+	}
+	qint64 now = nowNanos();
+	deliveredAt[op] = now;
+	lastDeliveredAt = now;
+	++numDelivered;
+}
+
+int LatencyRecorder::deliveredCount() const
+{
+	return numDelivered;
+}
+
+qint64 LatencyRecorder::lastDelivery() const
+{
+	return lastDeliveredAt;
+}
+
+QVector<qint64> LatencyRecorder::latencies() const
+{
+	QVector<qint64> result;
+	result.reserve(numDelivered);
+	for (int i = 0; i < deliveredAt.size(); ++i)
+	{
+		if (deliveredAt.at(i) != 0 && issuedAt.at(i) != 0)
+		{
+			result += deliveredAt.at(i) - issuedAt.at(i);
+		}
+	}
+	qSort(result.begin(), result.end());
+	return result;
+}
+
+BenchListener::BenchListener(LatencyRecorder & recorder_) : recorder(recorder_)
+{
+}
+
+void BenchListener::onEvents(const FileEvent * events, size_t count)
+{
+	for (size_t i = 0; i < count; ++i)
+	{
+		recorder.delivered(operationFor(events[i].type(), events[i].path()));
+	}
+}
+
+SignalReceiver::SignalReceiver(LatencyRecorder & recorder_) : recorder(recorder_), errors(0)
+{
+}
+
+int SignalReceiver::errorCount() const
+{
+	return errors;
+}
+
+void SignalReceiver::error(QString message)
+{
+	++errors;
+	qDebug() << "Watcher Error: " << message;
+}
+
+void SignalReceiver::moved(QString from, QString to)
+{
+	Q_UNUSED(to);
+	recorder.delivered(operationFor(FileEvent::Moved, from));
+}
+
+void SignalReceiver::deleted(QString path)
+{
+	recorder.delivered(operationFor(FileEvent::Deleted, path));
+}
+
+void SignalReceiver::newChild(QString path)
+{
+	recorder.delivered(operationFor(FileEvent::Created, path));
+}
+
+void SignalReceiver::modified(QString path)
+{
+	recorder.delivered(operationFor(FileEvent::Modified, path));
+}
+
+void SignalReceiver::sync()
+{
+}
@@ -0,0 +1,109 @@
+#ifndef THROUGHPUT_BENCH_H_
+#define THROUGHPUT_BENCH_H_
+//
+// C++ Interface: ThroughputBench
+//
+// Description: 
+//
+//
+// Author: Vitali Lovich <vlovich@gmail.com>, (C) 2008
+//
+// Copyright: See COPYING file that comes with this distribution
+//
+//
+#include <QObject>
+#include <QString>
+#include <QVector>
+
+#include <core/FileEvent.h>
+#include <core/FileEventListener.h>
+
+/**
+ * @return A monotonic timestamp in nanoseconds.
+ */
+qint64 nowNanos();
+
+/**
+ * The workload is made of groups of 4 operations on one file: create f<n>, write to f<n>,
+ * rename f<n> to r<n>, delete r<n>.  Operation 4 * n + k is step k of group n.
+ *
+ * @return The operation the event was generated by, or -1 if it isn't part of the workload.
+ */
+int operationFor(FileEvent::Type type, const QString & path);
+
+/**
+ * Remembers when the event caused by every operation of the workload was delivered.
+ * Each recorder must only receive deliveries from a single thread.
+ */
+class LatencyRecorder
+{
+public:
+	/**
+	 * @param issuedAt When each operation was issued, filled in by the workload right
+	 * before making the system call.
+	 */
+	explicit LatencyRecorder(const QVector<qint64> & issuedAt);
+
+	/**
+	 * Only the first delivery for an operation counts.
+	 */
+	void delivered(int op);
+
+	int deliveredCount() const;
+	qint64 lastDelivery() const;
+
+	/**
+	 * @return The sorted latencies, in nanoseconds, of every delivered operation.
+	 */
+	QVector<qint64> latencies() const;
+
+private:
+	const QVector<qint64> & issuedAt;
+	QVector<qint64> deliveredAt;
+	volatile int numDelivered;
+	volatile qint64 lastDeliveredAt;
+};
+
+/**
+ * Measures delivery through the native listener interface, on the poll thread.
+ */
+class BenchListener : public FileEventListener
+{
+public:
+	explicit BenchListener(LatencyRecorder & recorder);
+	void onEvents(const FileEvent * events, size_t count);
+
+private:
+	LatencyRecorder & recorder;
+};
+
+/**
+ * Measures delivery through the FileWatcher signals, received on a thread of its own.
+ */
+class SignalReceiver : public QObject
+{
+	Q_OBJECT
+public:
+	explicit SignalReceiver(LatencyRecorder & recorder);
+
+	int errorCount() const;
+
+public slots:
+	void error(QString message);
+	void moved(QString from, QString to);
+	void deleted(QString path);
+	void newChild(QString path);
+	void modified(QString path);
+
+	/**
+	 * Does nothing - invoked with a blocking connection to wait for the signals queued
+	 * before it.
+	 */
+	void sync();
+
+private:
+	LatencyRecorder & recorder;
+	volatile int errors;
+};
+
+#endif /* THROUGHPUT_BENCH_H_ */
@@ -0,0 +1,321 @@
+//
+// C++ Implementation: throughput_bench
+//
+// Description: 
+//
+//
+// Author: Vitali Lovich <vlovich@gmail.com>, (C) 2008
+//
+// Copyright: See COPYING file that comes with this distribution
+//
+//
+// Measures how many events the watcher delivers per second and how long each one takes
+// to get from the system call that caused it to the consumer, for workloads issued at
+// fixed rates.  Each rate produces one JSON object per line (per delivery path) on the
+// output so that runs can be compared over time.
+//
+// Usage: throughput_bench [--dir DIR] [--rates 1000,10000,...] [--duration SECONDS]
+//                         [--max-ops N] [--output FILE]
+//
+#include <QCoreApplication>
+#include <QThread>
+#include <QFile>
+#include <QDir>
+#include <QFileInfo>
+#include <QTextStream>
+#include <QStringList>
+#include <QtDebug>
+
+#include <core/WatcherFactory.h>
+#include <core/FileWatcher.h>
+
+#include "ThroughputBench.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <time.h>
+
+/**
+ * How long to wait for the remaining events once the workload is done and no progress
+ * is being made.
+ */
+#define SETTLE_TIME_MS 1000
+
+struct BenchOptions
+{
+	QString dir;
+	QList<int> rates;
+	int duration;
+	int maxOps;
+	QString output;
+};
+
+static BenchOptions parseOptions(const QStringList & arguments)
+{
+	BenchOptions options;
+	// tmpfs keeps the disk out of the measurements
+	options.dir = QFileInfo("/dev/shm").isDir() ? QString("/dev/shm") : QDir::tempPath();
+	options.rates << 1000 << 10000 << 100000 << 1000000;
+	options.duration = 2;
+	options.maxOps = 200000;
+
+	for (int i = 1; i + 1 < arguments.size(); i += 2)
+	{
+		QString name = arguments.at(i);
+		QString value = arguments.at(i + 1);
+		if (name == "--dir")
+		{
+			options.dir = value;
+		}
+		else if (name == "--rates")
+		{
+			options.rates.clear();
+			foreach(QString rate, value.split(',', QString::SkipEmptyParts))
+			{
+				options.rates += rate.toInt();
+			}
+		}
+		else if (name == "--duration")
+		{
+			options.duration = value.toInt();
+		}
+		else if (name == "--max-ops")
+		{
+			options.maxOps = value.toInt();
+		}
+		else if (name == "--output")
+		{
+			options.output = value;
+		}
+		else
+		{
+			qWarning() << "Ignoring unknown option " << name;
+		}
+	}
+	return options;
+}
+
+/**
+ * Issues the workload at the requested rate.  Every operation is timestamped right before
+ * its system call.
+ */
+static void runWorkload(const QString & dir, int rate, QVector<qint64> & issuedAt)
+{
+	QByteArray base = QFile::encodeName(dir);
+	char original[4096];
+	char renamed[4096];
+	const double interval = 1e9 / rate;
+	const qint64 start = nowNanos();
+
+	for (int op = 0; op < issuedAt.size(); ++op)
+	{
+		qint64 due = start + (qint64)(op * interval);
+		qint64 now = nowNanos();
+		if (due - now > 50000)
+		{
+			struct timespec delay;
+			delay.tv_sec = 0;
+			delay.tv_nsec = due - now;
+			nanosleep(&delay, NULL);
+		}
+		while (nowNanos() < due)
+		{
+			// spin for the last few microseconds
+		}
+
+		int group = op / 4;
+		snprintf(original, sizeof(original), "%s/f%d", base.constData(), group);
+		snprintf(renamed, sizeof(renamed), "%s/r%d", base.constData(), group);
+
+		issuedAt[op] = nowNanos();
+		int fd;
+		switch (op % 4)
+		{
+			case 0:
+				fd = open(original, O_CREAT | O_WRONLY | O_TRUNC, 0644);
+				if (fd != -1)
+				{
+					close(fd);
+				}
+				break;
+			case 1:
+				fd = open(original, O_WRONLY);
+				if (fd != -1)
+				{
+					if (write(fd, "x", 1) != 1)
+					{
+						qWarning() << "Unable to write to " << original;
+					}
+					close(fd);
+				}
+				break;
+			case 2:
+				rename(original, renamed);
+				break;
+			case 3:
+				unlink(renamed);
+				break;
+		}
+	}
+}
+
+/**
+ * Waits until every operation has been delivered on both paths, or until no more progress
+ * is made.
+ */
+static void waitForDelivery(int numOps, const LatencyRecorder & listenerLatency, const LatencyRecorder & signalLatency)
+{
+	int lastProgress = -1;
+	qint64 lastChange = nowNanos();
+	while (listenerLatency.deliveredCount() < numOps || signalLatency.deliveredCount() < numOps)
+	{
+		int progress = listenerLatency.deliveredCount() + signalLatency.deliveredCount();
+		qint64 now = nowNanos();
+		if (progress != lastProgress)
+		{
+			lastProgress = progress;
+			lastChange = now;
+		}
+		else if (now - lastChange > SETTLE_TIME_MS * 1000000LL)
+		{
+			break;
+		}
+		usleep(10000);
+	}
+}
+
+/**
+ * @return The given percentile of sorted, in microseconds.
+ */
+static double percentile(const QVector<qint64> & sorted, double fraction)
+{
+	if (sorted.isEmpty())
+	{
+		return 0;
+	}
+	int index = qMin(sorted.size() - 1, (int)(fraction * sorted.size()));
+	return sorted.at(index) / 1000.0;
+}
+
+/**
+ * @param overflows The times the kernel queue overflowed (@see WatcherStats::overflows) -
+ * "dropped" is everything that never arrived, whether the kernel or the watcher lost it.
+ */
+static void report(QTextStream & out, const QString & deliveryPath, int rate, int numOps,
+	qint64 start, qint64 generated, const LatencyRecorder & recorder, int errors, quint64 overflows)
+{
+	QVector<qint64> latencies = recorder.latencies();
+	int delivered = recorder.deliveredCount();
+	double generateSeconds = (generated - start) / 1e9;
+	double deliverSeconds = (qMax(recorder.lastDelivery(), generated) - start) / 1e9;
+
+	out << "{\"benchmark\":\"throughput\""
+		<< ",\"delivery\":\"" << deliveryPath << "\""
+		<< ",\"target_ops_per_s\":" << rate
+		<< ",\"ops\":" << numOps
+		<< ",\"achieved_ops_per_s\":" << numOps / generateSeconds
+		<< ",\"delivered\":" << delivered
+		<< ",\"dropped\":" << numOps - delivered
+		<< ",\"kernel_overflows\":" << overflows
+		<< ",\"errors\":" << errors
+		<< ",\"events_per_s\":" << delivered / deliverSeconds
+		<< ",\"p50_us\":" << percentile(latencies, 0.5)
+		<< ",\"p99_us\":" << percentile(latencies, 0.99)
+		<< ",\"p999_us\":" << percentile(latencies, 0.999)
+		<< "}\n";
+}
+
+int main(int argc, char ** argv)
+{
+	QCoreApplication application(argc, argv);
+	BenchOptions options = parseOptions(application.arguments());
+
+	WatcherFactory * factory = WatcherFactory::getInstance(".");
+	Q_ASSERT(factory != NULL);
+	if (factory == NULL)
+	{
+		qCritical() << "No watcher plugin found";
+		return 1;
+	}
+
+	QFile outputFile;
+	if (options.output.isEmpty())
+	{
+		outputFile.open(stdout, QIODevice::WriteOnly);
+	}
+	else
+	{
+		outputFile.setFileName(options.output);
+		if (!outputFile.open(QIODevice::WriteOnly | QIODevice::Append))
+		{
+			qCritical() << "Unable to open " << options.output;
+			return 1;
+		}
+	}
+	QTextStream out(&outputFile);
+
+	// the signal receiver gets an event loop of its own, just like a typical consumer
+	QThread receiverThread;
+	receiverThread.start();
+
+	foreach(int rate, options.rates)
+	{
+		if (rate <= 0)
+		{
+			continue;
+		}
+		int numOps = qMin(options.maxOps, rate * options.duration) / 4 * 4;
+		QString dir = QDir(options.dir).absoluteFilePath("fnotify_throughput_" + QString::number(rate));
+		if (!QDir().mkpath(dir))
+		{
+			qCritical() << "Unable to create " << dir;
+			return 1;
+		}
+
+		QVector<qint64> issuedAt(numOps, 0);
+		LatencyRecorder listenerLatency(issuedAt);
+		LatencyRecorder signalLatency(issuedAt);
+		BenchListener listener(listenerLatency);
+
+		SignalReceiver * receiver = new SignalReceiver(signalLatency);
+		receiver->moveToThread(&receiverThread);
+
+		FileWatcher * watcher = factory->createWatcher();
+		Q_ASSERT(watcher != NULL);
+		QObject::connect(watcher, SIGNAL(error(QString)), receiver, SLOT(error(QString)), Qt::QueuedConnection);
+		QObject::connect(watcher, SIGNAL(moved(QString, QString)), receiver, SLOT(moved(QString, QString)), Qt::QueuedConnection);
+		QObject::connect(watcher, SIGNAL(deleted(QString)), receiver, SLOT(deleted(QString)), Qt::QueuedConnection);
+		QObject::connect(watcher, SIGNAL(newChild(QString)), receiver, SLOT(newChild(QString)), Qt::QueuedConnection);
+		QObject::connect(watcher, SIGNAL(modified(QString)), receiver, SLOT(modified(QString)), Qt::QueuedConnection);
+		watcher->addListener(&listener);
+		watcher->addWatch(dir, false);
+		watcher->start();
+
+		qint64 start = nowNanos();
+		runWorkload(dir, rate, issuedAt);
+		qint64 generated = nowNanos();
+		waitForDelivery(numOps, listenerLatency, signalLatency);
+
+		quint64 overflows = watcher->stats().overflows;
+		watcher->removeListener(&listener);
+		watcher->removeWatch(dir);
+		delete watcher;
+
+		// make sure the receiver is done with signalLatency before it goes away
+		QMetaObject::invokeMethod(receiver, "sync", Qt::BlockingQueuedConnection);
+		int errors = receiver->errorCount();
+		receiver->deleteLater();
+
+		report(out, "listener", rate, numOps, start, generated, listenerLatency, errors, overflows);
+		report(out, "signal", rate, numOps, start, generated, signalLatency, errors, overflows);
+		out.flush();
+
+		QDir().rmdir(dir);
+	}
+
+	receiverThread.quit();
+	receiverThread.wait();
+
+	return 0;
+}
@@ -0,0 +1,12 @@
+PROJECT = throughput_bench
+TEMPLATE = app
+
+include(../test.pri)
+
+SOURCES += throughput_bench.cpp ThroughputBench.cpp
+HEADERS += ThroughputBench.h
+
+LIBS += -lfnotify
+
+DEPENDPATH += $$BASE/core
+INCLUDEPATH += $$BASE
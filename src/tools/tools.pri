@@ -0,0 +1 @@
+include(../global.pri)
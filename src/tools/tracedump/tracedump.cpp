@@ -0,0 +1,168 @@
+//
+// C++ Implementation: tracedump
+//
+// Description:
+//
+//
+// Author: Vitali Lovich <vlovich@gmail.com>, (C) 2008
+//
+// Copyright: See COPYING file that comes with this distribution
+//
+//
+// Decodes a flight recorder dump (see Trace::dump) into text.  The records of every thread
+// are merged in time order, one per line, with times relative to the oldest record.
+//
+// Usage: tracedump FILE
+//
+#include <QCoreApplication>
+#include <QFile>
+#include <QTextStream>
+#include <QStringList>
+#include <QVector>
+#include <QtAlgorithms>
+
+#include <core/Trace.h>
+
+#ifdef Q_OS_LINUX
+#include <sys/inotify.h>
+#endif /* Q_OS_LINUX */
+
+#include <stdio.h>
+
+struct Entry
+{
+	quint64 thread;
+	Trace::Record record;
+};
+
+static bool earlier(const Entry & first, const Entry & second)
+{
+	return first.record.timestamp < second.record.timestamp;
+}
+
+template <typename T>
+static bool readValue(QFile & file, T & value)
+{
+	return file.read((char *)&value, sizeof(value)) == sizeof(value);
+}
+
+/**
+ * @return The names of the bits set in an inotify mask, or just the number elsewhere.
+ */
+static QString describeMask(quint32 mask)
+{
+	QString result = "0x" + QString::number(mask, 16);
+#ifdef Q_OS_LINUX
+	static const quint32 BITS[] = {
+		IN_ACCESS, IN_MODIFY, IN_ATTRIB, IN_CLOSE_WRITE, IN_CLOSE_NOWRITE, IN_OPEN,
+		IN_MOVED_FROM, IN_MOVED_TO, IN_CREATE, IN_DELETE, IN_DELETE_SELF, IN_MOVE_SELF,
+		IN_UNMOUNT, IN_Q_OVERFLOW, IN_IGNORED, IN_ISDIR
+	};
+	static const char * NAMES[] = {
+		"ACCESS", "MODIFY", "ATTRIB", "CLOSE_WRITE", "CLOSE_NOWRITE", "OPEN",
+		"MOVED_FROM", "MOVED_TO", "CREATE", "DELETE", "DELETE_SELF", "MOVE_SELF",
+		"UNMOUNT", "Q_OVERFLOW", "IGNORED", "ISDIR"
+	};
+	static const size_t NUM_BITS = sizeof(BITS) / sizeof(BITS[0]);
+
+	QStringList names;
+	for (size_t i = 0; i < NUM_BITS; ++i)
+	{
+		if ((mask & BITS[i]) != 0)
+		{
+			names += NAMES[i];
+		}
+	}
+	if (!names.isEmpty())
+	{
+		result += "(" + names.join("|") + ")";
+	}
+#endif /* Q_OS_LINUX */
+	return result;
+}
+
+int main(int argc, char ** argv)
+{
+	QCoreApplication application(argc, argv);
+	QTextStream err(stderr);
+	if (application.arguments().size() != 2)
+	{
+		err << "Usage: tracedump FILE" << endl;
+		return 1;
+	}
+
+	QFile file(application.arguments().at(1));
+	if (!file.open(QIODevice::ReadOnly))
+	{
+		err << "Unable to open " << file.fileName() << endl;
+		return 1;
+	}
+
+	char magic[8];
+	quint32 recordSize;
+	quint32 numThreads;
+	if (file.read(magic, sizeof(magic)) != sizeof(magic) || qstrncmp(magic, "FNTRACE1", sizeof(magic)) != 0)
+	{
+		err << file.fileName() << " is not a trace dump" << endl;
+		return 1;
+	}
+	if (!readValue(file, recordSize) || !readValue(file, numThreads))
+	{
+		err << "Truncated header" << endl;
+		return 1;
+	}
+	if (recordSize != sizeof(Trace::Record))
+	{
+		err << "Records are " << recordSize << " bytes, expected " << sizeof(Trace::Record)
+			<< " - the dump was written by a different version" << endl;
+		return 1;
+	}
+
+	QVector<Entry> entries;
+	for (quint32 i = 0; i < numThreads; ++i)
+	{
+		Entry entry;
+		quint32 count;
+		if (!readValue(file, entry.thread) || !readValue(file, count))
+		{
+			err << "Truncated dump" << endl;
+			return 1;
+		}
+		for (quint32 j = 0; j < count; ++j)
+		{
+			if (!readValue(file, entry.record))
+			{
+				err << "Truncated dump" << endl;
+				return 1;
+			}
+			entries += entry;
+		}
+	}
+	qStableSort(entries.begin(), entries.end(), earlier);
+
+	QTextStream out(stdout);
+	quint64 start = entries.isEmpty() ? 0 : entries.first().record.timestamp;
+	foreach(const Entry & entry, entries)
+	{
+		const Trace::Record & record = entry.record;
+		const char * name = Trace::eventName(record.event);
+
+		out << QString::number((record.timestamp - start) / 1e6, 'f', 6) << " ms"
+			<< " thread=0x" << QString::number(entry.thread, 16)
+			<< " " << (name != NULL ? QString(name) : "unknown-" + QString::number(record.event));
+		if (record.handle != -1)
+		{
+			out << " wd=" << record.handle;
+		}
+		if (record.mask != 0)
+		{
+			out << " mask=" << describeMask(record.mask);
+		}
+		if (record.value != 0)
+		{
+			out << " value=" << record.value;
+		}
+		out << endl;
+	}
+	return 0;
+}
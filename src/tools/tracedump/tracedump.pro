@@ -0,0 +1,11 @@
+PROJECT = tracedump
+TEMPLATE = app
+
+include(../tools.pri)
+
+SOURCES += tracedump.cpp
+
+LIBS += -lfnotify
+
+DEPENDPATH += $$BASE/core
+INCLUDEPATH += $$BASE
@@ -21,9 +21,14 @@ else
 	USE_GDB=
 fi
 
-TESTS="plugin_test core_test smoke_test functionality_test"
+TESTS="plugin_test core_test smoke_test functionality_test delivery_test"
 BIN_DIR=bin
 
+# Benchmarks only run when BENCH is set.  Each one appends machine-readable results
+# (one JSON object per line) to BENCH_OUTPUT.
+BENCHMARKS="throughput_bench recursive_bench"
+BENCH_OUTPUT=${BENCH_OUTPUT:-$(pwd)/bench_output.txt}
+
 case $(uname) in
 	"Linux")
 		NUM_CPUS=$(cat /proc/cpuinfo | grep '^processor	: [0-9][0-9]*$' | wc -l)
@@ -65,5 +70,22 @@ for test in $TESTS; do
 	fi	
 done
 
+if [[ -n $BENCH ]]; then
+	for bench in $BENCHMARKS; do
+		NUM_TESTS=$((NUM_TESTS+1))
+
+		echo "Running benchmark ./$bench"
+		$USE_GDB ./$bench --output "$BENCH_OUTPUT"
+		if [[ $? -ne 0 ]]; then
+			FAILED="$FAILED $bench"
+			NUM_FAILED=$((NUM_FAILED+1))
+		else
+			SUCCEEDED="$SUCCEEDED $bench"
+			NUM_SUCCEEDED=$((NUM_SUCCEEDED+1))
+		fi
+	done
+	echo "Benchmark results appended to $BENCH_OUTPUT"
+fi
+
 echo "Failed: $NUM_FAILED / $NUM_TESTS: $FAILED"
 echo "OK    : $NUM_SUCCEEDED / $NUM_TESTS: $SUCCEEDED"